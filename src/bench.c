@@ -0,0 +1,352 @@
+/* Micro-benchmarks for the parts of wlterm that don't need a display.
+ *
+ * Usage: wlterm-bench <benchmark> [args...] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "document.h"
+#include "grid.h"
+#include "pty.h"
+#include "scrollback.h"
+#include "vt.h"
+
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* `yes`-style output: many short lines, every one of them scrolls. */
+static int bench_scroll(int argc, char *argv[]) {
+    long lines = argc > 0 ? atol(argv[0]) : 10000000;
+    struct wlterm_grid *g = wlterm_grid_create(50, 200);
+
+    double start = now();
+    for (long i = 0; i < lines; ++i)
+        wlterm_grid_write(g, "y\n", 2);
+    double elapsed = now() - start;
+
+    printf("scroll: %ld lines in %.3f s, %.0f lines/s\n", lines, elapsed, lines / elapsed);
+
+    wlterm_grid_destroy(g);
+    return 0;
+}
+
+static void feed_vt(void *data, const char *buf, size_t len) {
+    wlterm_vt_feed(data, buf, len);
+}
+
+/* A flood of output through a real PTY, consumed the same way the main loop
+   does it but with no compositor in the way. */
+static int bench_pty(int argc, char *argv[]) {
+    long bytes = argc > 0 ? atol(argv[0]) : 1L << 30;
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "yes | head -c %ld", bytes);
+    char *args[] = {"/bin/sh", "-c", cmd, NULL};
+
+    struct wlterm_grid *g = wlterm_grid_create(50, 200);
+    struct wlterm_vt *vt = wlterm_vt_create(g);
+
+    double start = now();
+    struct wlterm_pty *pty = wlterm_pty_create(args, g->rows, g->cols);
+    if (!pty)
+        return 1;
+
+    size_t total = 0;
+    while (!wlterm_pty_done(pty)) {
+        struct pollfd fd = {.fd = pty->event_fd, .events = POLLIN};
+        poll(&fd, 1, -1);
+        total += wlterm_pty_drain(pty, feed_vt, vt);
+    }
+    double elapsed = now() - start;
+
+    printf("pty: %zu bytes in %.3f s, %.1f MB/s\n", total, elapsed, total / elapsed / 1e6);
+
+    wlterm_pty_destroy(pty);
+    wlterm_vt_destroy(vt);
+    wlterm_grid_destroy(g);
+    return 0;
+}
+
+/* Plain ASCII lines of `width` characters, nothing for the parser to do
+   but write cells and scroll. */
+static int bench_text(int argc, char *argv[]) {
+    size_t size = argc > 0 ? atol(argv[0]) : 256 << 20;
+    int width = argc > 1 ? atoi(argv[1]) : 80;
+    char *buf = malloc(size);
+    size_t line = width + 2;
+
+    for (size_t i = 0; i < size; ++i)
+        buf[i] = i % line == line - 2 ? '\r' : i % line == line - 1 ? '\n' : 'a' + i % 26;
+
+    struct wlterm_grid *g = wlterm_grid_create(50, 200);
+    struct wlterm_vt *vt = wlterm_vt_create(g);
+
+    double start = now();
+    for (size_t o = 0; o < size; o += WLTERM_PTY_CHUNK_SIZE) {
+        size_t n = size - o < WLTERM_PTY_CHUNK_SIZE ? size - o : WLTERM_PTY_CHUNK_SIZE;
+        wlterm_vt_feed(vt, buf + o, n);
+    }
+    double elapsed = now() - start;
+
+    printf("text: %zu bytes of %d column lines in %.3f s, %.1f MB/s\n", size, width,
+           elapsed, size / elapsed / 1e6);
+
+    wlterm_vt_destroy(vt);
+    wlterm_grid_destroy(g);
+    free(buf);
+    return 0;
+}
+
+/* Lines of mostly non-ASCII text: Cyrillic, Greek, box drawing and CJK,
+   which all go through the UTF-8 decoder rather than the ASCII scan. */
+static int bench_utf8(int argc, char *argv[]) {
+    size_t size = argc > 0 ? atol(argv[0]) : 256 << 20;
+    static const char line[] =
+        "Съешь же ещё этих мягких французских булок, да выпей чаю │ "
+        "λόγος ─ 日本語のテキスト\r\n";
+    char *buf = malloc(size);
+
+    for (size_t i = 0; i < size; i += sizeof(line) - 1)
+        memcpy(buf + i, line, size - i < sizeof(line) - 1 ? size - i : sizeof(line) - 1);
+
+    struct wlterm_grid *g = wlterm_grid_create(50, 200);
+    struct wlterm_vt *vt = wlterm_vt_create(g);
+
+    double start = now();
+    for (size_t o = 0; o < size; o += WLTERM_PTY_CHUNK_SIZE) {
+        size_t n = size - o < WLTERM_PTY_CHUNK_SIZE ? size - o : WLTERM_PTY_CHUNK_SIZE;
+        wlterm_vt_feed(vt, buf + o, n);
+    }
+    double elapsed = now() - start;
+
+    printf("utf8: %zu bytes in %.3f s, %.1f MB/s, %lu lines\n", size, elapsed,
+           size / elapsed / 1e6, g->lines_scrolled);
+
+    wlterm_vt_destroy(vt);
+    wlterm_grid_destroy(g);
+    free(buf);
+    return 0;
+}
+
+/* Log output with a bit of variety: counters, timestamps and colors. */
+static char *make_log(size_t size) {
+    char *buf = malloc(size + 256);
+    size_t len = 0;
+
+    for (unsigned i = 0; len < size; ++i) {
+        unsigned t = i * 7919;
+        if (i % 3 == 2)
+            len += sprintf(buf + len, "2020-05-01 12:%02u:%02u.%03u \x1b[33mWARN\x1b[0m  "
+                           "[pool-%u] retrying connection %u ─ λ\r\n", t / 60000 % 60,
+                           t / 1000 % 60, t % 1000, i % 7, i);
+        else
+            len += sprintf(buf + len, "2020-05-01 12:%02u:%02u.%03u INFO  [main] request %u "
+                           "handled in %u ms, status=200 OK\r\n", t / 60000 % 60,
+                           t / 1000 % 60, t % 1000, i, t % 97);
+    }
+    return buf;
+}
+
+/* Parse a large plain text log dump, the common case the fast path is for.
+   The input is generated up front so only the parser is measured. */
+static int bench_parse(int argc, char *argv[]) {
+    size_t size = argc > 0 ? atol(argv[0]) : 256 << 20;
+    int rounds = argc > 1 ? atoi(argv[1]) : 4;
+    char *buf = make_log(size);
+
+    struct wlterm_grid *g = wlterm_grid_create(50, 200);
+    struct wlterm_vt *vt = wlterm_vt_create(g);
+
+    double start = now();
+    for (int r = 0; r < rounds; ++r) {
+        /* Chunks the size the PTY reader hands over. */
+        for (size_t o = 0; o < size; o += WLTERM_PTY_CHUNK_SIZE) {
+            size_t n = size - o < WLTERM_PTY_CHUNK_SIZE ? size - o : WLTERM_PTY_CHUNK_SIZE;
+            wlterm_vt_feed(vt, buf + o, n);
+        }
+    }
+    double elapsed = now() - start;
+    double bytes = (double)size * rounds;
+
+    printf("parse: %.0f bytes in %.3f s, %.1f MB/s, %lu lines\n", bytes, elapsed,
+           bytes / elapsed / 1e6, g->lines_scrolled);
+
+    wlterm_vt_destroy(vt);
+    wlterm_grid_destroy(g);
+    free(buf);
+    return 0;
+}
+
+/* Fill the scrollback with log output, then jump around in it. Reports the
+   memory used per million lines against storing every cell raw. */
+static int bench_scrollback(int argc, char *argv[]) {
+    long lines = argc > 0 ? atol(argv[0]) : 1000000;
+    int lookups = argc > 1 ? atoi(argv[1]) : 100000;
+    const size_t chunk = 1 << 20;
+    char *buf = make_log(chunk);
+
+    struct wlterm_grid *g = wlterm_grid_create(50, 200);
+    struct wlterm_vt *vt = wlterm_vt_create(g);
+    struct wlterm_scrollback *sb = wlterm_scrollback_create(lines);
+    g->scrollback = sb;
+
+    double start = now();
+    while (sb->n_lines < (size_t)lines)
+        wlterm_vt_feed(vt, buf, chunk);
+    double elapsed = now() - start;
+
+    struct wlterm_scrollback_stats stats;
+    wlterm_scrollback_stats(sb, &stats);
+    double bytes = stats.hot_bytes + stats.cold_bytes;
+    double raw = (double)stats.lines * g->cols * (3 * sizeof(uint32_t) + 1);
+
+    printf("scrollback: %lu lines in %.3f s, %.0f lines/s\n", stats.lines, elapsed,
+           stats.lines / elapsed);
+    printf("scrollback: %.1f MB per million lines, %lu pages, %.1fx smaller than raw "
+           "cells\n", bytes / stats.lines, stats.pages, raw / bytes);
+
+    /* Random lines, mostly in cold pages. */
+    srand(1);
+    uint64_t checksum = 0;
+    start = now();
+    for (int i = 0; i < lookups; ++i) {
+        struct wlterm_scrollback_line l;
+        if (wlterm_scrollback_line(sb, rand() % stats.lines, &l) && l.cols)
+            checksum += l.codepoints[0];
+    }
+    elapsed = now() - start;
+    printf("scrollback: %d random lookups in %.3f s, %.0f lookups/s, "
+           "%lu pages decompressed (%lx)\n", lookups, elapsed, lookups / elapsed,
+           sb->decompressed, checksum);
+
+    /* Scrolling back page by page, the common case. */
+    uint64_t decompressed = sb->decompressed;
+    start = now();
+    for (size_t n = 0; n < stats.lines; ++n) {
+        struct wlterm_scrollback_line l;
+        wlterm_scrollback_line(sb, n, &l);
+    }
+    elapsed = now() - start;
+    printf("scrollback: read back all lines in %.3f s, %.0f lines/s, %lu pages "
+           "decompressed\n", elapsed, stats.lines / elapsed, sb->decompressed - decompressed);
+
+    g->scrollback = NULL;
+    wlterm_scrollback_destroy(sb);
+    wlterm_vt_destroy(vt);
+    wlterm_grid_destroy(g);
+    free(buf);
+    return 0;
+}
+
+/* Open a large log file for viewing: the time until the first screen can
+   be drawn, until the whole file is indexed, and random lookups. The file
+   is written first unless `path` already exists. Without a path it goes to
+   a temporary file, removed afterwards. */
+static int bench_document(int argc, char *argv[]) {
+    size_t size = argc > 0 ? atol(argv[0]) : 256 << 20;
+    int lookups = argc > 2 ? atoi(argv[2]) : 100000;
+    char tmp[] = "/tmp/wlterm-bench-document-XXXXXX";
+    const char *path = argc > 1 ? argv[1] : tmp;
+    int fd = -1;
+
+    if (argc <= 1 && (fd = mkstemp(tmp)) < 0) {
+        perror(tmp);
+        return 1;
+    }
+    if (fd >= 0 || access(path, R_OK) != 0) {
+        const size_t chunk = 64 << 20;
+        char *buf = make_log(chunk);
+        FILE *f = fd >= 0 ? fdopen(fd, "w") : fopen(path, "w");
+        if (!f) {
+            perror(path);
+            if (fd >= 0)
+                unlink(tmp);
+            return 1;
+        }
+        for (size_t n = 0; n < size; n += chunk)
+            fwrite(buf, 1, size - n < chunk ? size - n : chunk, f);
+        fclose(f);
+        free(buf);
+    }
+
+    double start = now();
+    struct wlterm_document *d = wlterm_document_open(path);
+    /* The open document keeps its mapping. */
+    if (fd >= 0)
+        unlink(tmp);
+    if (!d) {
+        perror(path);
+        return 1;
+    }
+
+    /* What a first screen needs. */
+    size_t bytes = 0;
+    for (size_t n = 0; n < 50; ++n) {
+        const char *line;
+        size_t len;
+        if (wlterm_document_line(d, n, &line, &len) && len > 0)
+            bytes += len + line[0];
+    }
+    double first_screen = now() - start;
+
+    wlterm_document_wait(d);
+    double elapsed = now() - start;
+    size_t lines = wlterm_document_lines(d);
+
+    printf("document: %zu bytes, first screen after %.3f ms\n", d->size,
+           first_screen * 1e3);
+    printf("document: %zu lines indexed in %.3f s, %.2f GB/s, index of %zu KiB\n",
+           lines, elapsed, d->size / elapsed / 1e9,
+           (d->n_chunks + 1) * sizeof(uint64_t) >> 10);
+
+    srand(1);
+    start = now();
+    for (int i = 0; i < lookups; ++i) {
+        const char *line;
+        size_t len;
+        if (wlterm_document_line(d, ((size_t)rand() * RAND_MAX + rand()) % lines, &line, &len))
+            bytes += len;
+    }
+    elapsed = now() - start;
+    printf("document: %d random lookups in %.3f s, %.0f lookups/s (%zx)\n", lookups,
+           elapsed, lookups / elapsed, bytes);
+
+    wlterm_document_close(d);
+    return 0;
+}
+
+static const struct {
+    const char *name;
+    const char *args;
+    int (*run)(int, char *[]);
+} benchmarks[] = {
+    {"scroll", "[lines]", bench_scroll},
+    {"pty", "[bytes]", bench_pty},
+    {"parse", "[bytes] [rounds]", bench_parse},
+    {"text", "[bytes] [width]", bench_text},
+    {"utf8", "[bytes]", bench_utf8},
+    {"scrollback", "[lines] [lookups]", bench_scrollback},
+    {"document", "[bytes] [path] [lookups]", bench_document},
+};
+
+int main(int argc, char *argv[]) {
+    size_t n = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+    for (size_t i = 0; argc >= 2 && i < n; ++i)
+        if (strcmp(argv[1], benchmarks[i].name) == 0)
+            return benchmarks[i].run(argc - 2, argv + 2);
+
+    if (argc >= 2)
+        fprintf(stderr, "unknown benchmark: %s\n", argv[1]);
+    fprintf(stderr, "usage: %s <benchmark> [args...]\n", argv[0]);
+    for (size_t i = 0; i < n; ++i)
+        fprintf(stderr, "  %s %s\n", benchmarks[i].name, benchmarks[i].args);
+    return 1;
+}
@@ -2,10 +2,10 @@
 
 precision mediump float;
 
+in vec3 runColor;
 out vec4 color;
-uniform vec3 accentColor;
 
 void main() {
     
-    color = vec4(accentColor, 1.0);
+    color = vec4(runColor, 1.0);
 }
@@ -1,11 +1,16 @@
 #version 320 es
 
 layout (location = 0) in vec4 vertex;
+/* 0xRRGGBBAA, read as bytes on a little-endian host: (a, b, g, r). */
+layout (location = 1) in vec4 vertexColor;
 
 uniform mat4 projection;
 
+out vec3 runColor;
+
 void main() {
     
     gl_Position = projection * vec4(vertex.xy, 0.0, 1.0);
+    runColor = vertexColor.wzy;
 
 }
@@ -0,0 +1,36 @@
+#version 320 es
+
+/* Drawn over a window with rows-vertex.glsl, tex_pos being the position in
+   cells. Positions run into the hundreds, mediump can't place them. */
+precision highp float;
+precision highp int;
+in vec2 tex_pos;
+
+/* A texel per cell: sprite, foreground, background, attributes. */
+uniform highp usampler2D cells;
+uniform sampler2D sprites;
+uniform ivec2 slot;    /* Size of a sprite's slot, in texels. */
+uniform vec2 glyph;    /* Size of a cell, in texels. */
+uniform int per_row;   /* Slots in a row of the sprite texture. */
+
+out vec4 color;
+
+vec3 unpack(uint c) {
+    return vec3(float(c >> 24), float(c >> 16 & 255u), float(c >> 8 & 255u)) / 255.0;
+}
+
+void main() {
+    ivec2 cell = ivec2(floor(tex_pos));
+    if (any(greaterThanEqual(cell, textureSize(cells, 0))))
+        discard;
+    uvec4 c = texelFetch(cells, cell, 0);
+
+    /* Slots are laid out from the top left, like rows in a window. */
+    int sprite = int(c.x);
+    ivec2 texel = ivec2(sprite % per_row, sprite / per_row) * slot +
+        ivec2(fract(tex_pos) * glyph);
+    texel.y = textureSize(sprites, 0).y - 1 - texel.y;
+    float coverage = texelFetch(sprites, texel, 0).a;
+
+    color = vec4(mix(unpack(c.z), unpack(c.y), coverage), 1.0);
+}
@@ -0,0 +1,108 @@
+/* Asks a running `wlterm --server` to open a new frame.
+ *
+ * Usage: wlterm-client [--bench N [WLTERM]]
+ *
+ * With --bench, measures the time until the first frame is drawn, N times
+ * through the server and N times by starting a new `wlterm --once` process
+ * (WLTERM, default "wlterm" from $PATH). */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "server.h"
+
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int request(const char *path, const char *req) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "wlterm-client: can't connect to %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    dprintf(fd, "%s\n", req);
+
+    char buf[128];
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        fprintf(stderr, "wlterm-client: no reply from server\n");
+        return -1;
+    }
+    buf[n] = '\0';
+    if (strncmp(buf, "ok", 2) != 0) {
+        fprintf(stderr, "wlterm-client: %s", buf);
+        return -1;
+    }
+    return 0;
+}
+
+static void report(const char *name, double *t, int n) {
+    double sum = 0, min = t[0], max = t[0];
+    for (int i = 0; i < n; ++i) {
+        sum += t[i];
+        min = t[i] < min ? t[i] : min;
+        max = t[i] > max ? t[i] : max;
+    }
+    printf("%s: mean %.2f ms, min %.2f ms, max %.2f ms over %d frames\n",
+           name, sum / n * 1e3, min * 1e3, max * 1e3, n);
+}
+
+static int bench(const char *path, int n, const char *wlterm) {
+    double *t = malloc(n * sizeof(double));
+
+    for (int i = 0; i < n; ++i) {
+        double start = now();
+        if (request(path, "frame-once"))
+            return 1;
+        t[i] = now() - start;
+    }
+    report("server", t, n);
+
+    for (int i = 0; i < n; ++i) {
+        double start = now();
+        pid_t pid = fork();
+        if (pid == 0) {
+            execlp(wlterm, wlterm, "--once", (char *)NULL);
+            _exit(127);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+            fprintf(stderr, "wlterm-client: %s --once failed\n", wlterm);
+            return 1;
+        }
+        t[i] = now() - start;
+    }
+    report("process", t, n);
+
+    free(t);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    char *path = wlterm_server_socket_path();
+    int ret;
+
+    if (argc > 2 && strcmp(argv[1], "--bench") == 0)
+        ret = bench(path, atoi(argv[2]), argc > 3 ? argv[3] : "wlterm");
+    else
+        ret = request(path, "frame") ? 1 : 0;
+
+    free(path);
+    return ret;
+}
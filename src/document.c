@@ -0,0 +1,194 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "document.h"
+
+
+#define CHUNK WLTERM_DOCUMENT_CHUNK
+
+static uint64_t count_newlines(const char *p, size_t n) {
+    uint64_t count = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    /* 64 bytes per round: compare against '\n' and count the set bits of
+       the byte masks. */
+    const __m128i nl = _mm_set1_epi8('\n');
+    for (; i + 64 <= n; i += 64) {
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), nl);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i + 16)), nl);
+        __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i + 32)), nl);
+        __m128i d = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i + 48)), nl);
+        uint64_t mask = (uint64_t)_mm_movemask_epi8(a) |
+                        (uint64_t)_mm_movemask_epi8(b) << 16 |
+                        (uint64_t)_mm_movemask_epi8(c) << 32 |
+                        (uint64_t)_mm_movemask_epi8(d) << 48;
+        count += __builtin_popcountll(mask);
+    }
+#endif
+
+    /* Whatever is left, or all of it without SSE2: memchr is vectorized in
+       any libc worth using. */
+    const char *end = p + n;
+    for (p += i; (p = memchr(p, '\n', end - p)); ++p)
+        count++;
+    return count;
+}
+
+static size_t chunk_size(struct wlterm_document *d, size_t c) {
+    size_t start = c * CHUNK;
+    return d->size - start < CHUNK ? d->size - start : CHUNK;
+}
+
+static void index_chunk(struct wlterm_document *d, size_t c) {
+    d->newlines[c + 1] = d->newlines[c] + count_newlines(d->data + c * CHUNK,
+                                                         chunk_size(d, c));
+    atomic_store_explicit(&d->indexed, c + 1, memory_order_release);
+}
+
+static void *indexer_thread(void *data) {
+    struct wlterm_document *d = data;
+
+    for (size_t c = atomic_load(&d->indexed); c < d->n_chunks; ++c) {
+        if (atomic_load_explicit(&d->quit, memory_order_relaxed))
+            break;
+        index_chunk(d, c);
+
+        /* Pages already counted won't be needed again until they are looked
+           at, let the kernel drop them first. */
+#ifdef MADV_COLD
+        if (c % 1024 == 1023) {
+            size_t start = (c - 1023) * CHUNK;
+            madvise((void *)(d->data + start), 1024 * CHUNK, MADV_COLD);
+        }
+#endif
+    }
+    return NULL;
+}
+
+/* Map `path` and index its first chunk. The rest is indexed in the
+   background. Returns NULL if the file can't be opened. */
+struct wlterm_document *wlterm_document_open(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+
+    struct wlterm_document *d = calloc(1, sizeof(struct wlterm_document));
+    d->size = st.st_size;
+    d->data = "";
+    if (d->size) {
+        void *data = mmap(NULL, d->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            free(d);
+            return NULL;
+        }
+        d->data = data;
+        madvise(data, d->size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    d->n_chunks = (d->size + CHUNK - 1) / CHUNK;
+    d->newlines = calloc(d->n_chunks + 1, sizeof(uint64_t));
+    atomic_init(&d->indexed, 0);
+    atomic_init(&d->quit, false);
+
+    if (d->n_chunks)
+        index_chunk(d, 0);
+    if (d->n_chunks > 1)
+        d->indexer_running = pthread_create(&d->indexer, NULL, indexer_thread, d) == 0;
+
+    /* Without a thread, index everything right here. */
+    if (!d->indexer_running)
+        indexer_thread(d);
+
+    return d;
+}
+
+void wlterm_document_close(struct wlterm_document *d) {
+    if (!d)
+        return;
+
+    atomic_store(&d->quit, true);
+    if (d->indexer_running)
+        pthread_join(d->indexer, NULL);
+
+    if (d->size)
+        munmap((void *)d->data, d->size);
+    free(d->newlines);
+    free(d);
+}
+
+bool wlterm_document_indexed(struct wlterm_document *d) {
+    return atomic_load_explicit(&d->indexed, memory_order_acquire) == d->n_chunks;
+}
+
+/* Block until the whole document is indexed. */
+void wlterm_document_wait(struct wlterm_document *d) {
+    if (d->indexer_running) {
+        pthread_join(d->indexer, NULL);
+        d->indexer_running = false;
+    }
+}
+
+/* Lines that can be looked up so far, all of them once indexed. A last line
+   without a newline counts. */
+size_t wlterm_document_lines(struct wlterm_document *d) {
+    size_t indexed = atomic_load_explicit(&d->indexed, memory_order_acquire);
+    size_t lines = d->newlines[indexed];
+
+    if (indexed == d->n_chunks && d->size && d->data[d->size - 1] != '\n')
+        lines++;
+    return lines;
+}
+
+/* Point `line` at the start of line n, `len` bytes long without its newline.
+   False if the line doesn't exist, or isn't indexed yet. */
+bool wlterm_document_line(struct wlterm_document *d, size_t n, const char **line,
+                          size_t *len) {
+    if (n >= wlterm_document_lines(d))
+        return false;
+
+    const char *start = d->data;
+    if (n > 0) {
+        /* The chunk holding the n-th newline: the last one with fewer than n
+           newlines before it. */
+        size_t lo = 0, hi = atomic_load_explicit(&d->indexed, memory_order_acquire);
+        while (hi - lo > 1) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (d->newlines[mid] < n)
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        const char *p = d->data + lo * CHUNK;
+        const char *end = p + chunk_size(d, lo);
+        for (uint64_t left = n - d->newlines[lo]; ; ++p) {
+            p = memchr(p, '\n', end - p);
+            if (--left == 0)
+                break;
+        }
+        start = p + 1;
+    }
+
+    const char *end = d->data + d->size;
+    const char *nl = memchr(start, '\n', end - start);
+    *line = start;
+    *len = (nl ? nl : end) - start;
+    return true;
+}
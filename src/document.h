@@ -0,0 +1,46 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* The line index has an entry per chunk of this many bytes. */
+#define WLTERM_DOCUMENT_CHUNK (64 * 1024)
+
+/* A file opened for viewing, read-only and never copied.
+ *
+ * The file is memory-mapped and lines are handed out as pointers into the
+ * mapping. The index only records how many lines start before each chunk:
+ * line n is found with a binary search for its chunk, then a scan of that
+ * chunk alone. A background thread builds the index front to back; the
+ * first chunk is indexed before the document is returned, so the start of
+ * the file can be shown right away, and lines further down become available
+ * as the indexer gets to them. */
+struct wlterm_document {
+    const char *data;
+    size_t size;
+
+    /* newlines[c] is the number of newlines before chunk c, for c up to
+       n_chunks. Entries up to `indexed` are valid, published by the indexer
+       with release semantics. */
+    uint64_t *newlines;
+    size_t n_chunks;
+    atomic_size_t indexed;
+
+    pthread_t indexer;
+    bool indexer_running;
+    atomic_bool quit;
+};
+
+struct wlterm_document *wlterm_document_open(const char *path);
+void wlterm_document_close(struct wlterm_document *);
+bool wlterm_document_indexed(struct wlterm_document *);
+void wlterm_document_wait(struct wlterm_document *);
+size_t wlterm_document_lines(struct wlterm_document *);
+bool wlterm_document_line(struct wlterm_document *, size_t n, const char **line,
+                          size_t *len);
+
+#endif /* DOCUMENT_H */
@@ -2,11 +2,16 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
-#include <GLES2/gl2.h>
+#include <GLES3/gl32.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 
+/* Generated at build time from the .glsl files, see embed-shaders.c. */
+#include "_wlterm_shaders.h"
+
 
 bool check_egl_extension(const char *extensions, const char *extension) {
 	size_t extlen = strlen(extension);
@@ -61,6 +66,30 @@ EGLDisplay platform_get_egl_display(EGLenum platform, void *native_display,
 	return eglGetDisplay((EGLNativeDisplayType) native_display);
 }
 
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+/* A display that needs no window system, e.g. Mesa's llvmpipe on a machine
+ * without a GPU. Uses the surfaceless platform when available, otherwise
+ * whatever the default display is. */
+EGLDisplay platform_get_headless_egl_display(void) {
+	const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = NULL;
+
+	if (extensions &&
+	    check_egl_extension(extensions, "EGL_MESA_platform_surfaceless") &&
+	    check_egl_extension(extensions, "EGL_EXT_platform_base"))
+		get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+			eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+	if (get_platform_display)
+		return get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+					    EGL_DEFAULT_DISPLAY, NULL);
+
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
 EGLSurface platform_create_egl_surface(EGLDisplay dpy, EGLConfig config,
 				   void *native_window, const EGLint *attrib_list) {
 	static PFNEGLCREATEPLATFORMWINDOWSURFACEEXTPROC
@@ -86,6 +115,32 @@ EGLBoolean platform_destroy_egl_surface(EGLDisplay display, EGLSurface surface)
 	return eglDestroySurface(display, surface);
 }
 
+EGLBoolean platform_swap_buffers_with_damage(EGLDisplay display, EGLSurface surface,
+					     EGLint *rects, EGLint n_rects) {
+	static PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC swap_with_damage = NULL;
+	static bool checked = false;
+
+	if (!checked) {
+		const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+		checked = true;
+
+		if (extensions &&
+		    check_egl_extension(extensions, "EGL_KHR_swap_buffers_with_damage"))
+			swap_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+				eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+		else if (extensions &&
+			 check_egl_extension(extensions, "EGL_EXT_swap_buffers_with_damage"))
+			swap_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)
+				eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+	}
+
+	/* Without the extension the whole surface is damaged on swap. */
+	if (swap_with_damage && n_rects > 0)
+		return swap_with_damage(display, surface, rects, n_rects);
+
+	return eglSwapBuffers(display, surface);
+}
+
 GLuint
 create_shader(const char *source, GLenum shader_type)
 {
@@ -111,51 +166,210 @@ create_shader(const char *source, GLenum shader_type)
 	return shader;
 }
 
-char *read_file(const char *filename) {
-    char *buffer = NULL;
-    long length;
-    FILE *f = fopen(filename, "rb");
-
-    if (f) {
-        fseek(f, 0, SEEK_END);
-        length = ftell(f);
-        fseek(f, 0, SEEK_SET);
-        buffer = malloc(length + 1);
-        memset(buffer, 0, length + 1);
+const char *
+shader_source(const char *name)
+{
+	for (size_t i = 0; i < sizeof(wlterm_shaders) / sizeof(wlterm_shaders[0]); i++)
+		if (strcmp(wlterm_shaders[i].name, name) == 0)
+			return wlterm_shaders[i].source;
+	return NULL;
+}
 
-        if (buffer) {
-            fread(buffer, 1, length, f);
-        }
-        fclose(f);
-    }
-    /* fprintf(stderr, buffer); */
-    return buffer;
+static GLuint
+make_shader(const char *name, GLenum type)
+{
+	const char *source = shader_source(name);
+	if (!source) {
+		fprintf(stderr, "Error: no shader named %s\n", name);
+		exit(1);
+	}
+	return create_shader(source, type);
 }
 
+/* Program binary cache.
+ *
+ * Linked programs are saved with glGetProgramBinary, so later launches can
+ * load them with glProgramBinary instead of compiling any GLSL. A binary is
+ * only good for the driver that produced it: the key covers the GL vendor,
+ * renderer and version strings as well as the shader sources, and a binary
+ * the driver rejects anyway is simply rebuilt from source.
+ *
+ * Layout: struct program_cache_header followed by `length` bytes. */
+
+#define PROGRAM_CACHE_MAGIC 0x50474c57  /* "WLGP" */
+#define PROGRAM_CACHE_VERSION 1
+
+struct program_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t format;
+	uint32_t length;
+};
+
+static uint64_t
+fnv1a(uint64_t h, const char *s)
+{
+	while (s && *s) {
+		h ^= (unsigned char)*s++;
+		h *= 0x100000001b3ull;
+	}
+	/* Separator, so "ab" + "c" differs from "a" + "bc". */
+	h ^= 0xff;
+	h *= 0x100000001b3ull;
+	return h;
+}
 
-char **read_buffer_contents(const char *filename, uint32_t *len) {
-    char *file = read_file(filename);
-    
-    char *fp;
-    
-    /* Count the number of lines. */
-    *len = 1;
-    fp = &file[0] - 1;
-    while (*++fp) if (*fp == '\n') (*len)++;
-    
-    char **lines = malloc(*len * sizeof(char *));
+static uint64_t
+program_key(const char **sources, int n)
+{
+	uint64_t h = 0xcbf29ce484222325ull;
+
+	h = fnv1a(h, (const char *)glGetString(GL_VENDOR));
+	h = fnv1a(h, (const char *)glGetString(GL_RENDERER));
+	h = fnv1a(h, (const char *)glGetString(GL_VERSION));
+	for (int i = 0; i < n; i++)
+		h = fnv1a(h, sources[i]);
+	return h;
+}
 
-    char **lp = &lines[0];
-    *lp = &file[0];
+static bool
+program_cache_path(char *path, size_t size, uint64_t key)
+{
+	const char *dir = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+
+	if (dir && *dir)
+		snprintf(path, size, "%s/wlterm", dir);
+	else if (home)
+		snprintf(path, size, "%s/.cache/wlterm", home);
+	else
+		return false;
+	mkdir(path, 0700);
+
+	size_t len = strlen(path);
+	snprintf(path + len, size - len, "/program-%016llx", (unsigned long long)key);
+	return true;
+}
 
-    fp = &file[0] - 1;
-    while (*++fp) {
-        if (*fp == '\n') {
-            *fp = '\0';
-            *++lp = fp + 1;
-        }
-    }
+static bool
+load_program_binary(GLuint program, const char *path, uint64_t key)
+{
+	struct program_cache_header h;
+	FILE *f = fopen(path, "rb");
+	if (!f)
+		return false;
+
+	bool ok = fread(&h, sizeof(h), 1, f) == 1 &&
+		h.magic == PROGRAM_CACHE_MAGIC &&
+		h.version == PROGRAM_CACHE_VERSION && h.key == key;
+	void *binary = ok ? malloc(h.length) : NULL;
+	ok = binary && fread(binary, 1, h.length, f) == h.length;
+	fclose(f);
+
+	if (ok) {
+		GLint status;
+		glProgramBinary(program, h.format, binary, h.length);
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		ok = status;
+	}
+	free(binary);
+	return ok;
+}
 
-    return lines;
+static void
+save_program_binary(GLuint program, const char *path, uint64_t key)
+{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	struct program_cache_header h = {
+		.magic = PROGRAM_CACHE_MAGIC,
+		.version = PROGRAM_CACHE_VERSION,
+		.key = key,
+	};
+	void *binary = malloc(length);
+	GLsizei written = 0;
+	glGetProgramBinary(program, length, &written, &h.format, binary);
+	h.length = written;
+
+	/* Replace atomically, a concurrent reader sees either file. */
+	char tmp[4096 + 8];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	FILE *f = fopen(tmp, "wb");
+	if (f) {
+		bool ok = written > 0 && fwrite(&h, sizeof(h), 1, f) == 1 &&
+			fwrite(binary, 1, written, f) == (size_t)written;
+		ok &= fclose(f) == 0;
+		if (!ok || rename(tmp, path) != 0)
+			unlink(tmp);
+	}
+	free(binary);
 }
 
+/* Build a program from embedded shaders, named by their file names in src/.
+ * `geometry_shader` may be NULL. Sets `*cached` (if given) when the program
+ * was loaded from the program binary cache. */
+GLuint
+create_program(const char *vertex_shader, const char *fragment_shader,
+	       const char *geometry_shader, bool *cached)
+{
+	const char *sources[] = {
+		shader_source(vertex_shader),
+		shader_source(fragment_shader),
+		geometry_shader ? shader_source(geometry_shader) : "",
+	};
+	GLuint program = glCreateProgram();
+	GLint formats = 0;
+	char path[4096];
+	uint64_t key = 0;
+
+	if (cached)
+		*cached = false;
+
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	bool use_cache = formats > 0 && sources[0] && sources[1] && sources[2];
+	if (use_cache) {
+		key = program_key(sources, 3);
+		use_cache = program_cache_path(path, sizeof(path), key);
+	}
+	if (use_cache && load_program_binary(program, path, key)) {
+		if (cached)
+			*cached = true;
+		return program;
+	}
+
+	GLuint vert = make_shader(vertex_shader, GL_VERTEX_SHADER);
+	GLuint frag = make_shader(fragment_shader, GL_FRAGMENT_SHADER);
+	GLuint geo = 0;
+	if (geometry_shader)
+		geo = make_shader(geometry_shader, GL_GEOMETRY_SHADER);
+
+	glAttachShader(program, vert);
+	glAttachShader(program, frag);
+	if (geo)
+		glAttachShader(program, geo);
+	if (use_cache)
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	glLinkProgram(program);
+	glDeleteShader(vert);
+	glDeleteShader(frag);
+	if (geo)
+		glDeleteShader(geo);
+
+	GLint status;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (!status) {
+		char log[1000];
+		GLsizei len;
+		glGetProgramInfoLog(program, 1000, &len, log);
+		fprintf(stderr, "Error: linking:\n%*s\n", len, log);
+		exit(1);
+	}
+
+	if (use_cache)
+		save_program_binary(program, path, key);
+	return program;
+}
@@ -0,0 +1,63 @@
+/* Build-time helper: turns the GLSL sources into a header of C strings, so the
+ * shaders are part of the binary instead of being read at launch.
+ *
+ * Usage: embed-shaders <output.h> <shader.glsl>... */
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+
+static bool embed(FILE *out, const char *path) {
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        perror(path);
+        return false;
+    }
+
+    const char *name = strrchr(path, '/');
+    fprintf(out, "    {\"%s\",\n     \"", name ? name + 1 : path);
+
+    int c;
+    while ((c = fgetc(in)) != EOF) {
+        switch (c) {
+        case '\n': fputs("\\n\"\n     \"", out); break;
+        case '"': fputs("\\\"", out); break;
+        case '\\': fputs("\\\\", out); break;
+        case '\t': fputs("\\t", out); break;
+        case '\r': break;
+        default: fputc(c, out);
+        }
+    }
+    fputs("\"},\n", out);
+
+    fclose(in);
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: embed-shaders <output.h> <shader.glsl>...\n");
+        return 1;
+    }
+
+    FILE *out = fopen(argv[1], "w");
+    if (!out) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    fprintf(out, "/* Generated by embed-shaders, do not edit. */\n"
+            "#ifndef _WLTERM_SHADERS_H\n#define _WLTERM_SHADERS_H\n\n"
+            "static const struct {\n    const char *name;\n    const char *source;\n"
+            "} wlterm_shaders[] = {\n");
+
+    int rc = 0;
+    for (int i = 2; i < argc; ++i)
+        if (!embed(out, argv[i]))
+            rc = 1;
+
+    fprintf(out, "};\n\n#endif /* _WLTERM_SHADERS_H */\n");
+    if (fclose(out) != 0)
+        rc = 1;
+    return rc;
+}
@@ -0,0 +1,229 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <GLES3/gl32.h>
+
+#include "glyphs.h"
+
+
+#define BITMAP_WORDS ((WLTERM_MAX_CODEPOINT >> 5) + 1)
+
+static void page_init(struct wlterm_glyph_worker *gw, struct wlterm_atlas_page *p) {
+    p->atlas = msdfgl_create_atlas(gw->msdfgl_ctx, gw->atlas_size, 2);
+    p->font = msdfgl_load_font(gw->msdfgl_ctx, gw->font_name, gw->range, gw->scale,
+                               p->atlas);
+    p->n_glyphs = 0;
+    p->last_used = gw->frame;
+}
+
+static void page_release(struct wlterm_atlas_page *p) {
+    msdfgl_destroy_font(p->font);
+    msdfgl_destroy_atlas(p->atlas);
+}
+
+/* Empty page `i` for reuse. Its glyphs have to be requested again. */
+static void page_evict(struct wlterm_glyph_worker *gw, int i) {
+    struct wlterm_atlas_page *p = &gw->pages[i];
+
+    for (int j = 0; j < p->n_glyphs; ++j) {
+        int32_t c = p->codepoints[j];
+        atomic_fetch_and_explicit(&gw->ready[c >> 5], ~(1u << (c & 31)),
+                                  memory_order_relaxed);
+        atomic_fetch_and_explicit(&gw->requested[c >> 5], ~(1u << (c & 31)),
+                                  memory_order_relaxed);
+    }
+    page_release(p);
+    page_init(gw, p);
+    gw->evictions++;
+}
+
+/* The page new glyphs go into, a fresh one once the current one is full.
+   Never the first page. Called with `lock` held. */
+static struct wlterm_atlas_page *fill_page(struct wlterm_glyph_worker *gw) {
+    if (gw->fill && gw->pages[gw->fill].n_glyphs < WLTERM_ATLAS_PAGE_GLYPHS)
+        return &gw->pages[gw->fill];
+
+    if (gw->n_pages < gw->max_pages) {
+        gw->fill = gw->n_pages++;
+        page_init(gw, &gw->pages[gw->fill]);
+    } else {
+        int lru = 1;
+        for (int i = 2; i < gw->n_pages; ++i)
+            if (gw->pages[i].last_used < gw->pages[lru].last_used)
+                lru = i;
+        page_evict(gw, lru);
+        gw->fill = lru;
+    }
+    return &gw->pages[gw->fill];
+}
+
+static void set_ready(struct wlterm_glyph_worker *gw, int32_t codepoint) {
+    atomic_fetch_or_explicit(&gw->ready[codepoint >> 5], 1u << (codepoint & 31),
+                             memory_order_release);
+}
+
+static void *worker_thread(void *data) {
+    struct wlterm_glyph_worker *gw = data;
+
+    eglMakeCurrent(gw->gl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, gw->gl_context);
+
+    for (;;) {
+        pthread_mutex_lock(&gw->queue_lock);
+        while (!gw->queue_len && !gw->quit)
+            pthread_cond_wait(&gw->queue_cond, &gw->queue_lock);
+        if (gw->quit) {
+            pthread_mutex_unlock(&gw->queue_lock);
+            break;
+        }
+        int32_t codepoint = gw->queue[--gw->queue_len];
+        pthread_mutex_unlock(&gw->queue_lock);
+
+        /* Frames go on drawing from the other pages while the glyph is
+           generated. */
+        pthread_mutex_lock(&gw->lock);
+        struct wlterm_atlas_page *p = fill_page(gw);
+        pthread_mutex_lock(&p->lock);
+        pthread_mutex_unlock(&gw->lock);
+
+        msdfgl_generate_glyph(p->font, codepoint);
+
+        /* The atlas is sampled from the frame contexts, make sure the new
+           glyph is actually in it before anyone draws it. */
+        glFinish();
+        pthread_mutex_unlock(&p->lock);
+
+        pthread_mutex_lock(&gw->lock);
+        p->codepoints[p->n_glyphs++] = codepoint;
+        gw->page[codepoint] = p - gw->pages;
+        pthread_mutex_unlock(&gw->lock);
+
+        set_ready(gw, codepoint);
+        gw->generated++;
+
+        uint64_t one = 1;
+        while (write(gw->event_fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+    }
+
+    for (int i = 1; i < gw->n_pages; ++i)
+        page_release(&gw->pages[i]);
+
+    eglMakeCurrent(gw->gl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    return NULL;
+}
+
+/* Takes over `context`, which must not be current on any other thread once
+   this returns, and `font` as the first atlas page. Further pages load
+   `font_name` again with the same parameters. */
+struct wlterm_glyph_worker *wlterm_glyph_worker_create(EGLDisplay display,
+                                                       EGLContext context,
+                                                       msdfgl_context_t msdfgl_ctx,
+                                                       msdfgl_font_t font,
+                                                       const char *font_name,
+                                                       double range, double scale,
+                                                       int atlas_size) {
+    struct wlterm_glyph_worker *gw = calloc(1, sizeof(struct wlterm_glyph_worker));
+    if (!gw) return NULL;
+
+    gw->gl_display = display;
+    gw->gl_context = context;
+    gw->msdfgl_ctx = msdfgl_ctx;
+    gw->font = font;
+    gw->font_name = strdup(font_name);
+    gw->range = range;
+    gw->scale = scale;
+    gw->atlas_size = atlas_size;
+
+    gw->pages[0].font = font;
+    gw->n_pages = 1;
+    gw->max_pages = WLTERM_ATLAS_DEFAULT_GLYPHS / WLTERM_ATLAS_PAGE_GLYPHS;
+    const char *budget = getenv("WLTERM_ATLAS_GLYPHS");
+    if (budget && atoi(budget) > 0)
+        gw->max_pages = atoi(budget) / WLTERM_ATLAS_PAGE_GLYPHS;
+    if (gw->max_pages < 2)
+        gw->max_pages = 2;
+    if (gw->max_pages > WLTERM_ATLAS_MAX_PAGES)
+        gw->max_pages = WLTERM_ATLAS_MAX_PAGES;
+
+    gw->page = calloc(WLTERM_MAX_CODEPOINT + 1, sizeof(uint8_t));
+    gw->ready = calloc(BITMAP_WORDS, sizeof(uint32_t));
+    gw->requested = calloc(BITMAP_WORDS, sizeof(uint32_t));
+    gw->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    pthread_mutex_init(&gw->lock, NULL);
+    for (int i = 0; i < WLTERM_ATLAS_MAX_PAGES; ++i)
+        pthread_mutex_init(&gw->pages[i].lock, NULL);
+    pthread_mutex_init(&gw->queue_lock, NULL);
+    pthread_cond_init(&gw->queue_cond, NULL);
+
+    pthread_create(&gw->thread, NULL, worker_thread, gw);
+    return gw;
+}
+
+void wlterm_glyph_worker_destroy(struct wlterm_glyph_worker *gw) {
+
+    pthread_mutex_lock(&gw->queue_lock);
+    gw->quit = true;
+    pthread_cond_signal(&gw->queue_cond);
+    pthread_mutex_unlock(&gw->queue_lock);
+    pthread_join(gw->thread, NULL);
+
+    pthread_cond_destroy(&gw->queue_cond);
+    pthread_mutex_destroy(&gw->queue_lock);
+    pthread_mutex_destroy(&gw->lock);
+    for (int i = 0; i < WLTERM_ATLAS_MAX_PAGES; ++i)
+        pthread_mutex_destroy(&gw->pages[i].lock);
+    close(gw->event_fd);
+    free(gw->queue);
+    free((void *)gw->ready);
+    free((void *)gw->requested);
+    free(gw->page);
+    free(gw->font_name);
+    free(gw);
+}
+
+void wlterm_glyph_request(struct wlterm_glyph_worker *gw, int32_t codepoint) {
+
+    if (codepoint < 0 || codepoint > WLTERM_MAX_CODEPOINT)
+        return;
+    if (atomic_fetch_or_explicit(&gw->requested[codepoint >> 5], 1u << (codepoint & 31),
+                                 memory_order_relaxed) & (1u << (codepoint & 31)))
+        return;
+
+    pthread_mutex_lock(&gw->queue_lock);
+    if (gw->queue_len == gw->queue_cap) {
+        gw->queue_cap = gw->queue_cap ? gw->queue_cap * 2 : 256;
+        gw->queue = realloc(gw->queue, gw->queue_cap * sizeof(int32_t));
+    }
+    gw->queue[gw->queue_len++] = codepoint;
+    pthread_cond_signal(&gw->queue_cond);
+    pthread_mutex_unlock(&gw->queue_lock);
+}
+
+/* For glyphs generated into the first page before the worker started. */
+void wlterm_glyph_mark_ready(struct wlterm_glyph_worker *gw, int32_t codepoint) {
+    pthread_mutex_lock(&gw->lock);
+    if (gw->pages[0].n_glyphs < WLTERM_ATLAS_PAGE_GLYPHS)
+        gw->pages[0].codepoints[gw->pages[0].n_glyphs++] = codepoint;
+    pthread_mutex_unlock(&gw->lock);
+    set_ready(gw, codepoint);
+}
+
+/* Glyphs in the atlas pages right now. */
+int wlterm_glyph_worker_resident(struct wlterm_glyph_worker *gw) {
+    int n = 0;
+    pthread_mutex_lock(&gw->lock);
+    for (int i = 0; i < gw->n_pages; ++i)
+        n += gw->pages[i].n_glyphs;
+    pthread_mutex_unlock(&gw->lock);
+    return n;
+}
+
+/* Returns true if glyphs have become ready since the last call. */
+bool wlterm_glyph_worker_drain(struct wlterm_glyph_worker *gw) {
+    uint64_t n;
+    return read(gw->event_fd, &n, sizeof(n)) == sizeof(n);
+}
@@ -0,0 +1,112 @@
+#ifndef GLYPHS_H
+#define GLYPHS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <EGL/egl.h>
+#include <msdfgl.h>
+
+#define WLTERM_MAX_CODEPOINT 0x10ffff
+
+/* Drawn in place of glyphs that haven't been generated yet. */
+#define WLTERM_PLACEHOLDER_GLYPH 0x25a1
+
+/* Glyphs per atlas page, and the most pages $WLTERM_ATLAS_GLYPHS can ask
+   for. */
+#define WLTERM_ATLAS_PAGE_GLYPHS 512
+#define WLTERM_ATLAS_MAX_PAGES 64
+#define WLTERM_ATLAS_DEFAULT_GLYPHS 4096
+
+/* An msdfgl atlas with a font of its own, since msdfgl keeps one atlas per
+   font. Glyphs only ever go into the newest page; a page is evicted as a
+   whole. `lock` is held while a glyph is generated into it or it is drawn
+   from. */
+struct wlterm_atlas_page {
+    pthread_mutex_t lock;
+    msdfgl_atlas_t atlas;
+    msdfgl_font_t font;
+    int32_t codepoints[WLTERM_ATLAS_PAGE_GLYPHS];
+    int n_glyphs;
+    uint64_t last_used;  /* `frame` this page was last drawn from. */
+};
+
+/* Generates glyphs on a background thread.
+ *
+ * The worker owns the root EGL context, where msdfgl keeps the font atlases
+ * and its generator state, so glyph generation never has to switch contexts
+ * in the middle of drawing a frame. The renderer only ever draws glyphs
+ * marked ready, and requests the rest; `event_fd` is signalled as they land.
+ *
+ * Glyphs fill atlas pages of WLTERM_ATLAS_PAGE_GLYPHS each, up to
+ * `max_pages`. Past that, the page drawn from least recently is emptied and
+ * filled again: its glyphs are no longer ready, and are generated again when
+ * next requested. The first page, with ASCII and the placeholder, stays
+ * and takes no more glyphs.
+ *
+ * msdfgl itself is not thread safe. A glyph is generated with only its
+ * page's lock held, and frames draw a page that is busy with placeholders
+ * rather than wait for it. The page table, `pages` and `page`, is only
+ * touched with `lock` held: by frames while they draw text, by the worker
+ * to pick the page for a glyph and to record it once generated. */
+struct wlterm_glyph_worker {
+    EGLDisplay gl_display;
+    EGLContext gl_context;
+    msdfgl_context_t msdfgl_ctx;
+    msdfgl_font_t font;
+
+    /* To load the font again for every page. */
+    char *font_name;
+    double range, scale;
+    int atlas_size;
+
+    struct wlterm_atlas_page pages[WLTERM_ATLAS_MAX_PAGES];
+    int n_pages;
+    int max_pages;
+    int fill;
+    uint8_t *page;  /* Page of every ready codepoint. */
+    uint64_t frame;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_cond;
+    int32_t *queue;
+    size_t queue_len;
+    size_t queue_cap;
+    bool quit;
+
+    int event_fd;
+
+    /* One bit per codepoint. `ready` is written by the worker, `requested`
+       by the main thread, and cleared by the worker on eviction. */
+    _Atomic uint32_t *ready;
+    _Atomic uint32_t *requested;
+
+    /* Read by the main thread for statistics. */
+    _Atomic uint64_t generated;
+    _Atomic uint64_t evictions;
+};
+
+struct wlterm_glyph_worker *wlterm_glyph_worker_create(EGLDisplay, EGLContext,
+                                                       msdfgl_context_t, msdfgl_font_t,
+                                                       const char *font_name,
+                                                       double range, double scale,
+                                                       int atlas_size);
+void wlterm_glyph_worker_destroy(struct wlterm_glyph_worker *);
+void wlterm_glyph_request(struct wlterm_glyph_worker *, int32_t codepoint);
+void wlterm_glyph_mark_ready(struct wlterm_glyph_worker *, int32_t codepoint);
+bool wlterm_glyph_worker_drain(struct wlterm_glyph_worker *);
+int wlterm_glyph_worker_resident(struct wlterm_glyph_worker *);
+
+static inline bool wlterm_glyph_ready(struct wlterm_glyph_worker *gw, int32_t codepoint) {
+    if (codepoint < 0 || codepoint > WLTERM_MAX_CODEPOINT)
+        return false;
+    return atomic_load_explicit(&gw->ready[codepoint >> 5], memory_order_acquire) &
+        (1u << (codepoint & 31));
+}
+
+#endif /* GLYPHS_H */
@@ -0,0 +1,285 @@
+/* Unit tests for the grid: scrolling, the row ring, resizing and clearing.
+ *
+ * Every check compares what the renderer would see, the cells of visible
+ * rows, so the tests hold whatever the grid does internally. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "grid.h"
+
+
+static int failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, \
+                __func__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+/* Visible row `row` as a string, one character per cell. */
+static const char *row_text(const struct wlterm_grid *g, int row) {
+    static char text[256];
+    size_t o = wlterm_grid_row(g, row);
+
+    for (int col = 0; col < g->cols; ++col)
+        text[col] = g->codepoints[o + col] < 0x80 ? g->codepoints[o + col] : '?';
+    text[g->cols] = '\0';
+    return text;
+}
+
+/* True if every cell of the row is a blank in these colors. */
+static bool row_blank(const struct wlterm_grid *g, int row, uint32_t fg, uint32_t bg) {
+    size_t o = wlterm_grid_row(g, row);
+
+    for (int col = 0; col < g->cols; ++col)
+        if (g->codepoints[o + col] != ' ' || g->fg[o + col] != fg ||
+            g->bg[o + col] != bg || g->attrs[o + col])
+            return false;
+    return true;
+}
+
+static void write_str(struct wlterm_grid *g, const char *s) {
+    wlterm_grid_write(g, s, strlen(s));
+}
+
+static void test_create(void) {
+    struct wlterm_grid *g = wlterm_grid_create(3, 4);
+
+    CHECK(g->rows == 3 && g->cols == 4 && g->head == 0);
+    for (int row = 0; row < g->rows; ++row)
+        CHECK(row_blank(g, row, WLTERM_DEFAULT_FG, WLTERM_DEFAULT_BG));
+    CHECK(g->cursor_row == 0 && g->cursor_col == 0);
+    CHECK(g->scroll_top == 0 && g->scroll_bottom == 2);
+    wlterm_grid_destroy(g);
+}
+
+static void test_write_and_wrap(void) {
+    struct wlterm_grid *g = wlterm_grid_create(3, 4);
+
+    write_str(g, "abcdef");
+    CHECK(strcmp(row_text(g, 0), "abcd") == 0);
+    CHECK(strcmp(row_text(g, 1), "ef  ") == 0);
+    CHECK(g->cursor_row == 1 && g->cursor_col == 2);
+
+    /* A full row leaves the wrap pending until the next character. */
+    wlterm_grid_move_cursor(g, 2, 0);
+    write_str(g, "wxyz");
+    CHECK(g->cursor_row == 2 && g->cursor_col == 4);
+    CHECK(g->head == 0);
+
+    /* Without autowrap the last cell is overwritten. */
+    g->autowrap = false;
+    wlterm_grid_move_cursor(g, 0, 2);
+    wlterm_grid_put_ascii(g, "123", 3);
+    CHECK(strcmp(row_text(g, 0), "ab13") == 0);
+    CHECK(g->cursor_row == 0);
+    wlterm_grid_destroy(g);
+}
+
+static void test_ring_head(void) {
+    struct wlterm_grid *g = wlterm_grid_create(4, 3);
+
+    write_str(g, "a\nb\nc\nd");
+    CHECK(g->head == 0);
+
+    /* Each line past the bottom moves the head instead of the rows. */
+    write_str(g, "\ne");
+    CHECK(g->head == 1);
+    CHECK(strcmp(row_text(g, 0), "b  ") == 0);
+    CHECK(strcmp(row_text(g, 3), "e  ") == 0);
+    CHECK(g->lines_scrolled == 1);
+
+    /* Round the ring: the head wraps back to 0, rows stay in order. */
+    write_str(g, "\nf\ng\nh");
+    CHECK(g->head == 0);
+    CHECK(strcmp(row_text(g, 0), "e  ") == 0);
+    CHECK(strcmp(row_text(g, 3), "h  ") == 0);
+    write_str(g, "\ni");
+    CHECK(g->head == 1);
+    CHECK(strcmp(row_text(g, 0), "f  ") == 0);
+    CHECK(strcmp(row_text(g, 3), "i  ") == 0);
+
+    /* Scrolling back down moves the head the other way, the new top row is
+       blank. */
+    wlterm_grid_scroll_down(g, 2);
+    CHECK(g->head == 3);
+    CHECK(row_blank(g, 0, g->pen_fg, g->pen_bg));
+    CHECK(row_blank(g, 1, g->pen_fg, g->pen_bg));
+    CHECK(strcmp(row_text(g, 2), "f  ") == 0);
+    CHECK(strcmp(row_text(g, 3), "g  ") == 0);
+
+    /* More than a screen clears it all, the head stays valid. */
+    wlterm_grid_scroll(g, 10);
+    CHECK(g->head >= 0 && g->head < g->rows);
+    for (int row = 0; row < g->rows; ++row)
+        CHECK(row_blank(g, row, g->pen_fg, g->pen_bg));
+    wlterm_grid_destroy(g);
+}
+
+static void test_scroll_region(void) {
+    struct wlterm_grid *g = wlterm_grid_create(5, 3);
+
+    write_str(g, "a\r\nb\r\nc\r\nd\r\ne");
+    wlterm_grid_set_margins(g, 1, 3);
+    CHECK(g->scroll_top == 1 && g->scroll_bottom == 3);
+    CHECK(g->cursor_row == 0 && g->cursor_col == 0);
+
+    /* A line feed at the bottom margin scrolls only the region, rows are
+       copied and the head stays put. */
+    wlterm_grid_move_cursor(g, 3, 0);
+    write_str(g, "\nx");
+    CHECK(g->head == 0);
+    CHECK(strcmp(row_text(g, 0), "a  ") == 0);
+    CHECK(strcmp(row_text(g, 1), "c  ") == 0);
+    CHECK(strcmp(row_text(g, 2), "d  ") == 0);
+    CHECK(strcmp(row_text(g, 3), "x  ") == 0);
+    CHECK(strcmp(row_text(g, 4), "e  ") == 0);
+
+    /* Reverse index at the top margin scrolls the region down. */
+    wlterm_grid_move_cursor(g, 1, 0);
+    wlterm_grid_reverse_index(g);
+    CHECK(row_blank(g, 1, g->pen_fg, g->pen_bg));
+    CHECK(strcmp(row_text(g, 2), "c  ") == 0);
+    CHECK(strcmp(row_text(g, 3), "d  ") == 0);
+    CHECK(strcmp(row_text(g, 4), "e  ") == 0);
+
+    /* Insert and delete lines stay inside the region too. */
+    wlterm_grid_move_cursor(g, 2, 0);
+    wlterm_grid_delete_lines(g, 1);
+    CHECK(strcmp(row_text(g, 2), "d  ") == 0);
+    CHECK(row_blank(g, 3, g->pen_fg, g->pen_bg));
+    CHECK(strcmp(row_text(g, 4), "e  ") == 0);
+    wlterm_grid_insert_lines(g, 5);
+    for (int row = 2; row <= 3; ++row)
+        CHECK(row_blank(g, row, g->pen_fg, g->pen_bg));
+    CHECK(strcmp(row_text(g, 0), "a  ") == 0);
+    CHECK(strcmp(row_text(g, 4), "e  ") == 0);
+
+    /* Outside the region line feeds don't scroll at all. */
+    wlterm_grid_move_cursor(g, 4, 0);
+    wlterm_grid_linefeed(g);
+    CHECK(g->cursor_row == 4);
+    CHECK(strcmp(row_text(g, 4), "e  ") == 0);
+
+    /* Bad margins reset to the whole screen. */
+    wlterm_grid_set_margins(g, 3, 1);
+    CHECK(g->scroll_top == 0 && g->scroll_bottom == 4);
+    wlterm_grid_destroy(g);
+}
+
+static void test_resize(void) {
+    struct wlterm_grid *g = wlterm_grid_create(4, 4);
+
+    write_str(g, "ab\r\ncdef\r\ngh\r\nij");
+    CHECK(g->cursor_row == 3);
+
+    /* Fewer rows keep the bottom, where the cursor is. Fewer columns cut
+       rows on the right. */
+    wlterm_grid_resize(g, 2, 3);
+    CHECK(g->rows == 2 && g->cols == 3);
+    CHECK(strcmp(row_text(g, 0), "gh ") == 0);
+    CHECK(strcmp(row_text(g, 1), "ij ") == 0);
+    CHECK(g->cursor_row == 1 && g->cursor_col == 2);
+    CHECK(g->scroll_top == 0 && g->scroll_bottom == 1);
+
+    /* More of both pads with blanks. */
+    wlterm_grid_resize(g, 3, 5);
+    CHECK(strcmp(row_text(g, 0), "gh   ") == 0);
+    CHECK(strcmp(row_text(g, 1), "ij   ") == 0);
+    CHECK(row_blank(g, 2, g->pen_fg, g->pen_bg));
+
+    /* Resizing after the head moved copies rows in screen order. */
+    wlterm_grid_move_cursor(g, 2, 0);
+    write_str(g, "kl\nmn");
+    CHECK(g->head != 0);
+    wlterm_grid_resize(g, 3, 2);
+    CHECK(g->head == 0);
+    CHECK(strcmp(row_text(g, 0), "ij") == 0);
+    CHECK(strcmp(row_text(g, 1), "kl") == 0);
+    CHECK(strcmp(row_text(g, 2), "mn") == 0);
+
+    /* Writing into the last column after a resize still wraps. */
+    wlterm_grid_move_cursor(g, 0, 0);
+    write_str(g, "xyz");
+    CHECK(strcmp(row_text(g, 0), "xy") == 0);
+    CHECK(strcmp(row_text(g, 1), "zl") == 0);
+    wlterm_grid_destroy(g);
+}
+
+static void test_clear(void) {
+    struct wlterm_grid *g = wlterm_grid_create(3, 6);
+    const uint32_t red = 0xff0000ff, blue = 0x0000ffff;
+
+    write_str(g, "abcdef");
+
+    /* Erased cells take the pen's colors, and no attributes. */
+    g->pen_bg = red;
+    g->pen_attrs = WLTERM_ATTR_BOLD;
+    g->dirty[0] = 0;
+    wlterm_grid_erase(g, 0, 2, 4);
+    CHECK(strcmp(row_text(g, 0), "ab  ef") == 0);
+    size_t o = wlterm_grid_row(g, 0);
+    CHECK(g->bg[o + 1] == WLTERM_DEFAULT_BG);
+    CHECK(g->bg[o + 2] == red && g->bg[o + 3] == red);
+    CHECK(g->attrs[o + 2] == 0);
+    CHECK(g->bg[o + 4] == WLTERM_DEFAULT_BG);
+    CHECK(g->dirty[0]);
+
+    /* Out of range erases are clamped or ignored. */
+    wlterm_grid_erase(g, 0, 5, 100);
+    CHECK(strcmp(row_text(g, 0), "ab  e ") == 0);
+    wlterm_grid_erase(g, 7, 0, 6);
+    wlterm_grid_erase(g, 0, 4, 2);
+    wlterm_grid_erase(g, 0, -3, 1);
+    CHECK(strcmp(row_text(g, 0), " b  e ") == 0);
+
+    /* Clearing rows clears whole rows in the pen colors. */
+    g->pen_attrs = 0;
+    write_str(g, "\r\nxyz");
+    g->pen_bg = blue;
+    wlterm_grid_clear_rows(g, 0, 2);
+    CHECK(row_blank(g, 0, g->pen_fg, blue));
+    CHECK(row_blank(g, 1, g->pen_fg, blue));
+    CHECK(row_blank(g, 2, WLTERM_DEFAULT_FG, WLTERM_DEFAULT_BG));
+
+    /* A scrolled in row is blank in the pen colors of the moment. */
+    g->pen_bg = WLTERM_DEFAULT_BG;
+    wlterm_grid_move_cursor(g, 0, 0);
+    write_str(g, "12345");
+    g->pen_bg = red;
+    wlterm_grid_scroll(g, 1);
+    CHECK(row_blank(g, 2, g->pen_fg, red));
+    g->pen_bg = WLTERM_DEFAULT_BG;
+    wlterm_grid_scroll(g, 2);
+    CHECK(row_blank(g, 0, g->pen_fg, red));
+    CHECK(row_blank(g, 1, g->pen_fg, WLTERM_DEFAULT_BG));
+    CHECK(row_blank(g, 2, g->pen_fg, WLTERM_DEFAULT_BG));
+
+    /* Inserting and deleting characters shift the rest of the row. */
+    wlterm_grid_move_cursor(g, 0, 0);
+    write_str(g, "abcdef");
+    wlterm_grid_move_cursor(g, 0, 1);
+    wlterm_grid_insert_chars(g, 2);
+    CHECK(strcmp(row_text(g, 0), "a  bcd") == 0);
+    wlterm_grid_delete_chars(g, 3);
+    CHECK(strcmp(row_text(g, 0), "acd   ") == 0);
+    wlterm_grid_delete_chars(g, 100);
+    CHECK(strcmp(row_text(g, 0), "a     ") == 0);
+    wlterm_grid_destroy(g);
+}
+
+int main(void) {
+    test_create();
+    test_write_and_wrap();
+    test_ring_head();
+    test_scroll_region();
+    test_resize();
+    test_clear();
+
+    if (failures)
+        fprintf(stderr, "%d checks failed\n", failures);
+    return failures ? 1 : 0;
+}
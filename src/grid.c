@@ -0,0 +1,442 @@
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "grid.h"
+#include "scrollback.h"
+
+
+/* wchar_t is a 32 bit integer here, and libc's wmemset is vectorized. */
+_Static_assert(sizeof(wchar_t) == sizeof(uint32_t), "wchar_t is not 32 bits");
+
+static inline void fill32(uint32_t *p, uint32_t value, size_t n) {
+    wmemset((wchar_t *)p, (wchar_t)value, n);
+}
+
+static void grid_alloc(struct wlterm_grid *g, int rows, int cols) {
+    size_t n = (size_t)rows * cols;
+
+    g->rows = rows;
+    g->cols = cols;
+    g->head = 0;
+    g->codepoints = malloc(n * sizeof(uint32_t));
+    g->fg = malloc(n * sizeof(uint32_t));
+    g->bg = malloc(n * sizeof(uint32_t));
+    g->attrs = malloc(n * sizeof(uint8_t));
+    g->dirty = malloc(rows * sizeof(uint8_t));
+
+    /* No blank tail yet: the first clear writes whole rows. */
+    g->tails = malloc(rows * sizeof(struct wlterm_grid_tail));
+    for (int r = 0; r < rows; ++r)
+        g->tails[r] = (struct wlterm_grid_tail){cols, 0, 0};
+}
+
+static void grid_free(struct wlterm_grid *g) {
+    free(g->codepoints);
+    free(g->fg);
+    free(g->bg);
+    free(g->attrs);
+    free(g->dirty);
+    free(g->tails);
+}
+
+static inline struct wlterm_grid_tail *grid_tail(struct wlterm_grid *g, int row) {
+    int r = g->head + row;
+    return &g->tails[r >= g->rows ? r - g->rows : r];
+}
+
+/* Cells up to `col` of a row were written. */
+static inline void grid_extend_tail(struct wlterm_grid *g, int row, int col) {
+    struct wlterm_grid_tail *t = grid_tail(g, row);
+    if (t->start < col)
+        t->start = col;
+}
+
+/* Hand the top n rows to the scrollback. */
+static void grid_save_rows(struct wlterm_grid *g, int n) {
+    if (!g->scrollback)
+        return;
+    for (int row = 0; row < n; ++row) {
+        size_t o = wlterm_grid_row(g, row);
+        wlterm_scrollback_push(g->scrollback, &g->codepoints[o], &g->fg[o], &g->bg[o],
+                               &g->attrs[o], g->cols);
+    }
+}
+
+struct wlterm_grid *wlterm_grid_create(int rows, int cols) {
+    struct wlterm_grid *g = malloc(sizeof(struct wlterm_grid));
+    if (!g) return NULL;
+
+    if (rows < 1) rows = 1;
+    if (cols < 1) cols = 1;
+
+    grid_alloc(g, rows, cols);
+
+    g->cursor_row = 0;
+    g->cursor_col = 0;
+    g->pen_fg = WLTERM_DEFAULT_FG;
+    g->pen_bg = WLTERM_DEFAULT_BG;
+    g->pen_attrs = 0;
+    g->lines_scrolled = 0;
+    g->scroll_top = 0;
+    g->scroll_bottom = rows - 1;
+    g->autowrap = true;
+    g->scrollback = NULL;
+
+    wlterm_grid_clear_rows(g, 0, rows);
+    return g;
+}
+
+void wlterm_grid_destroy(struct wlterm_grid *g) {
+    grid_free(g);
+    free(g);
+}
+
+void wlterm_grid_resize(struct wlterm_grid *g, int rows, int cols) {
+
+    if (rows < 1) rows = 1;
+    if (cols < 1) cols = 1;
+    if (rows == g->rows && cols == g->cols)
+        return;
+
+    /* Keep the bottom of the screen, where the cursor usually is. */
+    int skip = g->cursor_row + 1 > rows ? g->cursor_row + 1 - rows : 0;
+    grid_save_rows(g, skip);
+
+    struct wlterm_grid old = *g;
+    grid_alloc(g, rows, cols);
+    wlterm_grid_clear_rows(g, 0, rows);
+
+    int copy_rows = old.rows - skip < rows ? old.rows - skip : rows;
+    int copy_cols = old.cols < cols ? old.cols : cols;
+
+    for (int row = 0; row < copy_rows; ++row) {
+        size_t src = wlterm_grid_row(&old, row + skip);
+        size_t dst = wlterm_grid_row(g, row);
+        memcpy(&g->codepoints[dst], &old.codepoints[src], copy_cols * sizeof(uint32_t));
+        memcpy(&g->fg[dst], &old.fg[src], copy_cols * sizeof(uint32_t));
+        memcpy(&g->bg[dst], &old.bg[src], copy_cols * sizeof(uint32_t));
+        memcpy(&g->attrs[dst], &old.attrs[src], copy_cols * sizeof(uint8_t));
+        grid_tail(g, row)->start = copy_cols;
+    }
+
+    g->cursor_row = old.cursor_row - skip;
+    if (g->cursor_col >= cols)
+        g->cursor_col = cols - 1;
+    g->scroll_top = 0;
+    g->scroll_bottom = rows - 1;
+
+    grid_free(&old);
+}
+
+void wlterm_grid_erase(struct wlterm_grid *g, int row, int from, int to) {
+
+    if (from < 0) from = 0;
+    if (to > g->cols) to = g->cols;
+    if (row < 0 || row >= g->rows || from >= to)
+        return;
+
+    /* The blank tail needs no clearing if it's in the pen's colors. A
+       different erase up to the end of the row starts a new tail. */
+    struct wlterm_grid_tail *t = grid_tail(g, row);
+    int end = to;
+    if (t->fg == g->pen_fg && t->bg == g->pen_bg) {
+        end = to < t->start ? to : t->start;
+        if (to >= t->start && from < t->start)
+            t->start = from;
+    } else if (to == g->cols) {
+        *t = (struct wlterm_grid_tail){from, g->pen_fg, g->pen_bg};
+    } else if (to > t->start) {
+        t->start = to;
+    }
+    g->dirty[row] = 1;
+    if (from >= end)
+        return;
+
+    size_t o = wlterm_grid_row(g, row) + from;
+    fill32(&g->codepoints[o], ' ', end - from);
+    fill32(&g->fg[o], g->pen_fg, end - from);
+    fill32(&g->bg[o], g->pen_bg, end - from);
+    memset(&g->attrs[o], 0, end - from);
+}
+
+void wlterm_grid_clear_rows(struct wlterm_grid *g, int row, int n) {
+    for (int r = row; r < row + n && r < g->rows; ++r)
+        wlterm_grid_erase(g, r, 0, g->cols);
+}
+
+/* Blank tails in the same colors are left out, they match already. */
+static void grid_copy_row(struct wlterm_grid *g, int dst, int src) {
+    size_t d = wlterm_grid_row(g, dst);
+    size_t s = wlterm_grid_row(g, src);
+    struct wlterm_grid_tail *dt = grid_tail(g, dst), *st = grid_tail(g, src);
+
+    int n = g->cols;
+    if (dt->fg == st->fg && dt->bg == st->bg)
+        n = dt->start > st->start ? dt->start : st->start;
+    *dt = *st;
+
+    memcpy(&g->codepoints[d], &g->codepoints[s], n * sizeof(uint32_t));
+    memcpy(&g->fg[d], &g->fg[s], n * sizeof(uint32_t));
+    memcpy(&g->bg[d], &g->bg[s], n * sizeof(uint32_t));
+    memcpy(&g->attrs[d], &g->attrs[s], n * sizeof(uint8_t));
+}
+
+/* Move rows top..bottom up by n, clearing the rows that come into view. */
+static void grid_scroll_up(struct wlterm_grid *g, int top, int bottom, int n) {
+
+    if (n <= 0 || top > bottom)
+        return;
+    if (n > bottom - top + 1)
+        n = bottom - top + 1;
+
+    /* Like xterm, keep what scrolls off the top even with a bottom margin. */
+    if (top == 0)
+        grid_save_rows(g, n);
+
+    if (top == 0 && bottom == g->rows - 1) {
+        /* The whole screen: the rows scrolled out become the new rows at
+           the bottom. */
+        g->head = (g->head + n) % g->rows;
+        g->lines_scrolled += n;
+    } else {
+        for (int r = top; r <= bottom - n; ++r)
+            grid_copy_row(g, r, r + n);
+    }
+    wlterm_grid_clear_rows(g, bottom - n + 1, n);
+
+    /* Every row in the region now shows different content. */
+    memset(&g->dirty[top], 1, bottom - top + 1);
+}
+
+static void grid_scroll_down(struct wlterm_grid *g, int top, int bottom, int n) {
+
+    if (n <= 0 || top > bottom)
+        return;
+    if (n > bottom - top + 1)
+        n = bottom - top + 1;
+
+    if (top == 0 && bottom == g->rows - 1) {
+        g->head = (g->head + g->rows - n) % g->rows;
+    } else {
+        for (int r = bottom; r >= top + n; --r)
+            grid_copy_row(g, r, r - n);
+    }
+    wlterm_grid_clear_rows(g, top, n);
+
+    memset(&g->dirty[top], 1, bottom - top + 1);
+}
+
+void wlterm_grid_scroll(struct wlterm_grid *g, int n) {
+    grid_scroll_up(g, g->scroll_top, g->scroll_bottom, n);
+}
+
+void wlterm_grid_scroll_down(struct wlterm_grid *g, int n) {
+    grid_scroll_down(g, g->scroll_top, g->scroll_bottom, n);
+}
+
+void wlterm_grid_set_margins(struct wlterm_grid *g, int top, int bottom) {
+
+    if (top < 0) top = 0;
+    if (bottom >= g->rows) bottom = g->rows - 1;
+    if (top >= bottom) {
+        top = 0;
+        bottom = g->rows - 1;
+    }
+    g->scroll_top = top;
+    g->scroll_bottom = bottom;
+    wlterm_grid_move_cursor(g, 0, 0);
+}
+
+void wlterm_grid_insert_lines(struct wlterm_grid *g, int n) {
+    if (g->cursor_row < g->scroll_top || g->cursor_row > g->scroll_bottom)
+        return;
+    grid_scroll_down(g, g->cursor_row, g->scroll_bottom, n);
+    g->cursor_col = 0;
+}
+
+void wlterm_grid_delete_lines(struct wlterm_grid *g, int n) {
+    if (g->cursor_row < g->scroll_top || g->cursor_row > g->scroll_bottom)
+        return;
+    grid_scroll_up(g, g->cursor_row, g->scroll_bottom, n);
+    g->cursor_col = 0;
+}
+
+/* Shift the cells right of the cursor by n, either way. Shifting by the
+   rest of the row or more clears it. */
+static void grid_shift_chars(struct wlterm_grid *g, int n) {
+    int col = g->cursor_col < g->cols ? g->cursor_col : g->cols - 1;
+    if (n > g->cols - col)
+        n = g->cols - col;
+    if (n < col - g->cols)
+        n = col - g->cols;
+    int len = g->cols - col - (n > 0 ? n : -n);
+    size_t o = wlterm_grid_row(g, g->cursor_row);
+    int dst = n > 0 ? col + n : col;
+    int src = n > 0 ? col : col - n;
+
+    /* Inserting pushes the tail right, deleting leaves it: the cells moved
+       into it are blanks of its own. */
+    struct wlterm_grid_tail *t = grid_tail(g, g->cursor_row);
+    if (n > 0 && t->start > col)
+        t->start = t->start + n < g->cols ? t->start + n : g->cols;
+
+    if (len > 0) {
+        memmove(&g->codepoints[o + dst], &g->codepoints[o + src], len * sizeof(uint32_t));
+        memmove(&g->fg[o + dst], &g->fg[o + src], len * sizeof(uint32_t));
+        memmove(&g->bg[o + dst], &g->bg[o + src], len * sizeof(uint32_t));
+        memmove(&g->attrs[o + dst], &g->attrs[o + src], len * sizeof(uint8_t));
+    }
+    if (n > 0)
+        wlterm_grid_erase(g, g->cursor_row, col, col + n);
+    else
+        wlterm_grid_erase(g, g->cursor_row, g->cols + n, g->cols);
+}
+
+void wlterm_grid_insert_chars(struct wlterm_grid *g, int n) {
+    if (n > 0)
+        grid_shift_chars(g, n);
+}
+
+void wlterm_grid_delete_chars(struct wlterm_grid *g, int n) {
+    if (n > 0)
+        grid_shift_chars(g, -n);
+}
+
+void wlterm_grid_move_cursor(struct wlterm_grid *g, int row, int col) {
+    g->cursor_row = row < 0 ? 0 : row >= g->rows ? g->rows - 1 : row;
+    g->cursor_col = col < 0 ? 0 : col >= g->cols ? g->cols - 1 : col;
+}
+
+void wlterm_grid_linefeed(struct wlterm_grid *g) {
+    if (g->cursor_row == g->scroll_bottom)
+        wlterm_grid_scroll(g, 1);
+    else if (g->cursor_row < g->rows - 1)
+        g->cursor_row++;
+}
+
+void wlterm_grid_reverse_index(struct wlterm_grid *g) {
+    if (g->cursor_row == g->scroll_top)
+        wlterm_grid_scroll_down(g, 1);
+    else if (g->cursor_row > 0)
+        g->cursor_row--;
+}
+
+void wlterm_grid_newline(struct wlterm_grid *g) {
+    g->cursor_col = 0;
+    wlterm_grid_linefeed(g);
+}
+
+/* Handle a pending wrap before writing at the cursor. */
+static inline void grid_wrap(struct wlterm_grid *g) {
+    if (g->cursor_col < g->cols)
+        return;
+    if (g->autowrap)
+        wlterm_grid_newline(g);
+    else
+        g->cursor_col = g->cols - 1;
+}
+
+void wlterm_grid_put(struct wlterm_grid *g, uint32_t codepoint) {
+
+    grid_wrap(g);
+
+    size_t o = wlterm_grid_row(g, g->cursor_row) + g->cursor_col;
+    g->codepoints[o] = codepoint;
+    g->fg[o] = g->pen_fg;
+    g->bg[o] = g->pen_bg;
+    g->attrs[o] = g->pen_attrs;
+    g->dirty[g->cursor_row] = 1;
+    g->cursor_col++;
+    grid_extend_tail(g, g->cursor_row, g->cursor_col);
+}
+
+/* Write a run of printable characters, a row segment at a time. They come
+   either as ASCII bytes or as codepoints, the other pointer being NULL. */
+static void grid_put_run(struct wlterm_grid *g, const unsigned char *s,
+                         const uint32_t *codepoints_in, size_t len) {
+    size_t done = 0;
+
+    while (len) {
+        grid_wrap(g);
+
+        size_t n = g->cols - g->cursor_col;
+        if (n > len)
+            n = len;
+
+        size_t o = wlterm_grid_row(g, g->cursor_row) + g->cursor_col;
+        uint32_t *restrict codepoints = &g->codepoints[o];
+
+        if (s) {
+            const unsigned char *restrict u = s + done;
+            for (size_t i = 0; i < n; ++i)
+                codepoints[i] = u[i];
+        } else {
+            memcpy(codepoints, codepoints_in + done, n * sizeof(uint32_t));
+        }
+
+        /* Cells of a blank tail in the pen's colors have them already, only
+           the codepoints change. */
+        struct wlterm_grid_tail *t = grid_tail(g, g->cursor_row);
+        size_t colored = n;
+        if (t->fg == g->pen_fg && t->bg == g->pen_bg && !g->pen_attrs)
+            colored = t->start <= g->cursor_col ? 0 :
+                (size_t)(t->start - g->cursor_col) < n ? (size_t)(t->start - g->cursor_col) : n;
+        fill32(&g->fg[o], g->pen_fg, colored);
+        fill32(&g->bg[o], g->pen_bg, colored);
+        memset(&g->attrs[o], g->pen_attrs, colored);
+
+        g->dirty[g->cursor_row] = 1;
+        g->cursor_col += n;
+        if (t->start < g->cursor_col)
+            t->start = g->cursor_col;
+        done += n;
+        len -= n;
+
+        /* Without autowrap the rest of the run overwrites the last cell. */
+        if (!g->autowrap && len) {
+            g->cursor_col = g->cols - 1;
+            done += len - 1;
+            len = 1;
+        }
+    }
+}
+
+void wlterm_grid_put_ascii(struct wlterm_grid *g, const char *s, size_t len) {
+    grid_put_run(g, (const unsigned char *)s, NULL, len);
+}
+
+void wlterm_grid_put_codepoints(struct wlterm_grid *g, const uint32_t *codepoints,
+                                size_t len) {
+    grid_put_run(g, NULL, codepoints, len);
+}
+
+void wlterm_grid_write(struct wlterm_grid *g, const char *s, size_t len) {
+    const char *end = s + len;
+
+    while (s < end) {
+        int32_t codepoint;
+        unsigned char c = *s;
+
+        if (c == '\n') {
+            wlterm_grid_newline(g);
+            s++;
+            continue;
+        }
+        if (c == '\r') {
+            g->cursor_col = 0;
+            s++;
+            continue;
+        }
+
+        /* Don't let a truncated sequence read past the end. */
+        int need = c < 0x80 ? 1 : c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+        if (end - s < need) {
+            codepoint = 0xfffd;
+            s++;
+        } else {
+            s += utf8_decode(s, &codepoint);
+        }
+        wlterm_grid_put(g, codepoint);
+    }
+}
@@ -0,0 +1,133 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum wlterm_attr {
+    WLTERM_ATTR_BOLD      = 1 << 0,
+    WLTERM_ATTR_ITALIC    = 1 << 1,
+    WLTERM_ATTR_UNDERLINE = 1 << 2,
+    WLTERM_ATTR_REVERSE   = 1 << 3,
+};
+
+struct wlterm_scrollback;
+
+#define WLTERM_DEFAULT_FG 0xc0c5ceff
+#define WLTERM_DEFAULT_BG 0x0c1014ff
+
+/* Past `start`, a row holds nothing but blanks in these colors. */
+struct wlterm_grid_tail {
+    int start;
+    uint32_t fg;
+    uint32_t bg;
+};
+
+/* Screen contents of a terminal window.
+ *
+ * Each cell attribute lives in its own contiguous array, so that the renderer
+ * can walk e.g. only the codepoints of a row. Rows are addressed through a
+ * ring: row 0 on screen is physical row `head`, and scrolling just moves the
+ * head and clears the rows that come into view.
+ *
+ * Every cell is always written out, but each physical row remembers where
+ * its blank tail starts: clearing a row in the same colors only clears up
+ * to there. A line of text scrolling in costs its own length, not the width
+ * of the screen. */
+struct wlterm_grid {
+    int rows;
+    int cols;
+    int head;
+
+    uint32_t *codepoints;
+    uint32_t *fg;
+    uint32_t *bg;
+    uint8_t *attrs;
+
+    /* Per physical row. */
+    struct wlterm_grid_tail *tails;
+
+    /* One flag per visible row, set whenever the row changes. */
+    uint8_t *dirty;
+
+    /* The cursor column may equal `cols`: the next character wraps. */
+    int cursor_row;
+    int cursor_col;
+
+    /* Scrolling region, inclusive. */
+    int scroll_top;
+    int scroll_bottom;
+    bool autowrap;
+
+    /* Attributes applied to newly written cells. */
+    uint32_t pen_fg;
+    uint32_t pen_bg;
+    uint8_t pen_attrs;
+
+    uint64_t lines_scrolled;
+
+    /* Lines scrolled off the top of the screen go here, if set. */
+    struct wlterm_scrollback *scrollback;
+};
+
+struct wlterm_grid *wlterm_grid_create(int rows, int cols);
+void wlterm_grid_destroy(struct wlterm_grid *);
+void wlterm_grid_resize(struct wlterm_grid *, int rows, int cols);
+
+void wlterm_grid_clear_rows(struct wlterm_grid *, int row, int n);
+void wlterm_grid_erase(struct wlterm_grid *, int row, int from, int to);
+void wlterm_grid_scroll(struct wlterm_grid *, int n);
+void wlterm_grid_scroll_down(struct wlterm_grid *, int n);
+void wlterm_grid_set_margins(struct wlterm_grid *, int top, int bottom);
+void wlterm_grid_insert_lines(struct wlterm_grid *, int n);
+void wlterm_grid_delete_lines(struct wlterm_grid *, int n);
+void wlterm_grid_insert_chars(struct wlterm_grid *, int n);
+void wlterm_grid_delete_chars(struct wlterm_grid *, int n);
+void wlterm_grid_move_cursor(struct wlterm_grid *, int row, int col);
+
+void wlterm_grid_put(struct wlterm_grid *, uint32_t codepoint);
+void wlterm_grid_put_ascii(struct wlterm_grid *, const char *s, size_t len);
+void wlterm_grid_put_codepoints(struct wlterm_grid *, const uint32_t *codepoints,
+                                size_t len);
+void wlterm_grid_linefeed(struct wlterm_grid *);
+void wlterm_grid_reverse_index(struct wlterm_grid *);
+void wlterm_grid_newline(struct wlterm_grid *);
+void wlterm_grid_write(struct wlterm_grid *, const char *utf8, size_t len);
+
+/* Offset of the first cell of visible row `row` in the attribute arrays. */
+static inline size_t wlterm_grid_row(const struct wlterm_grid *g, int row) {
+    int r = g->head + row;
+    if (r >= g->rows)
+        r -= g->rows;
+    return (size_t)r * g->cols;
+}
+
+/* Decode one UTF-8 sequence, returns the number of bytes consumed. Invalid
+   input decodes to U+FFFD one byte at a time. */
+static inline int utf8_decode(const char *s, int32_t *codepoint) {
+    const unsigned char *u = (const unsigned char *)s;
+
+    if (u[0] < 0x80) {
+        *codepoint = u[0];
+        return 1;
+    }
+    if ((u[0] & 0xe0) == 0xc0 && (u[1] & 0xc0) == 0x80) {
+        *codepoint = ((u[0] & 0x1f) << 6) | (u[1] & 0x3f);
+        return 2;
+    }
+    if ((u[0] & 0xf0) == 0xe0 && (u[1] & 0xc0) == 0x80 && (u[2] & 0xc0) == 0x80) {
+        *codepoint = ((u[0] & 0x0f) << 12) | ((u[1] & 0x3f) << 6) | (u[2] & 0x3f);
+        return 3;
+    }
+    if ((u[0] & 0xf8) == 0xf0 && (u[1] & 0xc0) == 0x80 && (u[2] & 0xc0) == 0x80 &&
+        (u[3] & 0xc0) == 0x80) {
+        *codepoint = ((u[0] & 0x07) << 18) | ((u[1] & 0x3f) << 12) |
+                     ((u[2] & 0x3f) << 6) | (u[3] & 0x3f);
+        return 4;
+    }
+    *codepoint = 0xfffd;
+    return 1;
+}
+
+#endif /* GRID_H */
@@ -0,0 +1,123 @@
+#include <stdlib.h>
+
+#include "layout.h"
+
+
+struct wlterm_layout *wlterm_layout_create(struct wlterm_window *window) {
+    struct wlterm_layout *l = calloc(1, sizeof(struct wlterm_layout));
+    if (!l) return NULL;
+
+    l->split = WLTERM_SPLIT_NONE;
+    l->ratio = 0.5;
+    l->window = window;
+    return l;
+}
+
+/* Destroy a whole (sub)tree. The windows are left alone. */
+void wlterm_layout_destroy(struct wlterm_layout *l) {
+    if (!l)
+        return;
+    wlterm_layout_destroy(l->children[0]);
+    wlterm_layout_destroy(l->children[1]);
+    free(l);
+}
+
+static void replace_child(struct wlterm_layout **root, struct wlterm_layout *old,
+                          struct wlterm_layout *new) {
+    struct wlterm_layout *parent = old->parent;
+
+    new->parent = parent;
+    if (!parent)
+        *root = new;
+    else
+        parent->children[parent->children[0] == old ? 0 : 1] = new;
+}
+
+/* Split `leaf` in two, with `window` in the new half: to the right of it or
+   below it. Returns the new leaf. */
+struct wlterm_layout *wlterm_layout_split(struct wlterm_layout **root,
+                                          struct wlterm_layout *leaf,
+                                          enum wlterm_split split,
+                                          struct wlterm_window *window) {
+    struct wlterm_layout *node = wlterm_layout_create(NULL);
+    struct wlterm_layout *added = wlterm_layout_create(window);
+
+    node->split = split;
+    node->rect = leaf->rect;
+    replace_child(root, leaf, node);
+
+    node->children[0] = leaf;
+    node->children[1] = added;
+    leaf->parent = node;
+    added->parent = node;
+    return added;
+}
+
+/* Remove `leaf` from the tree, its sibling takes over the space of their
+   parent split. */
+void wlterm_layout_remove(struct wlterm_layout **root, struct wlterm_layout *leaf) {
+    struct wlterm_layout *parent = leaf->parent;
+
+    if (!parent) {
+        *root = NULL;
+    } else {
+        struct wlterm_layout *sibling = parent->children[parent->children[0] == leaf];
+        replace_child(root, parent, sibling);
+        free(parent);
+    }
+    free(leaf);
+}
+
+/* Move the closest `split` edge of `leaf` by `delta` pixels, growing the leaf
+   for positive values. False if there is no such edge, or it can't move. */
+bool wlterm_layout_resize(struct wlterm_layout *leaf, enum wlterm_split split, int delta) {
+    struct wlterm_layout *child = leaf, *node = leaf->parent;
+
+    while (node && node->split != split) {
+        child = node;
+        node = node->parent;
+    }
+    if (!node)
+        return false;
+
+    int size = split == WLTERM_SPLIT_HORIZONTAL ? node->rect.width : node->rect.height;
+    if (size <= 2 * WLTERM_LAYOUT_MIN_SIZE)
+        return false;
+
+    /* Growing the second child moves the edge the other way. */
+    int first = node->ratio * size + (node->children[0] == child ? delta : -delta);
+    if (first < WLTERM_LAYOUT_MIN_SIZE)
+        first = WLTERM_LAYOUT_MIN_SIZE;
+    if (first > size - WLTERM_LAYOUT_MIN_SIZE)
+        first = size - WLTERM_LAYOUT_MIN_SIZE;
+
+    float ratio = (float)first / size;
+    if (ratio == node->ratio)
+        return false;
+    node->ratio = ratio;
+    return true;
+}
+
+/* Lay the tree out in `rect`, calling `place` for every window. */
+void wlterm_layout_apply(struct wlterm_layout *l, struct wlterm_rect rect,
+                         wlterm_layout_place_func place) {
+    l->rect = rect;
+
+    if (l->split == WLTERM_SPLIT_NONE) {
+        place(l->window, rect);
+        return;
+    }
+
+    struct wlterm_rect a = rect, b = rect;
+    if (l->split == WLTERM_SPLIT_HORIZONTAL) {
+        a.width = rect.width * l->ratio;
+        b.x = rect.x + a.width;
+        b.width = rect.width - a.width;
+    } else {
+        a.height = rect.height * l->ratio;
+        b.y = rect.y + a.height;
+        b.height = rect.height - a.height;
+    }
+    wlterm_layout_apply(l->children[0], a, place);
+    wlterm_layout_apply(l->children[1], b, place);
+}
@@ -0,0 +1,49 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stdbool.h>
+
+struct wlterm_window;
+
+struct wlterm_rect {
+    int x;
+    int y;
+    int width;
+    int height;
+};
+
+enum wlterm_split {
+    WLTERM_SPLIT_NONE,        /* A leaf, showing a window. */
+    WLTERM_SPLIT_HORIZONTAL,  /* Children side by side. */
+    WLTERM_SPLIT_VERTICAL,    /* Children one above the other. */
+};
+
+/* Windows never get narrower or lower than this many pixels. */
+#define WLTERM_LAYOUT_MIN_SIZE 16
+
+/* How a frame is tiled into windows: a binary tree of splits, with a window
+ * at each leaf. A split gives its first child `ratio` of its width or height
+ * and the second child the rest, so resizing a frame keeps the proportions.
+ * The tree only deals with geometry; placing the windows into the rectangles
+ * is up to the caller of wlterm_layout_apply(). */
+struct wlterm_layout {
+    enum wlterm_split split;
+    struct wlterm_layout *parent;
+    struct wlterm_layout *children[2];
+    float ratio;
+
+    struct wlterm_window *window;  /* Leaves only. */
+    struct wlterm_rect rect;
+};
+
+typedef void (*wlterm_layout_place_func)(struct wlterm_window *, struct wlterm_rect);
+
+struct wlterm_layout *wlterm_layout_create(struct wlterm_window *);
+void wlterm_layout_destroy(struct wlterm_layout *);
+struct wlterm_layout *wlterm_layout_split(struct wlterm_layout **root, struct wlterm_layout *,
+                                          enum wlterm_split, struct wlterm_window *);
+void wlterm_layout_remove(struct wlterm_layout **root, struct wlterm_layout *);
+bool wlterm_layout_resize(struct wlterm_layout *, enum wlterm_split, int delta);
+void wlterm_layout_apply(struct wlterm_layout *, struct wlterm_rect, wlterm_layout_place_func);
+
+#endif /* LAYOUT_H */
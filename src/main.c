@@ -1,11 +1,57 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "wlterm.h"
 
 
+static void usage() {
+    fprintf(stderr, "usage: wlterm [--server | --once] [file]\n"
+            "  --server  keep running without frames, and open new ones on\n"
+            "            request from wlterm-client\n"
+            "  --once    exit after drawing the first frame\n"
+            "  file      view the file instead of running a shell\n");
+}
+
 int main(int argc, char *argv[]) {
+    bool server = false;
+    bool once = false;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--server") == 0) {
+            server = true;
+        } else if (strcmp(argv[i], "--once") == 0) {
+            once = true;
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
 
     struct wlterm_application *app = wlterm_application_create();
 
-    wlterm_frame_create(app);
+    if (server) {
+        char *path = wlterm_server_socket_path();
+        app->server = wlterm_server_create(app, path);
+        free(path);
+        if (!app->server)
+            return 1;
+    } else {
+        struct wlterm_frame *f = wlterm_frame_create(app);
+        f->close_after_first_frame = once;
+
+        if (path) {
+            struct wlterm_document *d = wlterm_document_open(path);
+            if (!d) {
+                perror(path);
+                return 1;
+            }
+            wlterm_window_view_document(f->root_window, d);
+        }
+    }
 
     wlterm_application_run(app);  /* Runs until all frames closed */
 
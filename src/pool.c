@@ -0,0 +1,113 @@
+#include <stdlib.h>
+
+#include "pool.h"
+
+
+static void run_items(struct wlterm_pool *p, wlterm_pool_func func, void **items,
+                      int n) {
+    int i;
+    while ((i = atomic_fetch_add(&p->next, 1)) < n) {
+        func(items[i]);
+        atomic_fetch_add(&p->completed, 1);
+    }
+}
+
+static void *worker_thread(void *data) {
+    struct wlterm_pool *p = data;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (p->batch == seen && !p->quit)
+            pthread_cond_wait(&p->start, &p->lock);
+        if (p->quit)
+            break;
+
+        /* The batch can't change while any worker is active in it. */
+        seen = p->batch;
+        wlterm_pool_func func = p->func;
+        void **items = p->items;
+        int n = p->n_items;
+        p->active++;
+        pthread_mutex_unlock(&p->lock);
+
+        run_items(p, func, items, n);
+
+        pthread_mutex_lock(&p->lock);
+        p->active--;
+        pthread_cond_signal(&p->done);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+/* `n_threads` counts the caller, so 1 starts no threads at all. */
+struct wlterm_pool *wlterm_pool_create(int n_threads) {
+    struct wlterm_pool *p = calloc(1, sizeof(struct wlterm_pool));
+    if (!p) return NULL;
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->start, NULL);
+    pthread_cond_init(&p->done, NULL);
+    atomic_init(&p->next, 0);
+    atomic_init(&p->completed, 0);
+
+    p->n_threads = 1;
+    p->threads = calloc(n_threads > 1 ? n_threads - 1 : 1, sizeof(pthread_t));
+    for (int i = 0; i < n_threads - 1; ++i) {
+        if (pthread_create(&p->threads[i], NULL, worker_thread, p) != 0)
+            break;
+        p->n_threads++;
+    }
+    return p;
+}
+
+void wlterm_pool_destroy(struct wlterm_pool *p) {
+    if (!p)
+        return;
+
+    pthread_mutex_lock(&p->lock);
+    p->quit = true;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+
+    for (int i = 0; i < p->n_threads - 1; ++i)
+        pthread_join(p->threads[i], NULL);
+
+    pthread_cond_destroy(&p->done);
+    pthread_cond_destroy(&p->start);
+    pthread_mutex_destroy(&p->lock);
+    free(p->threads);
+    free(p);
+}
+
+/* Call `func` on each of the `n` items, spread over the pool, and wait for
+   all of them. */
+void wlterm_pool_run(struct wlterm_pool *p, wlterm_pool_func func, void **items, int n) {
+    if (p->n_threads == 1 || n < 2) {
+        for (int i = 0; i < n; ++i)
+            func(items[i]);
+        return;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    /* Workers that woke up late for the previous batch still read its
+       items. */
+    while (p->active)
+        pthread_cond_wait(&p->done, &p->lock);
+    p->func = func;
+    p->items = items;
+    p->n_items = n;
+    atomic_store(&p->next, 0);
+    atomic_store(&p->completed, 0);
+    p->batch++;
+    pthread_cond_broadcast(&p->start);
+    pthread_mutex_unlock(&p->lock);
+
+    run_items(p, func, items, n);
+
+    pthread_mutex_lock(&p->lock);
+    while (p->active || atomic_load(&p->completed) < n)
+        pthread_cond_wait(&p->done, &p->lock);
+    pthread_mutex_unlock(&p->lock);
+}
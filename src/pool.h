@@ -0,0 +1,39 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef void (*wlterm_pool_func)(void *item);
+
+/* A fixed set of threads running a function over a batch of items.
+ *
+ * The calling thread works on the batch too, and wlterm_pool_run() returns
+ * once every item is done, so a pool of one thread is just a loop. Items are
+ * handed out one at a time from a shared counter: they may take very
+ * different amounts of time, e.g. a busy window and an idle one. */
+struct wlterm_pool {
+    int n_threads;  /* Including the caller. */
+    pthread_t *threads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;  /* A new batch is out. */
+    pthread_cond_t done;   /* A worker finished its part of a batch. */
+    uint64_t batch;
+    int active;            /* Workers inside a batch. */
+    bool quit;
+
+    wlterm_pool_func func;
+    void **items;
+    int n_items;
+    atomic_int next;
+    atomic_int completed;
+};
+
+struct wlterm_pool *wlterm_pool_create(int n_threads);
+void wlterm_pool_destroy(struct wlterm_pool *);
+void wlterm_pool_run(struct wlterm_pool *, wlterm_pool_func, void **items, int n);
+
+#endif /* POOL_H */
@@ -0,0 +1,173 @@
+#include <string.h>
+
+#include <EGL/egl.h>
+
+#include "profile.h"
+
+/* GL_EXT_disjoint_timer_query */
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+
+void wlterm_histogram_add(struct wlterm_histogram *h, uint64_t us) {
+    int bucket = us ? 63 - __builtin_clzll(us) : 0;
+    if (bucket >= WLTERM_HISTOGRAM_BUCKETS)
+        bucket = WLTERM_HISTOGRAM_BUCKETS - 1;
+
+    h->buckets[bucket]++;
+    if (!h->count || us < h->min)
+        h->min = us;
+    if (us > h->max)
+        h->max = us;
+    h->count++;
+    h->sum += us;
+}
+
+void wlterm_histogram_merge(struct wlterm_histogram *h, const struct wlterm_histogram *o) {
+    if (!o->count)
+        return;
+    if (!h->count || o->min < h->min)
+        h->min = o->min;
+    if (o->max > h->max)
+        h->max = o->max;
+    h->count += o->count;
+    h->sum += o->sum;
+    for (int i = 0; i < WLTERM_HISTOGRAM_BUCKETS; ++i)
+        h->buckets[i] += o->buckets[i];
+}
+
+/* Upper bound of the bucket holding the p-th percentile. */
+uint64_t wlterm_histogram_percentile(const struct wlterm_histogram *h, double p) {
+    uint64_t rank = h->count * p / 100.0;
+    uint64_t seen = 0;
+
+    for (int i = 0; i < WLTERM_HISTOGRAM_BUCKETS; ++i) {
+        seen += h->buckets[i];
+        if (seen > rank) {
+            uint64_t upper = (2ull << i) - 1;
+            return upper < h->max ? upper : h->max;
+        }
+    }
+    return h->max;
+}
+
+static const char *metric_names[WLTERM_PROFILE_METRICS] = {
+    [WLTERM_PROFILE_CPU_RENDER] = "cpu_render_us",
+    [WLTERM_PROFILE_GPU_RENDER] = "gpu_render_us",
+    [WLTERM_PROFILE_SWAP] = "swap_us",
+    [WLTERM_PROFILE_INPUT_LATENCY] = "input_latency_us",
+};
+
+static void histogram_json(const struct wlterm_histogram *h, FILE *out) {
+    fprintf(out, "{\"count\": %lu, \"mean\": %.1f, \"min\": %lu, \"max\": %lu, "
+            "\"p50\": %lu, \"p90\": %lu, \"p99\": %lu, \"buckets\": [",
+            h->count, h->count ? (double)h->sum / h->count : 0.0, h->min, h->max,
+            wlterm_histogram_percentile(h, 50), wlterm_histogram_percentile(h, 90),
+            wlterm_histogram_percentile(h, 99));
+
+    /* Trailing empty buckets are left out. */
+    int n = WLTERM_HISTOGRAM_BUCKETS;
+    while (n > 0 && !h->buckets[n - 1])
+        n--;
+    for (int i = 0; i < n; ++i)
+        fprintf(out, "%s%u", i ? ", " : "", h->buckets[i]);
+    fprintf(out, "]}");
+}
+
+void wlterm_profile_dump_json(const struct wlterm_profile *p, FILE *out) {
+    fprintf(out, "{\n  \"frames\": %lu,\n  \"glyph_misses\": %lu,\n"
+            "  \"glyphs_generated\": %lu,\n  \"atlas_pages\": %lu,\n"
+            "  \"atlas_evictions\": %lu,\n  \"gpu_timer\": %s,\n"
+            "  \"scheduler\": %s,\n  \"frames_on_time\": %lu,\n  \"frames_late\": %lu,\n",
+            p->frames, p->glyph_misses, p->glyphs_generated, p->atlas_pages,
+            p->atlas_evictions, p->gpu_timer ? "true" : "false",
+            p->scheduler ? "true" : "false", p->frames_on_time, p->frames_late);
+    for (int i = 0; i < WLTERM_PROFILE_METRICS; ++i) {
+        fprintf(out, "  \"%s\": ", metric_names[i]);
+        histogram_json(&p->metrics[i], out);
+        fprintf(out, "%s\n", i < WLTERM_PROFILE_METRICS - 1 ? "," : "");
+    }
+    fprintf(out, "}\n");
+}
+
+bool wlterm_profile_dump(const struct wlterm_profile *p, const char *path) {
+    if (strcmp(path, "-") == 0) {
+        wlterm_profile_dump_json(p, stderr);
+        return true;
+    }
+
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return false;
+    wlterm_profile_dump_json(p, f);
+    return fclose(f) == 0;
+}
+
+
+static void (*get_query_object_ui64v)(GLuint id, GLenum pname, GLuint64 *params);
+
+void wlterm_gpu_timer_init(struct wlterm_gpu_timer *t) {
+    memset(t, 0, sizeof(*t));
+
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "GL_EXT_disjoint_timer_query"))
+        return;
+
+    if (!get_query_object_ui64v)
+        get_query_object_ui64v = (void *)eglGetProcAddress("glGetQueryObjectui64vEXT");
+    if (!get_query_object_ui64v)
+        return;
+
+    glGenQueries(WLTERM_GPU_TIMER_QUERIES, t->queries);
+    t->supported = true;
+}
+
+void wlterm_gpu_timer_finish(struct wlterm_gpu_timer *t) {
+    if (t->supported)
+        glDeleteQueries(WLTERM_GPU_TIMER_QUERIES, t->queries);
+    t->supported = false;
+}
+
+void wlterm_gpu_timer_begin(struct wlterm_gpu_timer *t) {
+    /* All queries in flight: skip timing this frame. */
+    if (!t->supported || t->pending == WLTERM_GPU_TIMER_QUERIES)
+        return;
+    glBeginQuery(GL_TIME_ELAPSED_EXT,
+                 t->queries[(t->head + t->pending) % WLTERM_GPU_TIMER_QUERIES]);
+}
+
+void wlterm_gpu_timer_end(struct wlterm_gpu_timer *t) {
+    if (!t->supported || t->pending == WLTERM_GPU_TIMER_QUERIES)
+        return;
+    glEndQuery(GL_TIME_ELAPSED_EXT);
+    t->pending++;
+}
+
+void wlterm_gpu_timer_collect(struct wlterm_gpu_timer *t, struct wlterm_histogram *h) {
+    if (!t->supported)
+        return;
+
+    /* Results are meaningless across a disjoint event, e.g. a clock change. */
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+
+    while (t->pending) {
+        GLuint query = t->queries[t->head];
+        GLuint available = 0;
+        glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+
+        GLuint64 ns = 0;
+        get_query_object_ui64v(query, GL_QUERY_RESULT, &ns);
+        if (!disjoint)
+            wlterm_histogram_add(h, ns / 1000);
+
+        t->head = (t->head + 1) % WLTERM_GPU_TIMER_QUERIES;
+        t->pending--;
+    }
+}
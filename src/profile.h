@@ -0,0 +1,76 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <GLES3/gl32.h>
+
+/* Bucket n counts samples in [2^n, 2^(n+1)) us, the last one everything
+   above. */
+#define WLTERM_HISTOGRAM_BUCKETS 24
+
+struct wlterm_histogram {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint32_t buckets[WLTERM_HISTOGRAM_BUCKETS];
+};
+
+void wlterm_histogram_add(struct wlterm_histogram *, uint64_t us);
+void wlterm_histogram_merge(struct wlterm_histogram *, const struct wlterm_histogram *);
+uint64_t wlterm_histogram_percentile(const struct wlterm_histogram *, double p);
+
+enum wlterm_profile_metric {
+    WLTERM_PROFILE_CPU_RENDER,     /* Drawing a frame, up to the swap. */
+    WLTERM_PROFILE_GPU_RENDER,     /* GPU time of the same, from timer queries. */
+    WLTERM_PROFILE_SWAP,           /* eglSwapBuffers* */
+    WLTERM_PROFILE_INPUT_LATENCY,  /* Key press to the next presented frame. */
+    WLTERM_PROFILE_METRICS,
+};
+
+/* Timings of everything that goes into getting a frame on screen, collected
+ * for the whole application and dumped as JSON: to the file named by
+ * $WLTERM_PROFILE ("-" for stderr) on exit, or any time on SIGUSR1. */
+struct wlterm_profile {
+    struct wlterm_histogram metrics[WLTERM_PROFILE_METRICS];
+
+    uint64_t frames;
+    uint64_t glyph_misses;     /* Glyphs drawn as placeholders. */
+    uint64_t glyphs_generated;
+    uint64_t atlas_pages;
+    uint64_t atlas_evictions;  /* Atlas pages emptied for new glyphs. */
+    bool gpu_timer;
+
+    /* Presented frames that made the refresh they were drawn for, and ones
+       that didn't, with the scheduler on. */
+    bool scheduler;
+    uint64_t frames_on_time;
+    uint64_t frames_late;
+};
+
+void wlterm_profile_dump_json(const struct wlterm_profile *, FILE *);
+bool wlterm_profile_dump(const struct wlterm_profile *, const char *path);
+
+
+/* GPU render times through GL_EXT_disjoint_timer_query. Results arrive a few
+   frames late, so queries go round a small ring and are collected once
+   available. Query objects are per context: one timer per frame. */
+#define WLTERM_GPU_TIMER_QUERIES 4
+
+struct wlterm_gpu_timer {
+    bool supported;
+    GLuint queries[WLTERM_GPU_TIMER_QUERIES];
+    int head;     /* Oldest query in flight. */
+    int pending;
+};
+
+void wlterm_gpu_timer_init(struct wlterm_gpu_timer *);
+void wlterm_gpu_timer_finish(struct wlterm_gpu_timer *);
+void wlterm_gpu_timer_begin(struct wlterm_gpu_timer *);
+void wlterm_gpu_timer_end(struct wlterm_gpu_timer *);
+void wlterm_gpu_timer_collect(struct wlterm_gpu_timer *, struct wlterm_histogram *);
+
+#endif /* PROFILE_H */
@@ -0,0 +1,253 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "pty.h"
+
+
+static void signal_fd(int fd) {
+    uint64_t one = 1;
+    while (write(fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+}
+
+static void publish(struct wlterm_pty *pty, size_t tail) {
+    atomic_store_explicit(&pty->tail, tail + 1, memory_order_release);
+    signal_fd(pty->event_fd);
+}
+
+/* A read returns at most what the kernel's PTY buffer holds, a few KiB, so
+   reads go one after the other into the same chunk. It is handed over once
+   full, or as soon as the master has nothing more for now: under a flood
+   chunks fill up, typing still shows up right away. */
+static void *reader_thread(void *data) {
+    struct wlterm_pty *pty = data;
+
+    for (;;) {
+        size_t tail = atomic_load_explicit(&pty->tail, memory_order_relaxed);
+
+        /* Ring full: wait until the main thread releases some chunks. */
+        while (tail - atomic_load_explicit(&pty->head, memory_order_acquire) ==
+               WLTERM_PTY_CHUNKS) {
+            uint64_t n;
+            if (read(pty->space_fd, &n, sizeof(n)) < 0 && errno != EINTR)
+                goto out;
+        }
+
+        struct wlterm_pty_chunk *c = &pty->chunks[tail & (WLTERM_PTY_CHUNKS - 1)];
+        c->len = 0;
+        while (c->len < WLTERM_PTY_CHUNK_SIZE) {
+            ssize_t n = read(pty->master, c->data + c->len, WLTERM_PTY_CHUNK_SIZE - c->len);
+
+            if (n > 0) {
+                c->len += n;
+                pty->bytes_read += n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EAGAIN) {
+                if (c->len)
+                    break;
+                struct pollfd pfd = {.fd = pty->master, .events = POLLIN};
+                poll(&pfd, 1, -1);
+                continue;
+            }
+
+            /* EIO once the child has closed the slave side. */
+            if (c->len)
+                publish(pty, tail);
+            goto out;
+        }
+        publish(pty, tail);
+    }
+
+out:
+    atomic_store(&pty->closed, true);
+    signal_fd(pty->event_fd);
+    return NULL;
+}
+
+static void child_exec(const char *slave_name, char *const argv[], int rows, int cols) {
+
+    setsid();
+
+    int slave = open(slave_name, O_RDWR);
+    if (slave < 0)
+        _exit(1);
+
+    ioctl(slave, TIOCSCTTY, 0);
+
+    struct winsize ws = {.ws_row = rows, .ws_col = cols};
+    ioctl(slave, TIOCSWINSZ, &ws);
+
+    dup2(slave, STDIN_FILENO);
+    dup2(slave, STDOUT_FILENO);
+    dup2(slave, STDERR_FILENO);
+    if (slave > STDERR_FILENO)
+        close(slave);
+
+    setenv("TERM", "xterm-256color", 1);
+
+    if (argv) {
+        execvp(argv[0], argv);
+    } else {
+        const char *shell = getenv("SHELL");
+        if (!shell)
+            shell = "/bin/sh";
+        execl(shell, shell, (char *)NULL);
+    }
+    _exit(127);
+}
+
+/* Hang up on the child and reap it. It gets a moment to exit by itself,
+   then it is killed: a child ignoring SIGHUP must not hang the caller. */
+static void reap_child(pid_t child) {
+    kill(child, SIGHUP);
+    for (int i = 0; i < 20; ++i) {
+        if (waitpid(child, NULL, WNOHANG) != 0)
+            return;
+        usleep(1000);
+    }
+    kill(child, SIGKILL);
+    while (waitpid(child, NULL, 0) < 0 && errno == EINTR) {}
+}
+
+/* Spawn `argv` (or the user's shell if NULL) on a new pseudoterminal. */
+struct wlterm_pty *wlterm_pty_create(char *const argv[], int rows, int cols) {
+    struct wlterm_pty *pty = calloc(1, sizeof(struct wlterm_pty));
+    if (!pty) return NULL;
+
+    pty->master = -1;
+    pty->event_fd = -1;
+    pty->space_fd = -1;
+    pty->child = -1;
+
+    pty->chunks = malloc(WLTERM_PTY_CHUNKS * sizeof(struct wlterm_pty_chunk));
+    pty->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    pty->space_fd = eventfd(0, EFD_CLOEXEC);
+    if (!pty->chunks || pty->event_fd < 0 || pty->space_fd < 0) {
+        perror("wlterm: pty");
+        goto err;
+    }
+    atomic_init(&pty->head, 0);
+    atomic_init(&pty->tail, 0);
+    atomic_init(&pty->closed, false);
+
+    /* Non-blocking, so the reader can tell when the child is done writing
+       for now. */
+    pty->master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC | O_NONBLOCK);
+    if (pty->master < 0 || grantpt(pty->master) || unlockpt(pty->master)) {
+        perror("wlterm: posix_openpt");
+        goto err;
+    }
+
+    const char *slave_name = ptsname(pty->master);
+
+    pty->child = fork();
+    if (pty->child < 0) {
+        perror("wlterm: fork");
+        goto err;
+    }
+    if (pty->child == 0)
+        child_exec(slave_name, argv, rows, cols);
+
+    int error = pthread_create(&pty->thread, NULL, reader_thread, pty);
+    if (error) {
+        fprintf(stderr, "wlterm: pthread_create: %s\n", strerror(error));
+        reap_child(pty->child);
+        goto err;
+    }
+    return pty;
+
+err:
+    if (pty->master >= 0)
+        close(pty->master);
+    if (pty->event_fd >= 0)
+        close(pty->event_fd);
+    if (pty->space_fd >= 0)
+        close(pty->space_fd);
+    free(pty->chunks);
+    free(pty);
+    return NULL;
+}
+
+void wlterm_pty_destroy(struct wlterm_pty *pty) {
+
+    /* The reader only ever blocks in poll() or read(), both cancellation
+       points. */
+    pthread_cancel(pty->thread);
+    pthread_join(pty->thread, NULL);
+
+    close(pty->master);
+    reap_child(pty->child);
+
+    close(pty->event_fd);
+    close(pty->space_fd);
+    free(pty->chunks);
+    free(pty);
+}
+
+/* Pass every queued chunk to `func` on the calling thread. Returns the number
+   of bytes handed over. */
+size_t wlterm_pty_drain(struct wlterm_pty *pty, wlterm_pty_data_func func, void *data) {
+    uint64_t n;
+    size_t bytes = 0;
+
+    /* Reset the event counter first, so that chunks queued while draining
+       wake up the next poll. */
+    while (read(pty->event_fd, &n, sizeof(n)) < 0 && errno == EINTR) {}
+
+    size_t head = atomic_load_explicit(&pty->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&pty->tail, memory_order_acquire);
+
+    if (head == tail)
+        return 0;
+
+    while (head != tail) {
+        struct wlterm_pty_chunk *c = &pty->chunks[head & (WLTERM_PTY_CHUNKS - 1)];
+        func(data, c->data, c->len);
+        bytes += c->len;
+
+        /* Hand each chunk back as soon as it is consumed. */
+        atomic_store_explicit(&pty->head, ++head, memory_order_release);
+    }
+
+    signal_fd(pty->space_fd);
+
+    return bytes;
+}
+
+ssize_t wlterm_pty_write(struct wlterm_pty *pty, const char *buf, size_t len) {
+    size_t written = 0;
+
+    while (written < len) {
+        ssize_t n = write(pty->master, buf + written, len - written);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN) {
+                struct pollfd pfd = {.fd = pty->master, .events = POLLOUT};
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            return -1;
+        }
+        written += n;
+    }
+    return written;
+}
+
+void wlterm_pty_resize(struct wlterm_pty *pty, int rows, int cols) {
+    struct winsize ws = {.ws_row = rows, .ws_col = cols};
+    ioctl(pty->master, TIOCSWINSZ, &ws);
+}
@@ -0,0 +1,63 @@
+#ifndef PTY_H
+#define PTY_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define WLTERM_PTY_CHUNK_SIZE (64 * 1024)
+#define WLTERM_PTY_CHUNKS 16  /* Must be a power of two. */
+
+struct wlterm_pty_chunk {
+    size_t len;
+    char data[WLTERM_PTY_CHUNK_SIZE];
+};
+
+/* A child process running on a pseudoterminal.
+ *
+ * The master side is read on a dedicated thread into large chunks, which are
+ * handed to the main thread through a single-producer single-consumer ring.
+ * A chunk takes as many reads as come in back to back, so a flood fills the
+ * ring's whole megabyte before the reader has to wait.
+ * `event_fd` becomes readable whenever there is something to drain, so the
+ * main loop can poll it along with the Wayland connection. */
+struct wlterm_pty {
+    int master;
+    pid_t child;
+
+    int event_fd;   /* reader -> main: chunks queued or child gone */
+    int space_fd;   /* main -> reader: chunks released */
+
+    pthread_t thread;
+
+    struct wlterm_pty_chunk *chunks;
+    _Atomic size_t head;  /* Next chunk to drain, owned by the main thread. */
+    _Atomic size_t tail;  /* Next chunk to fill, owned by the reader. */
+    atomic_bool closed;
+
+    uint64_t bytes_read;
+};
+
+typedef void (*wlterm_pty_data_func)(void *data, const char *buf, size_t len);
+
+struct wlterm_pty *wlterm_pty_create(char *const argv[], int rows, int cols);
+void wlterm_pty_destroy(struct wlterm_pty *);
+size_t wlterm_pty_drain(struct wlterm_pty *, wlterm_pty_data_func, void *);
+ssize_t wlterm_pty_write(struct wlterm_pty *, const char *, size_t);
+void wlterm_pty_resize(struct wlterm_pty *, int rows, int cols);
+
+/* Chunks the reader has queued and the main thread not yet drained. */
+static inline size_t wlterm_pty_queued(struct wlterm_pty *pty) {
+    return atomic_load(&pty->tail) - atomic_load(&pty->head);
+}
+
+/* True once the child has exited and every chunk has been drained. */
+static inline bool wlterm_pty_done(struct wlterm_pty *pty) {
+    return atomic_load(&pty->closed) &&
+        atomic_load(&pty->head) == atomic_load(&pty->tail);
+}
+
+#endif /* PTY_H */
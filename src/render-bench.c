@@ -0,0 +1,481 @@
+/* Rendering benchmark on the headless backend: the same frame and window
+ * code as wlterm, drawing into an offscreen framebuffer, so it runs without a
+ * compositor (or a GPU, with Mesa's software drivers).
+ *
+ * Usage: wlterm-render-bench [--frames N] [--size WxH] [--snapshot file.ppm]
+ *                            [--open N] [--threads 1,2,4,...] [--split N]
+ *                            [--scroll] [--smooth PX] [--scale S] [--rescale]
+ *                            [--cells] [--software] [--flood BYTES]
+ *                            [--soak N]
+ *
+ * The snapshot is written after the timed frames, for comparing rendering
+ * output pixel for pixel between changes.
+ *
+ * With --open, that many frames are open and each gets a few new lines of
+ * output before every round of rendering, like a set of busy terminals. The
+ * rounds are repeated for each render pool size in --threads.
+ *
+ * With --split, the frame is tiled into that many windows, and only the
+ * first one is redrawn in the timed frames.
+ *
+ * With --smooth, the first window then scrolls through its scrollback by
+ * that many pixels a frame, which only draws the rows coming into view.
+ *
+ * --scale draws at that many pixels per unit, and --rescale switches
+ * between 1 and 1.5 every frame, to show it costs no glyph generation.
+ *
+ * --cells runs the same frames in both render modes, glyph batches and the
+ * cell texture, typing a character a frame and then printing a line a
+ * frame.
+ *
+ * --software draws the frames on the CPU instead, into shared memory
+ * buffers; compare with a run on llvmpipe (LIBGL_ALWAYS_SOFTWARE=1) for the
+ * same workload.
+ *
+ * --flood pipes that many bytes of `yes` through a PTY into the first
+ * window, once with the frame hidden and once visible at 60 Hz, and reports
+ * how fast they are parsed.
+ *
+ * --soak opens, draws and closes that many frames one after the other, and
+ * fails if memory keeps growing or opening frames slows down. */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "glyphs.h"
+#include "wlterm.h"
+
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Colored, varied log lines, so every row has different glyphs and runs. */
+static void feed_log(struct wlterm_vt *vt, int lines) {
+    static const char *levels[] = {
+        "\033[32mINFO\033[0m", "\033[33mWARN\033[0m", "\033[1;31mERROR\033[0m",
+        "\033[36mDEBUG\033[0m",
+    };
+    char line[256];
+
+    for (int i = 0; i < lines; ++i) {
+        int n = snprintf(line, sizeof(line),
+                         "2024-01-01 12:%02d:%02d.%03d %s worker-%d: request %d "
+                         "took %d ms (%s)\r\n",
+                         i / 60 % 60, i % 60, i * 7 % 1000, levels[i % 4], i % 8,
+                         i * 31, i * 17 % 500, i % 3 ? "ok" : "cache miss");
+        wlterm_vt_feed(vt, line, n);
+    }
+}
+
+/* Render until every glyph on screen has been generated, so the timed frames
+   don't include any placeholders. */
+static void settle_glyphs(struct wlterm_frame *f) {
+    struct wlterm_glyph_worker *gw = f->application->glyph_worker;
+
+    for (;;) {
+        FOR_EACH_WINDOW (f, w)
+            wlterm_window_damage_all(w);
+        wlterm_frame_render(f);
+
+        bool missing = false;
+        FOR_EACH_WINDOW (f, w)
+            missing |= w->text.missing;
+        if (!missing)
+            break;
+
+        struct pollfd pfd = {.fd = gw->event_fd, .events = POLLIN};
+        poll(&pfd, 1, 1000);
+        wlterm_glyph_worker_drain(gw);
+    }
+}
+
+static bool write_ppm(struct wlterm_frame *f, const char *path) {
+    int width = f->buffer_width;
+    int height = f->buffer_height;
+    uint8_t *rgba = malloc((size_t)width * height * 4);
+    wlterm_frame_read_pixels(f, rgba);
+
+    FILE *out = fopen(path, "wb");
+    if (!out) {
+        free(rgba);
+        return false;
+    }
+    fprintf(out, "P6\n%d %d\n255\n", width, height);
+    for (size_t i = 0; i < (size_t)width * height; ++i)
+        fwrite(rgba + i * 4, 3, 1, out);
+    free(rgba);
+    return fclose(out) == 0;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: wlterm-render-bench [--frames N] [--size WxH] "
+            "[--snapshot file.ppm] [--open N] [--threads 1,2,4,...] [--split N] [--scroll] [--smooth PX] [--scale S] [--rescale] [--cells] [--software] [--flood BYTES] [--soak N]\n");
+}
+
+/* Aggregate frame rate of `n_frames` frames under continuous output, for
+   each render pool size in the comma separated `threads`. */
+static void bench_frames(struct wlterm_application *app, struct wlterm_frame *first,
+                         int n_frames, int rounds, const char *threads) {
+    struct wlterm_frame *frames[n_frames];
+    frames[0] = first;
+    for (int i = 1; i < n_frames; ++i) {
+        frames[i] = wlterm_frame_create(app);
+        wlterm_frame_resize(frames[i], first->width, first->height);
+        feed_log(frames[i]->root_window->vt, 100);
+        settle_glyphs(frames[i]);
+    }
+
+    for (const char *t = threads; t; t = strchr(t, ',') ? strchr(t, ',') + 1 : NULL) {
+        int n_threads = atoi(t);
+        wlterm_pool_destroy(app->render_pool);
+        app->render_pool = wlterm_pool_create(n_threads);
+
+        double start = now();
+        for (int r = 0; r < rounds; ++r) {
+            for (int i = 0; i < n_frames; ++i)
+                feed_log(frames[i]->root_window->vt, 3);
+            wlterm_application_render(app);
+        }
+        double elapsed = now() - start;
+
+        printf("frames: %d frames, %d threads: %.0f frames/s aggregate, %.1f per frame\n",
+               n_frames, app->render_pool->n_threads, rounds * n_frames / elapsed,
+               rounds / elapsed);
+    }
+
+    for (int i = 1; i < n_frames; ++i)
+        wlterm_frame_destroy(frames[i]);
+}
+
+/* Scroll back through the scrollback by `pixels` a frame, turning around at
+   either end, and report the frame times. */
+static void bench_smooth(struct wlterm_frame *f, int frames, double pixels) {
+    struct wlterm_window *w = f->root_window;
+    uint64_t glyphs = w->text.glyphs_drawn;
+    double worst = 0.0;
+
+    double start = now();
+    for (int i = 0; i < frames; ++i) {
+        double frame_start = now();
+        if (!wlterm_window_scroll_pixels(w, pixels)) {
+            pixels = -pixels;
+            wlterm_window_scroll_pixels(w, pixels);
+        }
+        wlterm_frame_render(f);
+        double t = now() - frame_start;
+        worst = t > worst ? t : worst;
+    }
+    double elapsed = now() - start;
+
+    printf("smooth: %d frames scrolling %g px each, %.0f frames/s, worst frame %.2f ms, "
+           "%.0f glyphs per frame\n", frames, fabs(pixels), frames / elapsed,
+           worst * 1e3, (double)(w->text.glyphs_drawn - glyphs) / frames);
+}
+
+/* Every frame at the other scale, like a frame dragged back and forth
+   between a 1x and a 1.5x output. */
+static void bench_rescale(struct wlterm_frame *f, int frames) {
+    struct wlterm_glyph_worker *gw = f->application->glyph_worker;
+    uint64_t generated = gw->generated;
+    double worst = 0.0;
+
+    double start = now();
+    for (int i = 0; i < frames; ++i) {
+        double frame_start = now();
+        wlterm_frame_set_scale(f, i % 2 ? 1.0 : 1.5);
+        wlterm_frame_render(f);
+        double t = now() - frame_start;
+        worst = t > worst ? t : worst;
+    }
+    double elapsed = now() - start;
+
+    printf("rescale: %d frames, %.0f frames/s, worst frame %.2f ms, %lu us switching, "
+           "%lu glyphs generated\n", frames, frames / elapsed, worst * 1e3,
+           f->scale_change_time, gw->generated - generated);
+}
+
+/* A character typed, then a line printed, every frame in each render mode.
+   The batches lay out the whole window every frame, the cell texture only
+   takes the rows that changed. */
+static void bench_cells(struct wlterm_frame *f, int frames) {
+    static const char *modes[] = {"batches", "cells"};
+    struct wlterm_application *app = f->application;
+    struct wlterm_window *w = f->root_window;
+    enum wlterm_render_mode saved = app->render_mode;
+
+    for (int mode = WLTERM_RENDER_BATCHES; mode <= WLTERM_RENDER_CELLS; ++mode) {
+        app->render_mode = mode;
+        settle_glyphs(f);
+
+        for (int lines = 0; lines < 2; ++lines) {
+            uint64_t uploaded = w->cells.uploaded;
+            double worst = 0.0;
+
+            double start = now();
+            for (int i = 0; i < frames; ++i) {
+                double frame_start = now();
+                if (lines)
+                    feed_log(w->vt, 1);
+                else
+                    wlterm_vt_feed(w->vt, "x", 1);
+                wlterm_window_damage_all(w);
+                wlterm_frame_render(f);
+                double t = now() - frame_start;
+                worst = t > worst ? t : worst;
+            }
+            double elapsed = now() - start;
+
+            printf("cells: %s, %s a frame: %.0f frames/s, worst frame %.2f ms, %.0f "
+                   "cells uploaded per frame\n", modes[mode], lines ? "a line" :
+                   "a character", frames / elapsed, worst * 1e3,
+                   (double)(w->cells.uploaded - uploaded) / frames);
+        }
+    }
+    app->render_mode = saved;
+}
+
+/* Output parsed as it comes in, the way the main loop does it. Hidden, the
+   frame is never drawn; visible, it's drawn whenever due, as if presented at
+   60 Hz, which a flood throttles down to snapshots. */
+static void bench_flood(struct wlterm_frame *f, long bytes) {
+    struct wlterm_application *app = f->application;
+    struct wlterm_window *w = f->root_window;
+    char cmd[128];
+    snprintf(cmd, sizeof(cmd), "yes | head -c %ld", bytes);
+    char *args[] = {"/bin/sh", "-c", cmd, NULL};
+
+    for (int visible = 0; visible < 2; ++visible) {
+        w->pty = wlterm_pty_create(args, w->grid->rows, w->grid->cols);
+        if (!w->pty)
+            return;
+        uint64_t parsed = w->vt->bytes_parsed, rendered = f->rendered_frames;
+        f->refresh = 16666667;
+        f->last_presented = now() * 1e9;
+
+        double start = now();
+        while (!wlterm_pty_done(w->pty)) {
+            struct pollfd pfd = {.fd = w->pty->event_fd, .events = POLLIN};
+            poll(&pfd, 1, visible ? 1 : -1);
+            wlterm_window_read_pty(w);
+            if (visible)
+                wlterm_application_render(app);
+        }
+        double elapsed = now() - start;
+
+        wlterm_pty_destroy(w->pty);
+        w->pty = NULL;
+        printf("flood: %s, %.0f MB/s, %lu frames drawn\n", visible ? "visible" : "hidden",
+               (w->vt->bytes_parsed - parsed) / elapsed / 1e6,
+               f->rendered_frames - rendered);
+    }
+}
+
+/* Resident set size in KiB. */
+static long rss_kib() {
+    long pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%*s %ld", &pages) != 1)
+            pages = 0;
+        fclose(statm);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/* A session's worth of short-lived frames. The first tenth fill the pools
+   and caches, after that memory must stay flat, within `SOAK_RSS_SLACK`
+   KiB, and opening a frame must take no longer on average in the last tenth
+   than in the second. */
+#define SOAK_RSS_SLACK 2048
+
+static bool bench_soak(struct wlterm_application *app, int width, int height, int n) {
+    struct wlterm_histogram opened = {0}, second = {0}, last = {0};
+    long baseline = 0;
+
+    double start = now();
+    for (int i = 0; i < n; ++i) {
+        double open_start = now();
+        struct wlterm_frame *f = wlterm_frame_create(app);
+        wlterm_frame_resize(f, width, height);
+        feed_log(f->root_window->vt, 100);
+        wlterm_frame_render(f);
+        uint64_t us = (now() - open_start) * 1e6;
+        wlterm_frame_destroy(f);
+
+        wlterm_histogram_add(&opened, us);
+        if (i >= n / 10 && i < 2 * n / 10)
+            wlterm_histogram_add(&second, us);
+        if (i >= n - n / 10)
+            wlterm_histogram_add(&last, us);
+        if (i == n / 10)
+            baseline = rss_kib();
+    }
+    double elapsed = now() - start;
+    long rss = rss_kib();
+
+    double second_mean = second.count ? (double)second.sum / second.count : 0.0;
+    double last_mean = last.count ? (double)last.sum / last.count : 0.0;
+    printf("soak: %d frames opened and closed in %.3f s, opening takes %.0f us on "
+           "average, %lu us at worst (%.0f us in the second tenth, %.0f us in the "
+           "last), RSS %ld KiB after the first tenth, %ld KiB at the end\n", n, elapsed,
+           (double)opened.sum / opened.count, opened.max, second_mean, last_mean,
+           baseline, rss);
+
+    bool ok = true;
+    if (rss - baseline > SOAK_RSS_SLACK) {
+        fprintf(stderr, "soak: RSS grew by %ld KiB\n", rss - baseline);
+        ok = false;
+    }
+    if (last_mean > 2 * second_mean) {
+        fprintf(stderr, "soak: opening frames got slower\n");
+        ok = false;
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    int frames = 500;
+    int width = 1280, height = 800;
+    const char *snapshot = NULL;
+    int open_frames = 0;
+    const char *threads = "1,2,4,8";
+    int windows = 1;
+    bool scroll = false;
+    double smooth = 0.0;
+    double scale = 1.0;
+    bool rescale = false;
+    bool cells = false;
+    bool software = false;
+    long flood = 0;
+    int soak = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2) {
+                usage();
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot = argv[++i];
+        } else if (strcmp(argv[i], "--open") == 0 && i + 1 < argc) {
+            open_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = argv[++i];
+        } else if (strcmp(argv[i], "--split") == 0 && i + 1 < argc) {
+            windows = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--scroll") == 0) {
+            scroll = true;
+        } else if (strcmp(argv[i], "--smooth") == 0 && i + 1 < argc) {
+            smooth = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            scale = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--rescale") == 0) {
+            rescale = true;
+        } else if (strcmp(argv[i], "--cells") == 0) {
+            cells = true;
+        } else if (strcmp(argv[i], "--software") == 0) {
+            software = true;
+        } else if (strcmp(argv[i], "--flood") == 0 && i + 1 < argc) {
+            flood = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--soak") == 0 && i + 1 < argc) {
+            soak = atoi(argv[++i]);
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    struct wlterm_application *app = wlterm_application_create_headless();
+    if (!app)
+        return 1;
+    if (software)
+        app->render_mode = WLTERM_RENDER_SOFTWARE;
+
+    struct wlterm_frame *f = wlterm_frame_create(app);
+    wlterm_frame_resize(f, width, height);
+    wlterm_frame_set_scale(f, scale);
+
+    /* Alternately side by side and stacked, each split halving the last
+       window. */
+    struct wlterm_window *last = f->root_window;
+    for (int i = 1; i < windows; ++i)
+        last = wlterm_window_split(last, i % 2 ? WLTERM_SPLIT_HORIZONTAL :
+                                   WLTERM_SPLIT_VERTICAL);
+    FOR_EACH_WINDOW (f, w)
+        feed_log(w->vt, 5000);
+
+    double start = now();
+    settle_glyphs(f);
+    printf("glyphs settled in %.3f s\n", now() - start);
+
+    /* Only count the timed frames. */
+    memset(&app->profile, 0, sizeof(app->profile));
+    app->profile.gpu_timer = f->gpu_timer.supported;
+
+    uint64_t glyphs = 0, draw_calls = 0, reused = 0, laid_out = 0;
+    FOR_EACH_WINDOW (f, w) {
+        glyphs -= w->text.glyphs_drawn;
+        draw_calls -= w->text.draw_calls;
+        reused -= w->runs.hits;
+        laid_out -= w->runs.misses;
+    }
+
+    /* With --scroll, a line of output per frame moves every row up. */
+    start = now();
+    for (int i = 0; i < frames; ++i) {
+        if (scroll)
+            feed_log(f->root_window->vt, 1);
+        wlterm_window_damage_all(f->root_window);
+        wlterm_frame_render(f);
+    }
+    double elapsed = now() - start;
+
+    FOR_EACH_WINDOW (f, w) {
+        glyphs += w->text.glyphs_drawn;
+        draw_calls += w->text.draw_calls;
+        reused += w->runs.hits;
+        laid_out += w->runs.misses;
+    }
+
+    printf("render: %d frames of %dx%d in %d windows in %.3f s, %.0f frames/s, "
+           "%.0f glyphs in %.1f draw calls per frame\n", frames, width, height, windows,
+           elapsed, frames / elapsed, (double)glyphs / frames, (double)draw_calls / frames);
+    struct wlterm_histogram *cpu = &app->profile.metrics[WLTERM_PROFILE_CPU_RENDER];
+    printf("cpu: %.0f us per frame up to the swap, on average\n",
+           cpu->count ? (double)cpu->sum / cpu->count : 0.0);
+    printf("rows: %lu laid out, %lu reused from the run cache\n", laid_out, reused);
+    wlterm_profile_dump_json(&app->profile, stdout);
+
+    if (smooth > 0.0)
+        bench_smooth(f, frames, smooth);
+    if (rescale)
+        bench_rescale(f, frames);
+    if (cells && !software)
+        bench_cells(f, frames);
+    if (open_frames > 0)
+        bench_frames(app, f, open_frames, frames, threads);
+    if (flood > 0)
+        bench_flood(f, flood);
+
+    int rc = 0;
+    if (soak >= 10 && !bench_soak(app, width, height, soak))
+        rc = 1;
+    if (snapshot && !write_ppm(f, snapshot)) {
+        perror(snapshot);
+        rc = 1;
+    }
+
+    wlterm_frame_destroy(f);
+    wlterm_application_destroy(app);
+    return rc;
+}
@@ -0,0 +1,12 @@
+#version 320 es
+
+precision mediump float;
+in vec2 tex_pos;
+
+uniform sampler2D rows;
+
+out vec4 color;
+
+void main() {
+    color = texture(rows, tex_pos);
+}
@@ -0,0 +1,12 @@
+#version 320 es
+
+layout (location = 0) in vec4 vertex;
+
+uniform mat4 projection;
+
+out vec2 tex_pos;
+
+void main() {
+    gl_Position = projection * vec4(vertex.xy, 0.0, 1.0);
+    tex_pos = vertex.zw;
+}
@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "runs.h"
+
+
+void wlterm_run_cache_init(struct wlterm_run_cache *c, size_t capacity) {
+    memset(c, 0, sizeof(struct wlterm_run_cache));
+
+    c->capacity = capacity;
+    c->n_buckets = 1;
+    while (c->n_buckets < capacity * 2)
+        c->n_buckets *= 2;
+    c->buckets = calloc(c->n_buckets, sizeof(struct wlterm_run *));
+}
+
+void wlterm_run_cache_clear(struct wlterm_run_cache *c) {
+    struct wlterm_run *next;
+    for (struct wlterm_run *r = c->lru_head; r; r = next) {
+        next = r->lru_next;
+        free(r);
+    }
+    memset(c->buckets, 0, c->n_buckets * sizeof(struct wlterm_run *));
+    c->lru_head = c->lru_tail = NULL;
+    c->n_runs = 0;
+    c->bytes = 0;
+}
+
+void wlterm_run_cache_release(struct wlterm_run_cache *c) {
+    if (!c->buckets)
+        return;
+    wlterm_run_cache_clear(c);
+    free(c->buckets);
+    memset(c, 0, sizeof(struct wlterm_run_cache));
+}
+
+static void lru_unlink(struct wlterm_run_cache *c, struct wlterm_run *r) {
+    if (r->lru_prev)
+        r->lru_prev->lru_next = r->lru_next;
+    else
+        c->lru_head = r->lru_next;
+    if (r->lru_next)
+        r->lru_next->lru_prev = r->lru_prev;
+    else
+        c->lru_tail = r->lru_prev;
+}
+
+static void lru_push(struct wlterm_run_cache *c, struct wlterm_run *r) {
+    r->lru_prev = NULL;
+    r->lru_next = c->lru_head;
+    if (c->lru_head)
+        c->lru_head->lru_prev = r;
+    else
+        c->lru_tail = r;
+    c->lru_head = r;
+}
+
+static size_t run_size(int n_glyphs, int n_bg) {
+    return sizeof(struct wlterm_run) + n_glyphs * sizeof(struct wlterm_shaped_glyph) +
+        n_bg * sizeof(struct wlterm_shaped_bg);
+}
+
+static void evict(struct wlterm_run_cache *c, struct wlterm_run *r) {
+    struct wlterm_run **bp = &c->buckets[r->key & (c->n_buckets - 1)];
+    while (*bp != r)
+        bp = &(*bp)->bucket_next;
+    *bp = r->bucket_next;
+
+    lru_unlink(c, r);
+    c->n_runs--;
+    c->bytes -= run_size(r->n_glyphs, r->n_bg);
+    c->evictions++;
+    free(r);
+}
+
+/* The row laid out under `key`, NULL if it isn't cached. */
+struct wlterm_run *wlterm_run_cache_get(struct wlterm_run_cache *c, uint64_t key) {
+    struct wlterm_run *r = c->buckets[key & (c->n_buckets - 1)];
+
+    while (r && r->key != key)
+        r = r->bucket_next;
+    if (!r) {
+        c->misses++;
+        return NULL;
+    }
+
+    c->hits++;
+    if (r != c->lru_head) {
+        lru_unlink(c, r);
+        lru_push(c, r);
+    }
+    return r;
+}
+
+/* Add a row with room for `n_glyphs` glyphs and `n_bg` background runs, for
+   the caller to fill in. The key must not be cached already. */
+struct wlterm_run *wlterm_run_cache_put(struct wlterm_run_cache *c, uint64_t key,
+                                        int n_glyphs, int n_bg) {
+    if (c->n_runs == c->capacity)
+        evict(c, c->lru_tail);
+
+    struct wlterm_run *r = malloc(run_size(n_glyphs, n_bg));
+    if (!r)
+        return NULL;
+
+    r->key = key;
+    r->n_glyphs = n_glyphs;
+    r->n_bg = n_bg;
+
+    struct wlterm_run **bucket = &c->buckets[key & (c->n_buckets - 1)];
+    r->bucket_next = *bucket;
+    *bucket = r;
+    lru_push(c, r);
+    c->n_runs++;
+    c->bytes += run_size(n_glyphs, n_bg);
+    return r;
+}
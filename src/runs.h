@@ -0,0 +1,71 @@
+#ifndef RUNS_H
+#define RUNS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Rows laid out per window. A screenful or two, plus some scrolling. */
+#define WLTERM_RUN_CACHE_SIZE 1024
+
+/* A glyph of a laid out row, positioned within the row. */
+struct wlterm_shaped_glyph {
+    float x;
+    uint32_t color;
+    int32_t codepoint;
+};
+
+/* A run of cells with the same non-default background. */
+struct wlterm_shaped_bg {
+    float x0;
+    float x1;
+    uint32_t color;
+};
+
+/* A laid out row: its glyphs, then its background runs. */
+struct wlterm_run {
+    uint64_t key;
+    struct wlterm_run *bucket_next;
+    struct wlterm_run *lru_prev;
+    struct wlterm_run *lru_next;
+
+    int n_glyphs;
+    int n_bg;
+    struct wlterm_shaped_glyph glyphs[];
+};
+
+/* Rows already laid out, keyed by a hash of the font, its size and the row's
+ * cells, so a row that is drawn again only has its glyphs copied to the new
+ * frame, wherever it has moved to on screen. The least recently used row
+ * goes once `capacity` are cached.
+ *
+ * Each window has its own cache, so windows can be laid out in parallel
+ * without any locking. */
+struct wlterm_run_cache {
+    struct wlterm_run **buckets;
+    size_t n_buckets;  /* A power of two. */
+    size_t n_runs;
+    size_t capacity;
+    size_t bytes;
+
+    /* Most recently used first. */
+    struct wlterm_run *lru_head;
+    struct wlterm_run *lru_tail;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+};
+
+void wlterm_run_cache_init(struct wlterm_run_cache *, size_t capacity);
+void wlterm_run_cache_release(struct wlterm_run_cache *);
+void wlterm_run_cache_clear(struct wlterm_run_cache *);
+struct wlterm_run *wlterm_run_cache_get(struct wlterm_run_cache *, uint64_t key);
+struct wlterm_run *wlterm_run_cache_put(struct wlterm_run_cache *, uint64_t key,
+                                        int n_glyphs, int n_bg);
+
+static inline struct wlterm_shaped_bg *wlterm_run_bg(struct wlterm_run *r) {
+    return (struct wlterm_shaped_bg *)(r->glyphs + r->n_glyphs);
+}
+
+#endif /* RUNS_H */
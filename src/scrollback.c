@@ -0,0 +1,479 @@
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "grid.h"
+#include "scrollback.h"
+
+
+#define HOT_LINES WLTERM_SCROLLBACK_HOT_LINES
+#define PAGE_LINES WLTERM_SCROLLBACK_PAGE_LINES
+
+/* Bytes per cell: codepoint, fg and bg, attrs. */
+#define CELL_SIZE (3 * sizeof(uint32_t) + sizeof(uint8_t))
+
+
+/* LZ77 with an LZ4-like block format: a token with the literal and match
+   lengths in its two nibbles, the literals, a 16 bit match offset, and length
+   extension bytes for either nibble that is 15. The last sequence has only
+   literals. Shrinks the streams of a page of log output some 4x more. */
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+
+static size_t lz_bound(size_t n) {
+    return n + n / 255 + 16;
+}
+
+static uint8_t *lz_put_length(uint8_t *op, size_t len) {
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+static uint8_t *lz_emit(uint8_t *op, const uint8_t *literals, size_t n_literals,
+                        size_t offset, size_t match) {
+    uint8_t *token = op++;
+
+    *token = (n_literals < 15 ? n_literals : 15) << 4;
+    if (n_literals >= 15)
+        op = lz_put_length(op, n_literals - 15);
+    memcpy(op, literals, n_literals);
+    op += n_literals;
+
+    if (!match)
+        return op;
+
+    *op++ = offset;
+    *op++ = offset >> 8;
+    match -= LZ_MIN_MATCH;
+    *token |= match < 15 ? match : 15;
+    if (match >= 15)
+        op = lz_put_length(op, match - 15);
+    return op;
+}
+
+static size_t lz_compress(const uint8_t *src, size_t n, uint8_t *dst) {
+    uint32_t table[1 << LZ_HASH_BITS] = {0};  /* Position + 1, 0 if empty. */
+    size_t ip = 0, anchor = 0;
+    uint8_t *op = dst;
+
+    size_t misses = 0;
+
+    while (ip + LZ_MIN_MATCH <= n) {
+        uint32_t seq, seq_ref = 0;
+        memcpy(&seq, &src[ip], sizeof(seq));
+        uint32_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+        size_t ref = table[h];
+        table[h] = ip + 1;
+
+        bool found = false;
+        if (ref--) {
+            memcpy(&seq_ref, &src[ref], sizeof(seq_ref));
+            found = ip - ref <= 0xffff && seq == seq_ref;
+        }
+        if (!found) {
+            /* Go faster through data that doesn't compress. */
+            ip += 1 + (misses++ >> 5);
+            continue;
+        }
+        misses = 0;
+
+        /* Extend the match 8 bytes at a time. */
+        size_t len = LZ_MIN_MATCH;
+        while (ip + len + 8 <= n) {
+            uint64_t a, b;
+            memcpy(&a, &src[ip + len], sizeof(a));
+            memcpy(&b, &src[ref + len], sizeof(b));
+            if (a != b) {
+                len += __builtin_ctzll(a ^ b) >> 3;
+                goto matched;
+            }
+            len += 8;
+        }
+        while (ip + len < n && src[ref + len] == src[ip + len])
+            len++;
+    matched:
+
+        op = lz_emit(op, &src[anchor], ip - anchor, ip - ref, len);
+        ip += len;
+        anchor = ip;
+    }
+    op = lz_emit(op, &src[anchor], n - anchor, 0, 0);
+    return op - dst;
+}
+
+static bool lz_get_length(const uint8_t **ip, const uint8_t *end, size_t *len) {
+    uint8_t b;
+    do {
+        if (*ip >= end)
+            return false;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return true;
+}
+
+static bool lz_decompress(const uint8_t *src, size_t n, uint8_t *dst, size_t dst_size) {
+    const uint8_t *ip = src, *end = src + n;
+    uint8_t *op = dst, *op_end = dst + dst_size;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+
+        size_t n_literals = token >> 4;
+        if (n_literals == 15 && !lz_get_length(&ip, end, &n_literals))
+            return false;
+        if (n_literals > (size_t)(end - ip) || n_literals > (size_t)(op_end - op))
+            return false;
+        memcpy(op, ip, n_literals);
+        op += n_literals;
+        ip += n_literals;
+
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return false;
+        size_t offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        size_t match = (token & 15) + LZ_MIN_MATCH;
+        if ((token & 15) == 15 && !lz_get_length(&ip, end, &match))
+            return false;
+        if (!offset || offset > (size_t)(op - dst) || match > (size_t)(op_end - op))
+            return false;
+
+        /* May overlap, e.g. a run of one repeated byte. */
+        const uint8_t *ref = op - offset;
+        if (offset >= match) {
+            memcpy(op, ref, match);
+        } else {
+            for (size_t i = 0; i < match; ++i)
+                op[i] = ref[i];
+        }
+        op += match;
+    }
+    return op == op_end;
+}
+
+
+static uint8_t *put_varint(uint8_t *p, uint32_t v) {
+    while (v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+static uint32_t get_varint(const uint8_t **p) {
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        uint8_t b = *(*p)++;
+        v |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            break;
+    }
+    return v;
+}
+
+static void put_u32(uint8_t **p, uint32_t v) {
+    memcpy(*p, &v, sizeof(v));
+    *p += sizeof(v);
+}
+
+static uint32_t get_u32(const uint8_t **p) {
+    uint32_t v;
+    memcpy(&v, *p, sizeof(v));
+    *p += sizeof(v);
+    return v;
+}
+
+static inline void fill32(uint32_t *p, uint32_t value, size_t n) {
+    wmemset((wchar_t *)p, (wchar_t)value, n);
+}
+
+static void *reserve(void *buf, size_t *capacity, size_t size) {
+    if (*capacity >= size)
+        return buf;
+    *capacity = size > *capacity * 2 ? size : *capacity * 2;
+    return realloc(buf, *capacity);
+}
+
+
+static void hot_line_view(const struct wlterm_scrollback_hot_line *l,
+                          struct wlterm_scrollback_line *out) {
+    out->cols = l->cols;
+    out->codepoints = l->cells;
+    out->fg = l->cells + l->capacity;
+    out->bg = l->cells + 2 * l->capacity;
+    out->attrs = (const uint8_t *)(l->cells + 3 * l->capacity);
+}
+
+/* Compress the oldest page worth of hot lines into a new cold page. */
+static void pack_page(struct wlterm_scrollback *sb) {
+    struct wlterm_scrollback_line lines[PAGE_LINES];
+    size_t cells = 0;
+
+    for (int i = 0; i < PAGE_LINES; ++i) {
+        hot_line_view(&sb->hot[(sb->hot_head + i) % HOT_LINES], &lines[i]);
+        cells += lines[i].cols;
+    }
+
+    /* Worst case: every varint at full length, every cell its own run. */
+    size_t bound = PAGE_LINES * 5 + cells * 5 + cells * (5 + 2 * sizeof(uint32_t) + 1);
+    sb->scratch = reserve(sb->scratch, &sb->scratch_capacity, bound);
+
+    uint8_t *p = sb->scratch;
+    for (int i = 0; i < PAGE_LINES; ++i)
+        p = put_varint(p, lines[i].cols);
+    for (int i = 0; i < PAGE_LINES; ++i) {
+        const uint32_t *codepoints = lines[i].codepoints;
+        for (int c = 0; c < lines[i].cols; ++c) {
+            if (codepoints[c] < 0x80)
+                *p++ = codepoints[c];
+            else
+                p = put_varint(p, codepoints[c]);
+        }
+    }
+
+    /* Colors and attributes change rarely along a line, and often not at
+       all between lines. */
+    uint32_t run = 0, fg = 0, bg = 0;
+    uint8_t attrs = 0;
+    for (int i = 0; i < PAGE_LINES; ++i) {
+        const struct wlterm_scrollback_line *l = &lines[i];
+        int c = 0;
+        while (c < l->cols) {
+            int start = c;
+            while (c < l->cols && l->fg[c] == fg && l->bg[c] == bg && l->attrs[c] == attrs)
+                c++;
+            run += c - start;
+            if (c == l->cols)
+                break;
+
+            if (run) {
+                p = put_varint(p, run);
+                put_u32(&p, fg);
+                put_u32(&p, bg);
+                *p++ = attrs;
+            }
+            run = 0;
+            fg = l->fg[c];
+            bg = l->bg[c];
+            attrs = l->attrs[c];
+        }
+    }
+    if (run) {
+        p = put_varint(p, run);
+        put_u32(&p, fg);
+        put_u32(&p, bg);
+        *p++ = attrs;
+    }
+
+    size_t raw_size = p - sb->scratch;
+    sb->packed = reserve(sb->packed, &sb->packed_capacity, lz_bound(raw_size));
+    size_t size = lz_compress(sb->scratch, raw_size, sb->packed);
+
+    if (sb->first_page + sb->n_pages == sb->pages_capacity) {
+        if (sb->first_page) {
+            memmove(sb->pages, &sb->pages[sb->first_page],
+                    sb->n_pages * sizeof(struct wlterm_scrollback_page));
+            sb->first_page = 0;
+        } else {
+            sb->pages_capacity = sb->pages_capacity ? sb->pages_capacity * 2 : 64;
+            sb->pages = realloc(sb->pages,
+                                sb->pages_capacity * sizeof(struct wlterm_scrollback_page));
+        }
+    }
+
+    struct wlterm_scrollback_page *page = &sb->pages[sb->first_page + sb->n_pages++];
+    page->data = malloc(size);
+    memcpy(page->data, sb->packed, size);
+    page->size = size;
+    page->raw_size = raw_size;
+    page->cells = cells;
+    sb->cold_bytes += size;
+    sb->cold_cells += cells;
+
+    sb->hot_head = (sb->hot_head + PAGE_LINES) % HOT_LINES;
+    sb->hot_count -= PAGE_LINES;
+
+    /* Drop whole pages past the limit. */
+    while (sb->n_pages && sb->n_lines - PAGE_LINES >= sb->max_lines) {
+        struct wlterm_scrollback_page *oldest = &sb->pages[sb->first_page];
+        sb->cold_bytes -= oldest->size;
+        sb->cold_cells -= oldest->cells;
+        free(oldest->data);
+        sb->first_page++;
+        sb->n_pages--;
+        sb->first_seq++;
+        sb->n_lines -= PAGE_LINES;
+    }
+}
+
+static bool unpack_page(struct wlterm_scrollback *sb, const struct wlterm_scrollback_page *page) {
+    sb->scratch = reserve(sb->scratch, &sb->scratch_capacity, page->raw_size);
+    if (!lz_decompress(page->data, page->size, sb->scratch, page->raw_size))
+        return false;
+
+    const uint8_t *p = sb->scratch;
+    sb->line_start[0] = 0;
+    for (int i = 0; i < PAGE_LINES; ++i)
+        sb->line_start[i + 1] = sb->line_start[i] + get_varint(&p);
+
+    size_t cells = sb->line_start[PAGE_LINES];
+    if (cells > sb->cells_capacity) {
+        sb->cells_capacity = cells;
+        sb->codepoints = realloc(sb->codepoints, cells * sizeof(uint32_t));
+        sb->fg = realloc(sb->fg, cells * sizeof(uint32_t));
+        sb->bg = realloc(sb->bg, cells * sizeof(uint32_t));
+        sb->attrs = realloc(sb->attrs, cells * sizeof(uint8_t));
+    }
+
+    /* Mostly ASCII, one byte each. */
+    for (size_t i = 0; i < cells; ++i)
+        sb->codepoints[i] = *p < 0x80 ? *p++ : get_varint(&p);
+
+    for (size_t i = 0; i < cells;) {
+        uint32_t run = get_varint(&p);
+        uint32_t fg = get_u32(&p);
+        uint32_t bg = get_u32(&p);
+        uint8_t attrs = *p++;
+        if (run > cells - i)
+            return false;
+        fill32(&sb->fg[i], fg, run);
+        fill32(&sb->bg[i], bg, run);
+        memset(&sb->attrs[i], attrs, run);
+        i += run;
+    }
+
+    sb->decompressed++;
+    return true;
+}
+
+
+struct wlterm_scrollback *wlterm_scrollback_create(size_t max_lines) {
+    struct wlterm_scrollback *sb = calloc(1, sizeof(struct wlterm_scrollback));
+    if (!sb) return NULL;
+
+    sb->max_lines = max_lines;
+    sb->cached_seq = UINT64_MAX;
+    return sb;
+}
+
+void wlterm_scrollback_destroy(struct wlterm_scrollback *sb) {
+    for (int i = 0; i < HOT_LINES; ++i)
+        free(sb->hot[i].cells);
+    for (size_t i = 0; i < sb->n_pages; ++i)
+        free(sb->pages[sb->first_page + i].data);
+    free(sb->pages);
+    free(sb->codepoints);
+    free(sb->fg);
+    free(sb->bg);
+    free(sb->attrs);
+    free(sb->scratch);
+    free(sb->packed);
+    free(sb);
+}
+
+static bool is_blank(const uint32_t *codepoints, const uint32_t *bg,
+                     const uint8_t *attrs, int i) {
+    return (codepoints[i] == ' ') & (bg[i] == WLTERM_DEFAULT_BG) & !attrs[i];
+}
+
+/* Most lines are much shorter than the screen is wide, the blanks at the end
+   are skipped a block at a time. */
+static int trimmed_length(const uint32_t *codepoints, const uint32_t *bg,
+                          const uint8_t *attrs, int cols) {
+    while (cols >= 16) {
+        bool blank = true;
+        for (int i = cols - 16; i < cols; ++i)
+            blank &= is_blank(codepoints, bg, attrs, i);
+        if (!blank)
+            break;
+        cols -= 16;
+    }
+    while (cols > 0 && is_blank(codepoints, bg, attrs, cols - 1))
+        cols--;
+    return cols;
+}
+
+void wlterm_scrollback_push(struct wlterm_scrollback *sb, const uint32_t *codepoints,
+                            const uint32_t *fg, const uint32_t *bg,
+                            const uint8_t *attrs, int cols) {
+
+    cols = trimmed_length(codepoints, bg, attrs, cols);
+
+    if (sb->hot_count == HOT_LINES)
+        pack_page(sb);
+
+    struct wlterm_scrollback_hot_line *l =
+        &sb->hot[(sb->hot_head + sb->hot_count) % HOT_LINES];
+    if (l->capacity < cols) {
+        free(l->cells);
+        l->cells = malloc(cols * CELL_SIZE);
+        l->capacity = cols;
+    }
+    l->cols = cols;
+    if (cols) {
+        memcpy(l->cells, codepoints, cols * sizeof(uint32_t));
+        memcpy(l->cells + l->capacity, fg, cols * sizeof(uint32_t));
+        memcpy(l->cells + 2 * l->capacity, bg, cols * sizeof(uint32_t));
+        memcpy(l->cells + 3 * l->capacity, attrs, cols * sizeof(uint8_t));
+    }
+
+    sb->hot_count++;
+    sb->n_lines++;
+}
+
+/* Line `n` counting back from the most recent one. */
+bool wlterm_scrollback_line(struct wlterm_scrollback *sb, size_t n,
+                            struct wlterm_scrollback_line *out) {
+    if (n >= sb->n_lines)
+        return false;
+
+    if (n < (size_t)sb->hot_count) {
+        hot_line_view(&sb->hot[(sb->hot_head + sb->hot_count - 1 - n) % HOT_LINES], out);
+        return true;
+    }
+
+    n -= sb->hot_count;
+    size_t page = sb->n_pages - 1 - n / PAGE_LINES;
+    int line = PAGE_LINES - 1 - n % PAGE_LINES;
+    uint64_t seq = sb->first_seq + page;
+
+    if (sb->cached_seq != seq) {
+        sb->cached_seq = UINT64_MAX;
+        if (!unpack_page(sb, &sb->pages[sb->first_page + page]))
+            return false;
+        sb->cached_seq = seq;
+    }
+
+    uint32_t start = sb->line_start[line];
+    out->cols = sb->line_start[line + 1] - start;
+    out->codepoints = &sb->codepoints[start];
+    out->fg = &sb->fg[start];
+    out->bg = &sb->bg[start];
+    out->attrs = &sb->attrs[start];
+    return true;
+}
+
+void wlterm_scrollback_stats(struct wlterm_scrollback *sb,
+                             struct wlterm_scrollback_stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    stats->lines = sb->n_lines;
+    stats->hot_lines = sb->hot_count;
+    stats->pages = sb->n_pages;
+    stats->cold_bytes = sb->cold_bytes +
+        sb->pages_capacity * sizeof(struct wlterm_scrollback_page);
+    stats->hot_bytes = sizeof(struct wlterm_scrollback);
+    for (int i = 0; i < HOT_LINES; ++i)
+        stats->hot_bytes += sb->hot[i].capacity * CELL_SIZE;
+    for (int i = 0; i < sb->hot_count; ++i)
+        stats->cells += sb->hot[(sb->hot_head + i) % HOT_LINES].cols;
+    stats->cells += sb->cold_cells;
+    stats->decompressed = sb->decompressed;
+}
@@ -0,0 +1,102 @@
+#ifndef SCROLLBACK_H
+#define SCROLLBACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Lines that have most recently scrolled off the top are kept as raw cells. */
+#define WLTERM_SCROLLBACK_HOT_LINES 1024
+
+/* Older lines are packed into compressed pages of this many lines each. */
+#define WLTERM_SCROLLBACK_PAGE_LINES 256
+
+/* One line of scrollback. Lines have trailing blanks trimmed, cells past
+   `cols` are blank in the default colors. The pointers stay valid until the
+   next call into the scrollback. */
+struct wlterm_scrollback_line {
+    int cols;
+    const uint32_t *codepoints;
+    const uint32_t *fg;
+    const uint32_t *bg;
+    const uint8_t *attrs;
+};
+
+struct wlterm_scrollback_hot_line {
+    int cols;
+    int capacity;
+    uint32_t *cells;  /* codepoints, fg and bg, then the attrs bytes. */
+};
+
+/* A compressed page: the lines' widths, their codepoints and run-length
+   encoded colors and attributes, each as its own stream, then the whole of it
+   LZ77-compressed. */
+struct wlterm_scrollback_page {
+    uint8_t *data;
+    uint32_t size;
+    uint32_t raw_size;
+    uint32_t cells;
+};
+
+struct wlterm_scrollback_stats {
+    uint64_t lines;
+    uint64_t hot_lines;
+    uint64_t pages;
+    uint64_t cells;         /* Cells stored, after trimming. */
+    uint64_t hot_bytes;
+    uint64_t cold_bytes;
+    uint64_t decompressed;  /* Pages decompressed so far. */
+};
+
+/* Lines scrolled off the top of a grid.
+ *
+ * Recent lines live in a ring of raw lines. When it fills up, its oldest
+ * page worth of lines is compressed into a cold page; cold pages are only
+ * decompressed again, one at a time, when a line in them is looked at. Once
+ * there are more than `max_lines`, the oldest pages are dropped. */
+struct wlterm_scrollback {
+    size_t max_lines;
+    size_t n_lines;
+
+    struct wlterm_scrollback_hot_line hot[WLTERM_SCROLLBACK_HOT_LINES];
+    int hot_head;  /* Oldest hot line. */
+    int hot_count;
+
+    /* Oldest first, pages[first_page] has sequence number first_seq. */
+    struct wlterm_scrollback_page *pages;
+    size_t first_page;
+    size_t n_pages;
+    size_t pages_capacity;
+    uint64_t first_seq;
+
+    /* The last page decompressed, line i spans cells
+       line_start[i]..line_start[i + 1]. */
+    uint64_t cached_seq;
+    uint32_t *codepoints;
+    uint32_t *fg;
+    uint32_t *bg;
+    uint8_t *attrs;
+    size_t cells_capacity;
+    uint32_t line_start[WLTERM_SCROLLBACK_PAGE_LINES + 1];
+
+    /* Reused between compressions. */
+    uint8_t *scratch;
+    size_t scratch_capacity;
+    uint8_t *packed;
+    size_t packed_capacity;
+
+    uint64_t cold_bytes;
+    uint64_t cold_cells;
+    uint64_t decompressed;
+};
+
+struct wlterm_scrollback *wlterm_scrollback_create(size_t max_lines);
+void wlterm_scrollback_destroy(struct wlterm_scrollback *);
+void wlterm_scrollback_push(struct wlterm_scrollback *, const uint32_t *codepoints,
+                            const uint32_t *fg, const uint32_t *bg,
+                            const uint8_t *attrs, int cols);
+bool wlterm_scrollback_line(struct wlterm_scrollback *, size_t n,
+                            struct wlterm_scrollback_line *);
+void wlterm_scrollback_stats(struct wlterm_scrollback *, struct wlterm_scrollback_stats *);
+
+#endif /* SCROLLBACK_H */
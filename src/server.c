@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "wlterm.h"
+
+
+struct wlterm_server *wlterm_server_create(struct wlterm_application *app,
+                                           const char *path) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "wlterm: socket path too long: %s\n", path);
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("wlterm: socket");
+        return NULL;
+    }
+
+    /* A socket left behind by a server that is gone can be replaced. */
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "wlterm: a server is already running on %s\n", path);
+        close(fd);
+        return NULL;
+    }
+    unlink(path);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        perror("wlterm: bind");
+        close(fd);
+        return NULL;
+    }
+
+    struct wlterm_server *s = malloc(sizeof(struct wlterm_server));
+    s->application = app;
+    s->fd = fd;
+    s->path = strdup(path);
+    s->clients = NULL;
+    s->n_clients = 0;
+    s->clients_capacity = 0;
+    return s;
+}
+
+void wlterm_server_destroy(struct wlterm_server *s) {
+    for (int i = 0; i < s->n_clients; ++i)
+        close(s->clients[i].fd);
+    free(s->clients);
+    close(s->fd);
+    unlink(s->path);
+    free(s->path);
+    free(s);
+}
+
+static void handle_request(struct wlterm_server *s, int client, char *buf) {
+    buf[strcspn(buf, "\r\n")] = '\0';
+
+    bool once = strcmp(buf, "frame-once") == 0;
+    if (!once && strcmp(buf, "frame") != 0) {
+        dprintf(client, "error: unknown request\n");
+        close(client);
+        return;
+    }
+
+    struct wlterm_frame *f = wlterm_frame_create(s->application);
+    if (!f) {
+        dprintf(client, "error: could not create frame\n");
+        close(client);
+        return;
+    }
+    f->close_after_first_frame = once;
+
+    /* Answered when the first frame has been drawn. */
+    if (f->rendered_frames) {
+        dprintf(client, "ok\n");
+        close(client);
+    } else {
+        f->notify_fd = client;
+    }
+}
+
+/* Read what has come in from a client. True once it is done with, its
+   request handled or its connection closed. */
+static bool read_request(struct wlterm_server *s, struct wlterm_server_client *c) {
+    ssize_t n = read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return false;
+    if (n <= 0) {
+        close(c->fd);
+        return true;
+    }
+    c->len += n;
+    c->buf[c->len] = '\0';
+
+    /* Requests are a line. Anything longer than the buffer isn't one. */
+    if (!memchr(c->buf, '\n', c->len) && c->len < sizeof(c->buf) - 1)
+        return false;
+    handle_request(s, c->fd, c->buf);
+    return true;
+}
+
+/* Accept every pending connection. Clients send their request right after
+   connecting, but it is only read once it arrives. */
+void wlterm_server_accept(struct wlterm_server *s) {
+    int client;
+    while ((client = accept4(s->fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0) {
+        if (s->n_clients == s->clients_capacity) {
+            s->clients_capacity = s->clients_capacity ? s->clients_capacity * 2 : 4;
+            s->clients = realloc(s->clients,
+                                 s->clients_capacity * sizeof(struct wlterm_server_client));
+        }
+        s->clients[s->n_clients++] = (struct wlterm_server_client){.fd = client};
+    }
+}
+
+/* Handle the clients that became readable, `clients` holding their poll
+   results in order. */
+void wlterm_server_dispatch(struct wlterm_server *s, const struct pollfd *clients) {
+    int n = 0;
+
+    for (int i = 0; i < s->n_clients; ++i) {
+        if (clients[i].revents && read_request(s, &s->clients[i]))
+            continue;
+        s->clients[n++] = s->clients[i];
+    }
+    s->n_clients = n;
+}
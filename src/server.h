@@ -0,0 +1,55 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/un.h>
+
+struct wlterm_application;
+
+/* A connection and the part of its request read so far. */
+struct wlterm_server_client {
+    int fd;
+    size_t len;
+    char buf[64];
+};
+
+/* Listens on a Unix socket for requests to open new frames, so that new
+ * terminals reuse the EGL display, font atlas and shaders of a running
+ * process instead of initializing their own.
+ *
+ * Requests are single lines: "frame" opens a frame, "frame-once" opens one
+ * and closes it again after its first frame, for benchmarking. The server
+ * answers "ok" once the new frame has been drawn. */
+struct wlterm_server {
+    struct wlterm_application *application;
+    int fd;
+    char *path;
+
+    /* Accepted connections whose request hasn't come in whole yet. They are
+       polled by the main loop along with the listening socket. */
+    struct wlterm_server_client *clients;
+    int n_clients;
+    int clients_capacity;
+};
+
+struct wlterm_server *wlterm_server_create(struct wlterm_application *, const char *path);
+void wlterm_server_destroy(struct wlterm_server *);
+void wlterm_server_accept(struct wlterm_server *);
+void wlterm_server_dispatch(struct wlterm_server *, const struct pollfd *clients);
+
+/* $XDG_RUNTIME_DIR/wlterm-$WAYLAND_DISPLAY.sock, malloc'd. Shared with the
+   client, which links nothing else. */
+static inline char *wlterm_server_socket_path() {
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    const char *display = getenv("WAYLAND_DISPLAY");
+    size_t len = sizeof(((struct sockaddr_un *)0)->sun_path);
+    char *path = malloc(len);
+
+    snprintf(path, len, "%s/wlterm-%s.sock", dir ? dir : "/tmp",
+             display ? display : "wayland-0");
+    return path;
+}
+
+#endif /* SERVER_H */
@@ -0,0 +1,246 @@
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "software.h"
+
+
+bool wlterm_coverage_cache_init(struct wlterm_coverage_cache *c, const char *font_path) {
+    memset(c, 0, sizeof(struct wlterm_coverage_cache));
+    if (FT_Init_FreeType(&c->library))
+        return false;
+    if (FT_New_Face(c->library, font_path, 0, &c->face)) {
+        FT_Done_FreeType(c->library);
+        return false;
+    }
+    return true;
+}
+
+void wlterm_coverage_cache_release(struct wlterm_coverage_cache *c) {
+    FT_Done_Face(c->face);
+    FT_Done_FreeType(c->library);
+    free(c->table);
+    free(c->pixels);
+    memset(c, 0, sizeof(struct wlterm_coverage_cache));
+}
+
+static struct wlterm_coverage *find(struct wlterm_coverage_cache *c, int32_t codepoint) {
+    uint32_t mask = c->table_size - 1;
+    uint32_t i = (uint32_t)codepoint * 0x9e3779b1u & mask;
+
+    while (c->table[i].codepoint != -1 && c->table[i].codepoint != codepoint)
+        i = (i + 1) & mask;
+    return &c->table[i];
+}
+
+static void grow_table(struct wlterm_coverage_cache *c, int size) {
+    struct wlterm_coverage *old = c->table;
+    int old_size = c->table_size;
+
+    c->table = malloc(size * sizeof(struct wlterm_coverage));
+    c->table_size = size;
+    for (int i = 0; i < size; ++i)
+        c->table[i].codepoint = -1;
+    for (int i = 0; i < old_size; ++i)
+        if (old[i].codepoint != -1)
+            *find(c, old[i].codepoint) = old[i];
+    free(old);
+}
+
+/* Rasterize into `slot`. Glyphs the font can't render are kept empty, so
+   they aren't tried again. */
+static void rasterize(struct wlterm_coverage_cache *c, struct wlterm_coverage *slot,
+                      int32_t codepoint) {
+    *slot = (struct wlterm_coverage){.codepoint = codepoint};
+    c->n_glyphs++;
+    c->rasterized++;
+
+    FT_UInt index = FT_Get_Char_Index(c->face, codepoint);
+    if (FT_Load_Glyph(c->face, index, FT_LOAD_RENDER | FT_LOAD_TARGET_LIGHT))
+        return;
+    FT_GlyphSlot g = c->face->glyph;
+    if (g->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY)
+        return;
+
+    size_t n = (size_t)g->bitmap.width * g->bitmap.rows;
+    if (c->n_pixels + n > c->pixels_capacity) {
+        c->pixels_capacity = c->pixels_capacity ? c->pixels_capacity * 2 : 64 * 1024;
+        if (c->pixels_capacity < c->n_pixels + n)
+            c->pixels_capacity = c->n_pixels + n;
+        c->pixels = realloc(c->pixels, c->pixels_capacity);
+    }
+    for (unsigned row = 0; row < g->bitmap.rows; ++row)
+        memcpy(c->pixels + c->n_pixels + row * g->bitmap.width,
+               g->bitmap.buffer + (ptrdiff_t)row * g->bitmap.pitch, g->bitmap.width);
+
+    slot->left = g->bitmap_left;
+    slot->top = g->bitmap_top;
+    slot->width = g->bitmap.width;
+    slot->height = g->bitmap.rows;
+    slot->offset = c->n_pixels;
+    c->n_pixels += n;
+}
+
+void wlterm_coverage_cache_set_size(struct wlterm_coverage_cache *c, float size, float dpi) {
+    if (c->size == size && c->dpi == dpi)
+        return;
+
+    c->size = size;
+    c->dpi = dpi;
+    FT_Set_Char_Size(c->face, 0, lroundf(size * 64.0), lroundf(dpi), lroundf(dpi));
+
+    free(c->table);
+    c->table = NULL;
+    c->table_size = 0;
+    grow_table(c, 256);
+    c->n_glyphs = 0;
+    c->n_pixels = 0;
+    for (int32_t codepoint = ' '; codepoint <= '~'; ++codepoint)
+        rasterize(c, find(c, codepoint), codepoint);
+}
+
+/* Valid until the next call. */
+const struct wlterm_coverage *wlterm_coverage_get(struct wlterm_coverage_cache *c,
+                                                  int32_t codepoint) {
+    struct wlterm_coverage *slot = find(c, codepoint);
+    if (slot->codepoint == codepoint)
+        return slot;
+
+    if (2 * (c->n_glyphs + 1) > c->table_size) {
+        grow_table(c, c->table_size * 2);
+        slot = find(c, codepoint);
+    }
+    rasterize(c, slot, codepoint);
+    return slot;
+}
+
+static inline uint32_t xrgb(uint32_t color) {
+    return color >> 8 | 0xff000000;
+}
+
+void wlterm_canvas_fill(struct wlterm_canvas *canvas, int x0, int y0, int x1, int y1,
+                        uint32_t color) {
+    x0 = x0 > canvas->clip_x0 ? x0 : canvas->clip_x0;
+    y0 = y0 > canvas->clip_y0 ? y0 : canvas->clip_y0;
+    x1 = x1 < canvas->clip_x1 ? x1 : canvas->clip_x1;
+    y1 = y1 < canvas->clip_y1 ? y1 : canvas->clip_y1;
+
+    uint32_t pixel = xrgb(color);
+    for (int y = y0; y < y1; ++y) {
+        uint32_t *p = canvas->pixels + (size_t)y * canvas->width;
+        for (int x = x0; x < x1; ++x)
+            p[x] = pixel;
+    }
+}
+
+/* Exact for anything up to 255 * 255. */
+static inline uint32_t div255(uint32_t x) {
+    return (x + 1 + (x >> 8)) >> 8;
+}
+
+/* dst = dst * (1 - a) + color * a, channel by channel, a pixel's coverage
+   being its a. */
+static void blend_span(uint32_t *dst, const uint8_t *coverage, int n, uint32_t color) {
+    int i = 0;
+
+#ifdef __SSE2__
+    /* Four pixels per round, as 16-bit channels: every product fits. */
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i max = _mm_set1_epi16(255);
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i fg = _mm_unpacklo_epi8(_mm_set1_epi32(color), zero);
+    for (; i + 4 <= n; i += 4) {
+        uint32_t a4;
+        memcpy(&a4, coverage + i, 4);
+        if (!a4)
+            continue;
+
+        /* Each pixel's coverage in all four of its channels. */
+        __m128i a = _mm_cvtsi32_si128(a4);
+        a = _mm_unpacklo_epi8(a, a);
+        a = _mm_unpacklo_epi16(a, a);
+        __m128i a_lo = _mm_unpacklo_epi8(a, zero), a_hi = _mm_unpackhi_epi8(a, zero);
+
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i d_lo = _mm_unpacklo_epi8(d, zero), d_hi = _mm_unpackhi_epi8(d, zero);
+
+        __m128i lo = _mm_add_epi16(_mm_mullo_epi16(d_lo, _mm_sub_epi16(max, a_lo)),
+                                   _mm_mullo_epi16(fg, a_lo));
+        __m128i hi = _mm_add_epi16(_mm_mullo_epi16(d_hi, _mm_sub_epi16(max, a_hi)),
+                                   _mm_mullo_epi16(fg, a_hi));
+        lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lo, one), _mm_srli_epi16(lo, 8)), 8);
+        hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(hi, one), _mm_srli_epi16(hi, 8)), 8);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+
+    for (; i < n; ++i) {
+        uint32_t a = coverage[i];
+        if (!a)
+            continue;
+        uint32_t d = dst[i], out = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            uint32_t channel = (d >> shift & 0xff) * (255 - a) + (color >> shift & 0xff) * a;
+            out |= div255(channel) << shift;
+        }
+        dst[i] = out;
+    }
+}
+
+/* Draw a glyph with its pen position at x and its baseline at y. */
+void wlterm_canvas_glyph(struct wlterm_canvas *canvas, const struct wlterm_coverage_cache *c,
+                         const struct wlterm_coverage *g, int x, int y, uint32_t color) {
+    int x0 = x + g->left, y0 = y - g->top;
+    int x1 = x0 + g->width, y1 = y0 + g->height;
+    int skip_x = x0 < canvas->clip_x0 ? canvas->clip_x0 - x0 : 0;
+    int skip_y = y0 < canvas->clip_y0 ? canvas->clip_y0 - y0 : 0;
+    x1 = x1 < canvas->clip_x1 ? x1 : canvas->clip_x1;
+    y1 = y1 < canvas->clip_y1 ? y1 : canvas->clip_y1;
+
+    int n = x1 - x0 - skip_x;
+    if (n <= 0)
+        return;
+
+    uint32_t pixel = xrgb(color);
+    for (int row = skip_y; y0 + row < y1; ++row) {
+        const uint8_t *coverage = c->pixels + g->offset + (size_t)row * g->width + skip_x;
+        uint32_t *dst = canvas->pixels + (size_t)(y0 + row) * canvas->width + x0 + skip_x;
+        blend_span(dst, coverage, n, pixel);
+    }
+}
+
+/* Copy a rectangle from a canvas of the same size. */
+void wlterm_canvas_copy(struct wlterm_canvas *canvas, const struct wlterm_canvas *from,
+                        int x0, int y0, int x1, int y1) {
+    x0 = x0 > 0 ? x0 : 0;
+    y0 = y0 > 0 ? y0 : 0;
+    x1 = x1 < canvas->width ? x1 : canvas->width;
+    y1 = y1 < canvas->height ? y1 : canvas->height;
+    if (x1 <= x0)
+        return;
+
+    for (int y = y0; y < y1; ++y) {
+        size_t o = (size_t)y * canvas->width + x0;
+        memcpy(canvas->pixels + o, from->pixels + o, (x1 - x0) * sizeof(uint32_t));
+    }
+}
+
+/* An anonymous file of `size` bytes to share pixels with the compositor
+   through, -1 on failure. */
+int wlterm_shm_file(size_t size) {
+    int fd = memfd_create("wlterm", MFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
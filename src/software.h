@@ -0,0 +1,68 @@
+#ifndef SOFTWARE_H
+#define SOFTWARE_H
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A glyph's coverage, a byte per pixel, `width` bytes per row. */
+struct wlterm_coverage {
+    int32_t codepoint;  /* -1 for an empty table entry. */
+    int16_t left;       /* From the pen position to the first column. */
+    int16_t top;        /* From the baseline up to the first row. */
+    uint16_t width;
+    uint16_t height;
+    uint32_t offset;    /* Into the cache's pixels. */
+};
+
+/* Glyphs rasterized by FreeType at one size, for drawing without GL.
+ *
+ * Sizes are in points at `dpi` dots per inch, like msdfgl's, so glyphs come
+ * out the size the GL renderer draws them. ASCII is rasterized as soon as a
+ * size is set, anything else the first time it's drawn; a new size starts
+ * over. */
+struct wlterm_coverage_cache {
+    FT_Library library;
+    FT_Face face;
+    float size;
+    float dpi;
+
+    struct wlterm_coverage *table;  /* Open addressing. */
+    int table_size;
+    int n_glyphs;
+
+    uint8_t *pixels;
+    size_t n_pixels;
+    size_t pixels_capacity;
+
+    uint64_t rasterized;
+};
+
+/* XRGB8888 pixels, wl_shm's format, top row first. Drawing is clipped to
+   the clip rectangle, x0 and y0 included, x1 and y1 not. */
+struct wlterm_canvas {
+    uint32_t *pixels;
+    int width;
+    int height;
+    int clip_x0, clip_y0, clip_x1, clip_y1;
+};
+
+bool wlterm_coverage_cache_init(struct wlterm_coverage_cache *, const char *font_path);
+void wlterm_coverage_cache_release(struct wlterm_coverage_cache *);
+void wlterm_coverage_cache_set_size(struct wlterm_coverage_cache *, float size, float dpi);
+const struct wlterm_coverage *wlterm_coverage_get(struct wlterm_coverage_cache *,
+                                                  int32_t codepoint);
+
+/* Colors are 0xRRGGBBAA, like the grid's. */
+void wlterm_canvas_fill(struct wlterm_canvas *, int x0, int y0, int x1, int y1,
+                        uint32_t color);
+void wlterm_canvas_glyph(struct wlterm_canvas *, const struct wlterm_coverage_cache *,
+                         const struct wlterm_coverage *, int x, int y, uint32_t color);
+void wlterm_canvas_copy(struct wlterm_canvas *, const struct wlterm_canvas *from, int x0,
+                        int y0, int x1, int y1);
+
+int wlterm_shm_file(size_t size);
+
+#endif /* SOFTWARE_H */
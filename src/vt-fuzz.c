@@ -0,0 +1,85 @@
+/* Fuzz target for the VT parser.
+ *
+ * Built with libFuzzer when the compiler supports it, otherwise as a plain
+ * program that feeds the files given on the command line (or stdin). */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scrollback.h"
+#include "vt.h"
+
+
+static void check_grid(const struct wlterm_grid *g) {
+    if (g->cursor_row < 0 || g->cursor_row >= g->rows ||
+        g->cursor_col < 0 || g->cursor_col > g->cols ||
+        g->scroll_top < 0 || g->scroll_bottom >= g->rows ||
+        g->scroll_top > g->scroll_bottom || g->head < 0 || g->head >= g->rows)
+        abort();
+}
+
+static void discard_reply(void *data, const char *buf, size_t len) {}
+
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size) {
+    struct wlterm_grid *g = wlterm_grid_create(24, 80);
+    struct wlterm_vt *vt = wlterm_vt_create(g);
+    vt->reply = discard_reply;
+    struct wlterm_scrollback *sb = wlterm_scrollback_create(2000);
+    g->scrollback = sb;
+
+    /* Feed in two pieces to exercise sequences split across buffers. */
+    size_t split = size ? data[0] % (size + 1) : 0;
+    wlterm_vt_feed(vt, (const char *)data, split);
+    check_grid(g);
+    wlterm_vt_feed(vt, (const char *)data + split, size - split);
+    check_grid(g);
+
+    wlterm_grid_resize(g, 10, 33);
+    wlterm_vt_feed(vt, (const char *)data, size);
+    check_grid(g);
+
+    /* Lines were pushed at both widths, and some are in compressed pages. */
+    for (size_t n = 0; n < sb->n_lines; ++n) {
+        struct wlterm_scrollback_line l;
+        if (!wlterm_scrollback_line(sb, n, &l) || l.cols < 0 || l.cols > 80)
+            abort();
+    }
+
+    wlterm_scrollback_destroy(sb);
+    wlterm_vt_destroy(vt);
+    wlterm_grid_destroy(g);
+    return 0;
+}
+
+#ifndef WLTERM_LIBFUZZER
+static void run_file(FILE *f) {
+    size_t len = 0, cap = 4096;
+    unsigned char *buf = malloc(cap);
+    size_t n;
+
+    while ((n = fread(buf + len, 1, cap - len, f)) > 0) {
+        len += n;
+        if (len == cap)
+            buf = realloc(buf, cap *= 2);
+    }
+    LLVMFuzzerTestOneInput(buf, len);
+    free(buf);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        run_file(stdin);
+        return 0;
+    }
+    for (int i = 1; i < argc; ++i) {
+        FILE *f = fopen(argv[i], "rb");
+        if (!f) {
+            perror(argv[i]);
+            return 1;
+        }
+        run_file(f);
+        fclose(f);
+    }
+    return 0;
+}
+#endif
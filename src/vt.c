@@ -0,0 +1,777 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "vt.h"
+
+
+/* Scanning for the end of a printable ASCII run.
+ *
+ * Each variant returns the length of the run of bytes in 0x20..0x7e at the
+ * start of `p`. Bytes below 0x20 and at or above 0x80 are both negative or
+ * below 0x20 when compared as signed, so one compare plus a check for DEL
+ * finds every byte that has to go through the state machine. */
+
+static size_t scan_printable_scalar(const unsigned char *p, size_t len) {
+    size_t i = 0;
+    while (i < len && p[i] >= 0x20 && p[i] < 0x7f)
+        i++;
+    return i;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#if defined(__SSE2__)
+static size_t scan_printable_sse2(const unsigned char *p, size_t len) {
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i special = _mm_or_si128(_mm_cmplt_epi8(v, space), _mm_cmpeq_epi8(v, del));
+        int mask = _mm_movemask_epi8(special);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + scan_printable_scalar(p + i, len - i);
+}
+#endif
+
+__attribute__((target("avx2")))
+static size_t scan_printable_avx2(const unsigned char *p, size_t len) {
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i special = _mm256_or_si256(_mm256_cmpgt_epi8(space, v),
+                                          _mm256_cmpeq_epi8(v, del));
+        unsigned mask = _mm256_movemask_epi8(special);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+    return i + scan_printable_scalar(p + i, len - i);
+}
+#endif
+
+static size_t (*scan_printable)(const unsigned char *, size_t) = NULL;
+
+
+/* Decoding a run of printable UTF-8.
+ *
+ * Each variant decodes printable ASCII and complete 2 and 3 byte sequences
+ * from the start of `p`, appending to the `*count` codepoints in `out` up to
+ * UTF8_RUN, and stops at anything else: control bytes, DEL, 4 byte
+ * sequences and broken or incomplete ones are left to feed_utf8. Returns
+ * the number of bytes consumed and updates `*count`. Like utf8_decode,
+ * overlong forms aren't rejected. */
+
+#define UTF8_RUN 256
+
+static size_t decode_utf8_scalar(const unsigned char *p, size_t len, uint32_t *out,
+                                 size_t *count) {
+    size_t i = 0, n = *count;
+
+    while (i < len && n < UTF8_RUN) {
+        unsigned char c = p[i];
+        if (c >= 0x20 && c < 0x7f) {
+            out[n++] = c;
+            i++;
+        } else if ((c & 0xe0) == 0xc0 && i + 2 <= len && (p[i + 1] & 0xc0) == 0x80) {
+            out[n++] = (c & 0x1f) << 6 | (p[i + 1] & 0x3f);
+            i += 2;
+        } else if ((c & 0xf0) == 0xe0 && i + 3 <= len && (p[i + 1] & 0xc0) == 0x80 &&
+                   (p[i + 2] & 0xc0) == 0x80) {
+            out[n++] = (c & 0x0f) << 12 | (p[i + 1] & 0x3f) << 6 | (p[i + 2] & 0x3f);
+            i += 3;
+        } else {
+            break;
+        }
+    }
+    *count = n;
+    return i;
+}
+
+#if defined(__SSE2__)
+/* 16 bytes at a time. Every position is decoded as if a sequence started
+   there, from the block and the same block loaded 1 and 2 bytes further on;
+   the codepoints are then picked from the positions that aren't
+   continuation bytes. The continuations the leads ask for, which may run 2
+   bytes past the block, have to be exactly the continuations there are. A
+   block is cut short at the first byte that ends the run. */
+static size_t decode_utf8_sse2(const unsigned char *p, size_t len, uint32_t *out,
+                               size_t *count) {
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0, n = *count;
+
+    while (i + 18 <= len && n + 16 <= UTF8_RUN) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(p + i + 1));
+        __m128i v2 = _mm_loadu_si128((const __m128i *)(p + i + 2));
+
+        __m128i is_cont = _mm_cmpeq_epi8(_mm_and_si128(v0, _mm_set1_epi8(0xc0)),
+                                         _mm_set1_epi8(0x80));
+        __m128i is_lead2 = _mm_cmpeq_epi8(_mm_and_si128(v0, _mm_set1_epi8(0xe0)),
+                                          _mm_set1_epi8(0xc0));
+        __m128i is_lead3 = _mm_cmpeq_epi8(_mm_and_si128(v0, _mm_set1_epi8(0xf0)),
+                                          _mm_set1_epi8(0xe0));
+        unsigned high = _mm_movemask_epi8(v0);
+        unsigned cont = _mm_movemask_epi8(is_cont);
+        unsigned lead2 = _mm_movemask_epi8(is_lead2);
+        unsigned lead3 = _mm_movemask_epi8(is_lead3);
+        unsigned control = _mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(v0, space),
+                                                          _mm_cmpeq_epi8(v0, del)));
+        unsigned stop = (control & ~high) | (high & ~cont & ~lead2 & ~lead3);
+
+        unsigned limit = stop ? __builtin_ctz(stop) : 16;
+        unsigned keep = (1u << limit) - 1;
+        lead2 &= keep;
+        lead3 &= keep;
+        unsigned required = (lead2 | lead3) << 1 | lead3 << 2;
+        unsigned past = _mm_movemask_epi8(_mm_cmpeq_epi8(
+            _mm_and_si128(v2, _mm_set1_epi8(0xc0)), _mm_set1_epi8(0x80))) >> 14 << 16;
+        if (!limit || (required & ~(cont | past)) || (cont & keep & ~required))
+            break;
+
+        /* All candidates fit in 16 bits. */
+        __m128i lanes[2];
+        for (int h = 0; h < 2; ++h) {
+            __m128i b0 = h ? _mm_unpackhi_epi8(v0, zero) : _mm_unpacklo_epi8(v0, zero);
+            __m128i b1 = h ? _mm_unpackhi_epi8(v1, zero) : _mm_unpacklo_epi8(v1, zero);
+            __m128i b2 = h ? _mm_unpackhi_epi8(v2, zero) : _mm_unpacklo_epi8(v2, zero);
+            __m128i m2 = h ? _mm_unpackhi_epi8(is_lead2, is_lead2) :
+                             _mm_unpacklo_epi8(is_lead2, is_lead2);
+            __m128i m3 = h ? _mm_unpackhi_epi8(is_lead3, is_lead3) :
+                             _mm_unpacklo_epi8(is_lead3, is_lead3);
+            __m128i t1 = _mm_and_si128(b1, _mm_set1_epi16(0x3f));
+            __m128i t2 = _mm_and_si128(b2, _mm_set1_epi16(0x3f));
+            __m128i c2 = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b0, _mm_set1_epi16(0x1f)), 6),
+                                      t1);
+            __m128i c3 = _mm_or_si128(_mm_or_si128(_mm_slli_epi16(b0, 12),
+                                                   _mm_slli_epi16(t1, 6)), t2);
+            lanes[h] = _mm_or_si128(_mm_andnot_si128(_mm_or_si128(m2, m3), b0),
+                                    _mm_or_si128(_mm_and_si128(m2, c2),
+                                                 _mm_and_si128(m3, c3)));
+        }
+
+        /* Without continuations every position is a codepoint, and there is
+           room for all 16 even if fewer are kept. */
+        uint32_t decoded[16];
+        uint32_t *to = cont & keep ? decoded : out + n;
+        _mm_storeu_si128((__m128i *)to, _mm_unpacklo_epi16(lanes[0], zero));
+        _mm_storeu_si128((__m128i *)(to + 4), _mm_unpackhi_epi16(lanes[0], zero));
+        _mm_storeu_si128((__m128i *)(to + 8), _mm_unpacklo_epi16(lanes[1], zero));
+        _mm_storeu_si128((__m128i *)(to + 12), _mm_unpackhi_epi16(lanes[1], zero));
+        if (to == decoded) {
+            for (unsigned m = ~cont & keep; m; m &= m - 1)
+                out[n++] = decoded[__builtin_ctz(m)];
+        } else {
+            n += limit;
+        }
+
+        i += limit + __builtin_popcount(required >> 16);
+        if (limit < 16) {
+            *count = n;
+            return i;
+        }
+    }
+
+    *count = n;
+    return i + decode_utf8_scalar(p + i, len - i, out, count);
+}
+#endif
+
+static size_t (*decode_utf8)(const unsigned char *, size_t, uint32_t *, size_t *) = NULL;
+
+static void select_simd() {
+    scan_printable = scan_printable_scalar;
+    decode_utf8 = decode_utf8_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__SSE2__)
+    scan_printable = scan_printable_sse2;
+    decode_utf8 = decode_utf8_sse2;
+#endif
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        scan_printable = scan_printable_avx2;
+#endif
+    if (getenv("WLTERM_NO_SIMD")) {
+        scan_printable = scan_printable_scalar;
+        decode_utf8 = decode_utf8_scalar;
+    }
+}
+
+
+/* xterm's default 256 color palette, as 0xRRGGBBAA. */
+static uint32_t palette[256];
+
+static void init_palette() {
+    static const uint32_t base[16] = {
+        0x000000ff, 0xcd0000ff, 0x00cd00ff, 0xcdcd00ff,
+        0x0000eeff, 0xcd00cdff, 0x00cdcdff, 0xe5e5e5ff,
+        0x7f7f7fff, 0xff0000ff, 0x00ff00ff, 0xffff00ff,
+        0x5c5cffff, 0xff00ffff, 0x00ffffff, 0xffffffff,
+    };
+    static const uint8_t levels[6] = {0x00, 0x5f, 0x87, 0xaf, 0xd7, 0xff};
+
+    memcpy(palette, base, sizeof(base));
+    for (int i = 0; i < 216; ++i) {
+        palette[16 + i] = (uint32_t)levels[i / 36] << 24 | levels[(i / 6) % 6] << 16 |
+                          levels[i % 6] << 8 | 0xff;
+    }
+    for (int i = 0; i < 24; ++i) {
+        uint32_t l = 8 + i * 10;
+        palette[232 + i] = l << 24 | l << 16 | l << 8 | 0xff;
+    }
+}
+
+/* DEC special graphics, 0x5f..0x7e. */
+static const uint32_t dec_graphics[32] = {
+    0x00a0, 0x25c6, 0x2592, 0x2409, 0x240c, 0x240d, 0x240a, 0x00b0,
+    0x00b1, 0x2424, 0x240b, 0x2518, 0x2510, 0x250c, 0x2514, 0x253c,
+    0x23ba, 0x23bb, 0x2500, 0x23bc, 0x23bd, 0x251c, 0x2524, 0x2534,
+    0x252c, 0x2502, 0x2264, 0x2265, 0x03c0, 0x2260, 0x00a3, 0x00b7,
+};
+
+
+struct wlterm_vt *wlterm_vt_create(struct wlterm_grid *grid) {
+    struct wlterm_vt *vt = malloc(sizeof(struct wlterm_vt));
+    if (!vt) return NULL;
+
+    if (!scan_printable) {
+        select_simd();
+        init_palette();
+    }
+
+    vt->grid = grid;
+    vt->reply = NULL;
+    vt->reply_data = NULL;
+    vt->bytes_parsed = 0;
+    wlterm_vt_reset(vt);
+    return vt;
+}
+
+void wlterm_vt_destroy(struct wlterm_vt *vt) {
+    free(vt);
+}
+
+void wlterm_vt_reset(struct wlterm_vt *vt) {
+    struct wlterm_grid *g = vt->grid;
+
+    vt->state = WLTERM_VT_GROUND;
+    vt->n_params = 0;
+    vt->intermediate = 0;
+    vt->private = 0;
+    vt->utf8_len = 0;
+    vt->graphics_charset = false;
+    vt->saved_row = 0;
+    vt->saved_col = 0;
+    vt->saved_fg = WLTERM_DEFAULT_FG;
+    vt->saved_bg = WLTERM_DEFAULT_BG;
+    vt->saved_attrs = 0;
+    vt->cursor_visible = true;
+    vt->app_cursor_keys = false;
+    vt->bracketed_paste = false;
+    vt->synchronized_output = false;
+
+    g->pen_fg = WLTERM_DEFAULT_FG;
+    g->pen_bg = WLTERM_DEFAULT_BG;
+    g->pen_attrs = 0;
+    g->autowrap = true;
+    g->scroll_top = 0;
+    g->scroll_bottom = g->rows - 1;
+}
+
+static void reply(struct wlterm_vt *vt, const char *s) {
+    if (vt->reply)
+        vt->reply(vt->reply_data, s, strlen(s));
+}
+
+static inline int param(struct wlterm_vt *vt, int i, int def) {
+    return i < vt->n_params && vt->params[i] > 0 ? vt->params[i] : def;
+}
+
+static void put_codepoint(struct wlterm_vt *vt, uint32_t c) {
+    if (vt->graphics_charset && c >= 0x5f && c <= 0x7e)
+        c = dec_graphics[c - 0x5f];
+    wlterm_grid_put(vt->grid, c);
+}
+
+static void execute(struct wlterm_vt *vt, unsigned char c) {
+    struct wlterm_grid *g = vt->grid;
+
+    switch (c) {
+    case '\b':
+        if (g->cursor_col > 0)
+            g->cursor_col = (g->cursor_col < g->cols ? g->cursor_col : g->cols) - 1;
+        break;
+    case '\t':
+        g->cursor_col = (g->cursor_col / 8 + 1) * 8;
+        if (g->cursor_col >= g->cols)
+            g->cursor_col = g->cols - 1;
+        break;
+    case '\n':
+    case '\v':
+    case '\f':
+        wlterm_grid_linefeed(g);
+        break;
+    case '\r':
+        g->cursor_col = 0;
+        break;
+    case 0x0e:  /* SO */
+    case 0x0f:  /* SI */
+        break;
+    }
+}
+
+static void select_graphic_rendition(struct wlterm_vt *vt) {
+    struct wlterm_grid *g = vt->grid;
+
+    if (!vt->n_params)
+        vt->params[vt->n_params++] = 0;
+
+    for (int i = 0; i < vt->n_params; ++i) {
+        int p = vt->params[i] < 0 ? 0 : vt->params[i];
+
+        switch (p) {
+        case 0:
+            g->pen_fg = WLTERM_DEFAULT_FG;
+            g->pen_bg = WLTERM_DEFAULT_BG;
+            g->pen_attrs = 0;
+            break;
+        case 1: g->pen_attrs |= WLTERM_ATTR_BOLD; break;
+        case 3: g->pen_attrs |= WLTERM_ATTR_ITALIC; break;
+        case 4: g->pen_attrs |= WLTERM_ATTR_UNDERLINE; break;
+        case 7: g->pen_attrs |= WLTERM_ATTR_REVERSE; break;
+        case 22: g->pen_attrs &= ~WLTERM_ATTR_BOLD; break;
+        case 23: g->pen_attrs &= ~WLTERM_ATTR_ITALIC; break;
+        case 24: g->pen_attrs &= ~WLTERM_ATTR_UNDERLINE; break;
+        case 27: g->pen_attrs &= ~WLTERM_ATTR_REVERSE; break;
+        case 39: g->pen_fg = WLTERM_DEFAULT_FG; break;
+        case 49: g->pen_bg = WLTERM_DEFAULT_BG; break;
+
+        case 38:
+        case 48: {
+            uint32_t color;
+            if (i + 2 < vt->n_params && vt->params[i + 1] == 5) {
+                color = palette[vt->params[i + 2] & 0xff];
+                i += 2;
+            } else if (i + 4 < vt->n_params && vt->params[i + 1] == 2) {
+                color = (uint32_t)(vt->params[i + 2] & 0xff) << 24 |
+                        (uint32_t)(vt->params[i + 3] & 0xff) << 16 |
+                        (uint32_t)(vt->params[i + 4] & 0xff) << 8 | 0xff;
+                i += 4;
+            } else {
+                return;
+            }
+            if (p == 38)
+                g->pen_fg = color;
+            else
+                g->pen_bg = color;
+            break;
+        }
+
+        default:
+            if (p >= 30 && p <= 37)
+                g->pen_fg = palette[p - 30];
+            else if (p >= 40 && p <= 47)
+                g->pen_bg = palette[p - 40];
+            else if (p >= 90 && p <= 97)
+                g->pen_fg = palette[p - 90 + 8];
+            else if (p >= 100 && p <= 107)
+                g->pen_bg = palette[p - 100 + 8];
+            break;
+        }
+    }
+}
+
+static void set_mode(struct wlterm_vt *vt, bool enable) {
+    if (vt->private != '?')
+        return;
+
+    for (int i = 0; i < vt->n_params; ++i) {
+        switch (vt->params[i]) {
+        case 1: vt->app_cursor_keys = enable; break;
+        case 7: vt->grid->autowrap = enable; break;
+        case 25: vt->cursor_visible = enable; break;
+        case 2004: vt->bracketed_paste = enable; break;
+        case 2026: vt->synchronized_output = enable; break;
+        }
+    }
+}
+
+/* DECRQM for the private modes above: 1 set, 2 reset, 0 unknown. */
+static void report_mode(struct wlterm_vt *vt) {
+    int mode = param(vt, 0, 0), state = 0;
+    char buf[32];
+
+    switch (mode) {
+    case 1: state = vt->app_cursor_keys; break;
+    case 7: state = vt->grid->autowrap; break;
+    case 25: state = vt->cursor_visible; break;
+    case 2004: state = vt->bracketed_paste; break;
+    case 2026: state = vt->synchronized_output; break;
+    default: state = 2; break;
+    }
+    snprintf(buf, sizeof(buf), "\x1b[?%d;%d$y", mode, 2 - state);
+    reply(vt, buf);
+}
+
+static void save_cursor(struct wlterm_vt *vt) {
+    vt->saved_row = vt->grid->cursor_row;
+    vt->saved_col = vt->grid->cursor_col;
+    vt->saved_fg = vt->grid->pen_fg;
+    vt->saved_bg = vt->grid->pen_bg;
+    vt->saved_attrs = vt->grid->pen_attrs;
+}
+
+static void restore_cursor(struct wlterm_vt *vt) {
+    wlterm_grid_move_cursor(vt->grid, vt->saved_row, vt->saved_col);
+    vt->grid->pen_fg = vt->saved_fg;
+    vt->grid->pen_bg = vt->saved_bg;
+    vt->grid->pen_attrs = vt->saved_attrs;
+}
+
+static void csi_dispatch(struct wlterm_vt *vt, unsigned char c) {
+    struct wlterm_grid *g = vt->grid;
+    int row = g->cursor_row;
+    int col = g->cursor_col < g->cols ? g->cursor_col : g->cols - 1;
+    char buf[32];
+
+    switch (c) {
+    case 'A': wlterm_grid_move_cursor(g, row - param(vt, 0, 1), col); break;
+    case 'B': wlterm_grid_move_cursor(g, row + param(vt, 0, 1), col); break;
+    case 'C': wlterm_grid_move_cursor(g, row, col + param(vt, 0, 1)); break;
+    case 'D': wlterm_grid_move_cursor(g, row, col - param(vt, 0, 1)); break;
+    case 'E': wlterm_grid_move_cursor(g, row + param(vt, 0, 1), 0); break;
+    case 'F': wlterm_grid_move_cursor(g, row - param(vt, 0, 1), 0); break;
+    case 'G':
+    case '`': wlterm_grid_move_cursor(g, row, param(vt, 0, 1) - 1); break;
+    case 'd': wlterm_grid_move_cursor(g, param(vt, 0, 1) - 1, col); break;
+    case 'H':
+    case 'f': wlterm_grid_move_cursor(g, param(vt, 0, 1) - 1, param(vt, 1, 1) - 1); break;
+
+    case 'J':
+        switch (param(vt, 0, 0)) {
+        case 0:
+            wlterm_grid_erase(g, row, col, g->cols);
+            wlterm_grid_clear_rows(g, row + 1, g->rows - row - 1);
+            break;
+        case 1:
+            wlterm_grid_clear_rows(g, 0, row);
+            wlterm_grid_erase(g, row, 0, col + 1);
+            break;
+        case 2:
+        case 3:
+            wlterm_grid_clear_rows(g, 0, g->rows);
+            break;
+        }
+        break;
+    case 'K':
+        switch (param(vt, 0, 0)) {
+        case 0: wlterm_grid_erase(g, row, col, g->cols); break;
+        case 1: wlterm_grid_erase(g, row, 0, col + 1); break;
+        case 2: wlterm_grid_erase(g, row, 0, g->cols); break;
+        }
+        break;
+    case 'X': wlterm_grid_erase(g, row, col, col + param(vt, 0, 1)); break;
+
+    case 'L': wlterm_grid_insert_lines(g, param(vt, 0, 1)); break;
+    case 'M': wlterm_grid_delete_lines(g, param(vt, 0, 1)); break;
+    case '@': wlterm_grid_insert_chars(g, param(vt, 0, 1)); break;
+    case 'P': wlterm_grid_delete_chars(g, param(vt, 0, 1)); break;
+    case 'S': wlterm_grid_scroll(g, param(vt, 0, 1)); break;
+    case 'T': wlterm_grid_scroll_down(g, param(vt, 0, 1)); break;
+
+    case 'm':
+        if (!vt->private)
+            select_graphic_rendition(vt);
+        break;
+    case 'r':
+        if (!vt->private)
+            wlterm_grid_set_margins(g, param(vt, 0, 1) - 1, param(vt, 1, g->rows) - 1);
+        break;
+    case 'h': set_mode(vt, true); break;
+    case 'l': set_mode(vt, false); break;
+    case 's': save_cursor(vt); break;
+    case 'u': restore_cursor(vt); break;
+
+    case 'c':
+        if (!vt->private)
+            reply(vt, "\x1b[?62;22c");
+        break;
+    case 'n':
+        if (param(vt, 0, 0) == 5) {
+            reply(vt, "\x1b[0n");
+        } else if (param(vt, 0, 0) == 6) {
+            snprintf(buf, sizeof(buf), "\x1b[%d;%dR", row + 1, col + 1);
+            reply(vt, buf);
+        }
+        break;
+    }
+}
+
+static void esc_dispatch(struct wlterm_vt *vt, unsigned char c) {
+    struct wlterm_grid *g = vt->grid;
+
+    if (vt->intermediate == '(') {
+        vt->graphics_charset = c == '0';
+        return;
+    }
+    if (vt->intermediate)
+        return;
+
+    switch (c) {
+    case 'D': wlterm_grid_linefeed(g); break;
+    case 'E': wlterm_grid_newline(g); break;
+    case 'M': wlterm_grid_reverse_index(g); break;
+    case '7': save_cursor(vt); break;
+    case '8': restore_cursor(vt); break;
+    case 'c':
+        wlterm_vt_reset(vt);
+        wlterm_grid_clear_rows(g, 0, g->rows);
+        wlterm_grid_move_cursor(g, 0, 0);
+        break;
+    }
+}
+
+static void clear_sequence(struct wlterm_vt *vt) {
+    vt->n_params = 0;
+    vt->intermediate = 0;
+    vt->private = 0;
+}
+
+/* Run one byte through the state machine. */
+static void advance(struct wlterm_vt *vt, unsigned char c) {
+
+    /* These act the same from any state. */
+    if (c == 0x18 || c == 0x1a) {  /* CAN, SUB */
+        vt->state = WLTERM_VT_GROUND;
+        return;
+    }
+    if (c == 0x1b) {
+        /* Also terminates strings, the '\' of the ST that follows is then
+           dispatched as an unknown escape. */
+        clear_sequence(vt);
+        vt->state = WLTERM_VT_ESCAPE;
+        return;
+    }
+
+    switch (vt->state) {
+    case WLTERM_VT_GROUND:
+        if (c < 0x20)
+            execute(vt, c);
+        else if (c != 0x7f)
+            put_codepoint(vt, c);
+        break;
+
+    case WLTERM_VT_ESCAPE:
+        if (c < 0x20) {
+            execute(vt, c);
+        } else if (c == '[') {
+            vt->state = WLTERM_VT_CSI_ENTRY;
+        } else if (c == ']') {
+            vt->state = WLTERM_VT_OSC_STRING;
+        } else if (c == 'P' || c == 'X' || c == '^' || c == '_') {
+            vt->state = WLTERM_VT_STRING_IGNORE;
+        } else if (c >= 0x20 && c <= 0x2f) {
+            vt->intermediate = c;
+            vt->state = WLTERM_VT_ESCAPE_INTERMEDIATE;
+        } else {
+            esc_dispatch(vt, c);
+            vt->state = WLTERM_VT_GROUND;
+        }
+        break;
+
+    case WLTERM_VT_ESCAPE_INTERMEDIATE:
+        if (c < 0x20) {
+            execute(vt, c);
+        } else if (c >= 0x30 && c < 0x7f) {
+            esc_dispatch(vt, c);
+            vt->state = WLTERM_VT_GROUND;
+        }
+        break;
+
+    case WLTERM_VT_CSI_ENTRY:
+    case WLTERM_VT_CSI_PARAM:
+        if (c < 0x20) {
+            execute(vt, c);
+        } else if (c >= '0' && c <= '9') {
+            if (!vt->n_params) {
+                vt->n_params = 1;
+                vt->params[0] = -1;
+            }
+            int *p = &vt->params[vt->n_params - 1];
+            if (*p < 0)
+                *p = 0;
+            if (*p < 100000)
+                *p = *p * 10 + (c - '0');
+            vt->state = WLTERM_VT_CSI_PARAM;
+        } else if (c == ';' || c == ':') {
+            if (!vt->n_params) {
+                vt->n_params = 1;
+                vt->params[0] = -1;
+            }
+            if (vt->n_params < WLTERM_VT_MAX_PARAMS)
+                vt->params[vt->n_params++] = -1;
+            vt->state = WLTERM_VT_CSI_PARAM;
+        } else if (c >= '<' && c <= '?') {
+            if (vt->state == WLTERM_VT_CSI_ENTRY)
+                vt->private = c;
+            else
+                vt->state = WLTERM_VT_CSI_IGNORE;
+        } else if (c >= 0x20 && c <= 0x2f) {
+            vt->intermediate = c;
+            vt->state = WLTERM_VT_CSI_INTERMEDIATE;
+        } else if (c >= 0x40 && c < 0x7f) {
+            csi_dispatch(vt, c);
+            vt->state = WLTERM_VT_GROUND;
+        }
+        break;
+
+    case WLTERM_VT_CSI_INTERMEDIATE:
+        if (c < 0x20) {
+            execute(vt, c);
+        } else if (c >= 0x40 && c < 0x7f) {
+            /* DECRQM is the only sequence with an intermediate supported. */
+            if (c == 'p' && vt->intermediate == '$' && vt->private == '?')
+                report_mode(vt);
+            vt->state = WLTERM_VT_GROUND;
+        } else if (c >= 0x30 && c <= 0x3f) {
+            vt->state = WLTERM_VT_CSI_IGNORE;
+        }
+        break;
+
+    case WLTERM_VT_CSI_IGNORE:
+        if (c < 0x20)
+            execute(vt, c);
+        else if (c >= 0x40 && c < 0x7f)
+            vt->state = WLTERM_VT_GROUND;
+        break;
+
+    case WLTERM_VT_OSC_STRING:
+    case WLTERM_VT_STRING_IGNORE:
+        if (c == 0x07)  /* BEL terminates OSC like ST does. */
+            vt->state = WLTERM_VT_GROUND;
+        break;
+    }
+}
+
+/* Decode as much UTF-8 as possible starting at p, along with the printable
+   ASCII between sequences. Returns the number of bytes consumed; an
+   incomplete sequence at the end of the buffer is kept for the next call. */
+static size_t feed_utf8(struct wlterm_vt *vt, const unsigned char *p, size_t len) {
+    size_t i = 0;
+
+    while (i < len && p[i] >= 0x80) {
+        /* Whole runs at a time, taking the ASCII between the sequences
+           along; one codepoint at a time where the run ends. */
+        if (!vt->graphics_charset) {
+            uint32_t codepoints[UTF8_RUN];
+            size_t n = 0;
+            size_t used = decode_utf8(p + i, len - i, codepoints, &n);
+            if (used) {
+                wlterm_grid_put_codepoints(vt->grid, codepoints, n);
+                i += used;
+                continue;
+            }
+        }
+
+        unsigned char c = p[i];
+        int need = c < 0xc0 ? 1 : c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+        int32_t codepoint;
+
+        if (len - i < (size_t)need) {
+            /* Only keep it if it could still become valid. */
+            size_t rest = len - i;
+            bool valid = need > 1;
+            for (size_t k = 1; k < rest; ++k)
+                valid &= (p[i + k] & 0xc0) == 0x80;
+            if (valid) {
+                memcpy(vt->utf8, p + i, rest);
+                vt->utf8_len = rest;
+                return len;
+            }
+        }
+
+        /* utf8_decode stops at the first byte that is not a continuation,
+           so it never reads past the run. */
+        int n = need <= (int)(len - i) ? utf8_decode((const char *)p + i, &codepoint) : 1;
+        if (need > (int)(len - i))
+            codepoint = 0xfffd;
+        put_codepoint(vt, codepoint);
+        i += n;
+    }
+    return i;
+}
+
+/* Complete a sequence split across buffers. */
+static size_t finish_utf8(struct wlterm_vt *vt, const unsigned char *p, size_t len) {
+    unsigned char c = vt->utf8[0];
+    int need = c < 0xe0 ? 2 : c < 0xf0 ? 3 : 4;
+    size_t i = 0;
+    int32_t codepoint;
+
+    while (vt->utf8_len < need && i < len && (p[i] & 0xc0) == 0x80)
+        vt->utf8[vt->utf8_len++] = p[i++];
+
+    if (vt->utf8_len == need) {
+        utf8_decode(vt->utf8, &codepoint);
+        put_codepoint(vt, codepoint);
+    } else if (i < len) {
+        /* Interrupted by something that isn't a continuation byte. */
+        put_codepoint(vt, 0xfffd);
+    } else {
+        return i;  /* Still incomplete, wait for more. */
+    }
+    vt->utf8_len = 0;
+    return i;
+}
+
+void wlterm_vt_feed(struct wlterm_vt *vt, const char *buf, size_t len) {
+    const unsigned char *p = (const unsigned char *)buf;
+    size_t i = 0;
+
+    vt->bytes_parsed += len;
+
+    if (vt->utf8_len)
+        i = finish_utf8(vt, p, len);
+
+    while (i < len) {
+        if (vt->state == WLTERM_VT_GROUND) {
+            /* Fast path: printable ASCII straight to the grid. */
+            size_t n = scan_printable(p + i, len - i);
+            if (n) {
+                if (vt->graphics_charset) {
+                    for (size_t k = 0; k < n; ++k)
+                        put_codepoint(vt, p[i + k]);
+                } else {
+                    wlterm_grid_put_ascii(vt->grid, (const char *)p + i, n);
+                }
+                i += n;
+                continue;
+            }
+            if (p[i] >= 0x80) {
+                i += feed_utf8(vt, p + i, len - i);
+                continue;
+            }
+        } else if (vt->state == WLTERM_VT_OSC_STRING ||
+                   vt->state == WLTERM_VT_STRING_IGNORE) {
+            /* Skip string contents without looking at each byte twice. */
+            while (i < len && p[i] != 0x07 && p[i] != 0x1b && p[i] != 0x18 &&
+                   p[i] != 0x1a)
+                i++;
+            if (i == len)
+                break;
+        }
+        advance(vt, p[i++]);
+    }
+}
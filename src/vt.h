@@ -0,0 +1,72 @@
+#ifndef VT_H
+#define VT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "grid.h"
+
+#define WLTERM_VT_MAX_PARAMS 16
+
+enum wlterm_vt_state {
+    WLTERM_VT_GROUND,
+    WLTERM_VT_ESCAPE,
+    WLTERM_VT_ESCAPE_INTERMEDIATE,
+    WLTERM_VT_CSI_ENTRY,
+    WLTERM_VT_CSI_PARAM,
+    WLTERM_VT_CSI_INTERMEDIATE,
+    WLTERM_VT_CSI_IGNORE,
+    WLTERM_VT_OSC_STRING,
+    WLTERM_VT_STRING_IGNORE,  /* DCS, SOS, PM and APC: consumed and dropped. */
+};
+
+typedef void (*wlterm_vt_reply_func)(void *data, const char *buf, size_t len);
+
+/* VT100/xterm escape sequence parser, applying everything it reads to a
+ * grid. Runs of printable ASCII, which make up most terminal output, skip the
+ * state machine entirely: they are found with a vectorized scan and written
+ * to the grid a row segment at a time. */
+struct wlterm_vt {
+    struct wlterm_grid *grid;
+
+    enum wlterm_vt_state state;
+    int params[WLTERM_VT_MAX_PARAMS];
+    int n_params;
+    char intermediate;
+    char private;  /* '?', '>', '<' or '=' right after the CSI. */
+
+    /* Incomplete UTF-8 sequence left at the end of the previous buffer. */
+    char utf8[4];
+    int utf8_len;
+
+    /* DEC special graphics in G0, for line drawing. */
+    bool graphics_charset;
+
+    int saved_row;
+    int saved_col;
+    uint32_t saved_fg;
+    uint32_t saved_bg;
+    uint8_t saved_attrs;
+
+    bool cursor_visible;
+    bool app_cursor_keys;
+    bool bracketed_paste;
+
+    /* DECSET 2026: the application is in the middle of an update, keep
+       showing what was there before. */
+    bool synchronized_output;
+
+    /* Replies to queries (device attributes, cursor position) go here. */
+    wlterm_vt_reply_func reply;
+    void *reply_data;
+
+    uint64_t bytes_parsed;
+};
+
+struct wlterm_vt *wlterm_vt_create(struct wlterm_grid *);
+void wlterm_vt_destroy(struct wlterm_vt *);
+void wlterm_vt_reset(struct wlterm_vt *);
+void wlterm_vt_feed(struct wlterm_vt *, const char *buf, size_t len);
+
+#endif /* VT_H */
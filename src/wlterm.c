@@ -2,13 +2,20 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <linux/input-event-codes.h>
+
 #include <GL/gl.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
@@ -23,6 +30,9 @@
 #include <wayland-client.h>
 #include <wayland-egl.h>
 
+#include "fractional-scale-v1-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+#include "viewporter-client-protocol.h"
 #include "xdg-shell-client-protocol.h"
 
 #include "egl_util.h"
@@ -31,6 +41,8 @@
 
 /* double font_size = 10.0; */
 double font_size = 10.0;
+/* Points to pixels, for msdfgl and FreeType alike. */
+const float font_dpi = 156.0;
 
 msdfgl_font_t active_font;
 
@@ -48,17 +60,109 @@ int parse_color(const char *color, vec3 ret) {
 static const EGLint context_attribs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
 
 const struct wl_callback_listener frame_listener;
+
+/* Slack left for the compositor ahead of a refresh, to start with and at
+   least, in ns. */
+#define SCHEDULE_SLACK 2000000ull
+#define SCHEDULE_MIN_SLACK 1000000ull
+
+/* A synchronized update is shown anyway after this long, in ns, in case the
+   application never ends it. */
+#define SYNC_TIMEOUT 150000000ull
+
+/* A flood is over once the PTY ring hasn't backed up for this long, in ns.
+   While one goes on, the backlog comes and goes as parsing and the child
+   take turns on the CPU. */
+#define FLOOD_HOLD 100000000ull
+
+/* Follow the refresh cycle, and whether the frame presented made the
+   refresh it was drawn for: if not, leave the compositor more time. Times
+   in ns. */
+static void schedule_presented(struct wlterm_frame *f, uint64_t presented,
+                               uint32_t refresh) {
+    struct wlterm_profile *profile = &f->application->profile;
+
+    f->last_presented = presented;
+    f->refresh = refresh;
+    if (!f->feedback_target || !refresh)
+        return;
+
+    if (presented > f->feedback_target + refresh / 2) {
+        f->slack += refresh / 8;
+        if (f->slack > refresh / 2)
+            f->slack = refresh / 2;
+        profile->frames_late++;
+    } else {
+        if (f->slack > SCHEDULE_MIN_SLACK)
+            f->slack -= (f->slack - SCHEDULE_MIN_SLACK) / 32;
+        profile->frames_on_time++;
+    }
+}
+
+static void feedback_sync_output(void *data, struct wp_presentation_feedback *feedback,
+                                 struct wl_output *output) {}
+
+static void feedback_presented(void *data, struct wp_presentation_feedback *feedback,
+                               uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+                               uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo,
+                               uint32_t flags) {
+    struct wlterm_frame *f = data;
+    struct wlterm_application *app = f->application;
+
+    uint64_t presented_ns = ((uint64_t)tv_sec_hi << 32 | tv_sec_lo) * 1000000000ull +
+        tv_nsec;
+
+    /* Bring the presentation clock over to CLOCK_MONOTONIC. */
+    if (app->presentation_clock != CLOCK_MONOTONIC) {
+        struct timespec ts, mono;
+        clock_gettime(app->presentation_clock, &ts);
+        clock_gettime(CLOCK_MONOTONIC, &mono);
+        presented_ns += (mono.tv_sec * 1000000000ull + mono.tv_nsec) -
+            (ts.tv_sec * 1000000000ull + ts.tv_nsec);
+    }
+    uint64_t presented = presented_ns / 1000;
+
+    if (f->latency_input_time && presented > f->latency_input_time)
+        wlterm_histogram_add(&app->profile.metrics[WLTERM_PROFILE_INPUT_LATENCY],
+                             presented - f->latency_input_time);
+    schedule_presented(f, presented_ns, refresh);
+
+    wp_presentation_feedback_destroy(feedback);
+    f->latency_feedback = NULL;
+}
+
+static void feedback_discarded(void *data, struct wp_presentation_feedback *feedback) {
+    struct wlterm_frame *f = data;
+
+    wp_presentation_feedback_destroy(feedback);
+    f->latency_feedback = NULL;
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+    .sync_output = feedback_sync_output,
+    .presented = feedback_presented,
+    .discarded = feedback_discarded,
+};
+
 static void frame_handle_done(void *data, struct wl_callback *callback, uint32_t time) {
     struct wlterm_frame *f = data;
 
     wl_callback_destroy(callback);
+    f->frame_callback = NULL;
 
     if (!f->open)
         return;
 
-    wlterm_frame_render(f);
-    callback = wl_surface_frame(f->surface);
-    wl_callback_add_listener(callback, &frame_listener, f);
+    /* Nothing changed since the last frame: don't draw, and don't ask for
+       another callback until something gets damaged. */
+    if (!f->dirty) {
+        f->skipped_frames++;
+        return;
+    }
+
+    /* Drawn after the events are dispatched, together with every other frame
+       that is due: once this callback came, unless a synchronized update or
+       a flood of output puts it off. The PTYs are read meanwhile. */
 }
 
 const struct wl_callback_listener frame_listener = {
@@ -70,7 +174,8 @@ static void handle_toplevel_configure(void *data, struct xdg_toplevel *toplevel,
 
     struct wlterm_frame *f = data;
 
-    wlterm_frame_resize(f, width, height);
+    if (width && height)
+        wlterm_frame_resize(f, width, height);
 }
 
 static void handle_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel) {
@@ -87,33 +192,53 @@ static void handle_xdg_buffer_configure(void *data, struct xdg_surface *xdg_surf
     struct wlterm_frame *f = data;
 
     xdg_surface_ack_configure(f->xdg_surface, serial);
+
+    /* Damaged since it was created, drawn with the other frames due. */
+    f->configured = true;
 }
 
 static struct xdg_surface_listener xdg_surface_listener = {
     .configure = handle_xdg_buffer_configure};
 
 
+/* Pointer events only record where the pointer is and how far it scrolled,
+   they're acted on in handle_input(). */
 static void pointer_handle_enter(void *data, struct wl_pointer *pointer, uint32_t serial,
                                  struct wl_surface *surface, wl_fixed_t sx,
                                  wl_fixed_t sy) {
+    struct wlterm_application *app = data;
+    app->pointer_frame = wl_surface_get_user_data(surface);
+    app->pointer_x = wl_fixed_to_double(sx);
+    app->pointer_y = wl_fixed_to_double(sy);
 }
 
 
 static void pointer_handle_leave(void *data, struct wl_pointer *pointer, uint32_t serial,
-                                 struct wl_surface *surface) {}
+                                 struct wl_surface *surface) {
+    struct wlterm_application *app = data;
+    app->pointer_frame = NULL;
+}
 
 static void pointer_handle_motion(void *data, struct wl_pointer *pointer, uint32_t time,
                                   wl_fixed_t sx, wl_fixed_t sy) {
-
+    struct wlterm_application *app = data;
+    app->pointer_x = wl_fixed_to_double(sx);
+    app->pointer_y = wl_fixed_to_double(sy);
 }
 
 static void pointer_handle_button(void *data, struct wl_pointer *wl_pointer,
                                   uint32_t serial, uint32_t time, uint32_t button,
                                   uint32_t state) {
+    struct wlterm_application *app = data;
+    if (button == BTN_LEFT && state == WL_POINTER_BUTTON_STATE_PRESSED)
+        app->pointer_pressed = true;
 }
 
 static void pointer_handle_axis(void *data, struct wl_pointer *wl_pointer, uint32_t time,
                                 uint32_t axis, wl_fixed_t value) {
+    struct wlterm_application *app = data;
+    if (axis == WL_POINTER_AXIS_VERTICAL_SCROLL)
+        app->scroll += wl_fixed_to_double(value);
 }
 
 static void pointer_handle_frame(void *data, struct wl_pointer *wl_pointer) {
@@ -125,9 +250,15 @@ static void pointer_handle_axis_source(void *data, struct wl_pointer *wl_pointer
 
 static void pointer_handle_axis_stop(void *data, struct wl_pointer *wl_pointer,
                                      uint32_t time, uint32_t axis) {
+    struct wlterm_application *app = data;
+    if (axis == WL_POINTER_AXIS_VERTICAL_SCROLL)
+        app->scroll_stopped = true;
 }
 static void pointer_handle_axis_discrete(void *data, struct wl_pointer *wl_pointer,
                                          uint32_t axis, int32_t discrete) {
+    struct wlterm_application *app = data;
+    if (axis == WL_POINTER_AXIS_VERTICAL_SCROLL)
+        app->scroll_discrete += discrete;
 }
 
 static const struct wl_pointer_listener pointer_listener = {
@@ -146,7 +277,6 @@ static void keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard, uint32_
                             int32_t fd, uint32_t size) {
 
     struct wlterm_application *app = data;
-    struct xkb_context *xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
 
     if (format != WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1) {
         close(fd);
@@ -157,14 +287,41 @@ static void keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard, uint32_
         close(fd);
         exit(1);
     }
+    struct xkb_context *xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
     struct xkb_keymap *xkb_keymap =
         xkb_keymap_new_from_string(xkb_context, map_shm, XKB_KEYMAP_FORMAT_TEXT_V1, 0);
     munmap(map_shm, size);
     close(fd);
+    xkb_context_unref(xkb_context);
 
+    if (app->xkb_state)
+        xkb_state_unref(app->xkb_state);
+    if (app->xkb_keymap)
+        xkb_keymap_unref(app->xkb_keymap);
+    app->xkb_keymap = xkb_keymap;
     app->xkb_state = xkb_state_new(xkb_keymap);
 }
 
+static void repeat_stop(struct wlterm_application *app) {
+    struct itimerspec off = {0};
+    app->repeat_key = 0;
+    timerfd_settime(app->repeat_fd, 0, &off, NULL);
+}
+
+static void repeat_start(struct wlterm_application *app, uint32_t key) {
+    if (app->repeat_rate <= 0 || !xkb_keymap_key_repeats(app->xkb_keymap, key + 8))
+        return;
+
+    long delay = app->repeat_delay > 0 ? app->repeat_delay * 1000000l : 1;
+    long interval = 1000000000l / app->repeat_rate;
+    struct itimerspec its = {
+        .it_value = {delay / 1000000000, delay % 1000000000},
+        .it_interval = {interval / 1000000000, interval % 1000000000},
+    };
+    app->repeat_key = key;
+    timerfd_settime(app->repeat_fd, 0, &its, NULL);
+}
+
 static void keyboard_enter(void *data, struct wl_keyboard *wl_keyboard, uint32_t serial,
                            struct wl_surface *surface, struct wl_array *keys) {
 
@@ -175,33 +332,418 @@ static void keyboard_enter(void *data, struct wl_keyboard *wl_keyboard, uint32_t
 
 static void keyboard_leave(void *data, struct wl_keyboard *wl_keyboard, uint32_t serial,
                            struct wl_surface *surface) {
-    // Who cares
+    repeat_stop(data);
 }
 static void keyboard_repeat_info(void *data, struct wl_keyboard *wl_keyboard,
-                                 int32_t rate, int32_t delay) {}
+                                 int32_t rate, int32_t delay) {
+    struct wlterm_application *app = data;
+    app->repeat_rate = rate;
+    app->repeat_delay = delay;
+    if (rate <= 0)
+        repeat_stop(app);
+}
 
 static void keyboard_modifiers(void *data, struct wl_keyboard *keyboard, uint32_t serial,
                                uint32_t mods_depressed, uint32_t mods_latched,
-                               uint32_t mods_locked, uint32_t group) {}
+                               uint32_t mods_locked, uint32_t group) {
+    struct wlterm_application *app = data;
+    if (app->xkb_state)
+        xkb_state_update_mask(app->xkb_state, mods_depressed, mods_latched, mods_locked,
+                              0, 0, group);
+}
+
+/* The clipboard. Of each offer only text is of interest: the type to ask
+   for is noted while its types are announced, before it becomes the
+   selection. */
+static void offer_handle_offer(void *data, struct wl_data_offer *offer, const char *type) {
+    struct wlterm_application *app = data;
+
+    if (offer != app->offer)
+        return;
+    if (strcmp(type, "text/plain;charset=utf-8") == 0)
+        app->offer_type = "text/plain;charset=utf-8";
+    else if (!app->offer_type && strcmp(type, "text/plain") == 0)
+        app->offer_type = "text/plain";
+}
+
+static const struct wl_data_offer_listener offer_listener = {
+    .offer = offer_handle_offer,
+};
+
+static void device_handle_data_offer(void *data, struct wl_data_device *device,
+                                     struct wl_data_offer *offer) {
+    struct wlterm_application *app = data;
+
+    if (app->offer)
+        wl_data_offer_destroy(app->offer);
+    app->offer = offer;
+    app->offer_type = NULL;
+    wl_data_offer_add_listener(offer, &offer_listener, app);
+}
+
+/* Nothing can be dropped on a terminal. */
+static void device_handle_enter(void *data, struct wl_data_device *device, uint32_t serial,
+                                struct wl_surface *surface, wl_fixed_t x, wl_fixed_t y,
+                                struct wl_data_offer *offer) {
+    struct wlterm_application *app = data;
+
+    if (offer && offer == app->offer) {
+        wl_data_offer_destroy(offer);
+        app->offer = NULL;
+    }
+}
+
+static void device_handle_leave(void *data, struct wl_data_device *device) {}
 
+static void device_handle_motion(void *data, struct wl_data_device *device, uint32_t time,
+                                 wl_fixed_t x, wl_fixed_t y) {}
+
+static void device_handle_drop(void *data, struct wl_data_device *device) {}
+
+static void device_handle_selection(void *data, struct wl_data_device *device,
+                                    struct wl_data_offer *offer) {
+    struct wlterm_application *app = data;
+
+    if (app->selection)
+        wl_data_offer_destroy(app->selection);
+    app->selection = NULL;
+
+    if (!offer || offer != app->offer)
+        return;
+    if (app->offer_type) {
+        app->selection = offer;
+        app->selection_type = app->offer_type;
+    } else {
+        wl_data_offer_destroy(offer);
+    }
+    app->offer = NULL;
+}
+
+static const struct wl_data_device_listener data_device_listener = {
+    .data_offer = device_handle_data_offer,
+    .enter = device_handle_enter,
+    .leave = device_handle_leave,
+    .motion = device_handle_motion,
+    .drop = device_handle_drop,
+    .selection = device_handle_selection,
+};
+
+/* Ask the clipboard's owner for its text. The main loop reads it as it
+   comes in, then pastes it into `w`. */
+static void paste_start(struct wlterm_application *app, struct wlterm_window *w) {
+    int fds[2];
+
+    if (!app->selection || app->paste_fd >= 0 || pipe(fds) < 0)
+        return;
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    wl_data_offer_receive(app->selection, app->selection_type, fds[1]);
+    close(fds[1]);
+
+    app->paste_fd = fds[0];
+    app->paste_len = 0;
+    app->paste_window = w;
+}
+
+/* Type pasted text into the window's shell. Line breaks go in as returns,
+   like xterm. With bracketed paste (DECSET 2004) the text is marked so the
+   application can tell it from typing; ESC is dropped from it so the text
+   can't end the paste itself. */
+static void window_paste(struct wlterm_window *w, char *text, size_t len) {
+    bool bracketed = w->vt->bracketed_paste;
+    size_t n = 0;
+    char prev = 0;
+
+    for (size_t i = 0; i < len; prev = text[i++]) {
+        if ((bracketed && text[i] == '\033') || (text[i] == '\n' && prev == '\r'))
+            continue;
+        text[n++] = text[i] == '\n' ? '\r' : text[i];
+    }
+
+    if (!w->pty)
+        return;
+    if (bracketed)
+        wlterm_pty_write(w->pty, "\033[200~", 6);
+    wlterm_pty_write(w->pty, text, n);
+    if (bracketed)
+        wlterm_pty_write(w->pty, "\033[201~", 6);
+}
+
+/* Read what has come in of a paste, and type it once it is all there. */
+static void paste_read(struct wlterm_application *app) {
+    ssize_t n;
+
+    do {
+        app->paste = realloc(app->paste, app->paste_len + 4096);
+        n = read(app->paste_fd, app->paste + app->paste_len, 4096);
+        if (n > 0)
+            app->paste_len += n;
+    } while (n > 0);
+    if (n < 0 && (errno == EAGAIN || errno == EINTR))
+        return;
+
+    close(app->paste_fd);
+    app->paste_fd = -1;
+    if (app->paste_window)
+        window_paste(app->paste_window, app->paste, app->paste_len);
+    app->paste_window = NULL;
+}
+
+/* Queue a press of evdev key `key`, with the modifiers held now. */
+static void queue_key(struct wlterm_application *app, uint32_t key) {
+    if (app->n_keys == app->keys_capacity) {
+        app->keys_capacity = app->keys_capacity ? app->keys_capacity * 2 : 16;
+        app->keys = realloc(app->keys, app->keys_capacity * sizeof(struct wlterm_key));
+    }
+    struct wlterm_key *k = &app->keys[app->n_keys++];
+    struct xkb_state *state = app->xkb_state;
+
+    k->sym = xkb_state_key_get_one_sym(state, key + 8);
+    k->mods = 0;
+    if (xkb_state_mod_name_is_active(state, XKB_MOD_NAME_SHIFT, XKB_STATE_MODS_EFFECTIVE) > 0)
+        k->mods |= WLTERM_MOD_SHIFT;
+    if (xkb_state_mod_name_is_active(state, XKB_MOD_NAME_ALT, XKB_STATE_MODS_EFFECTIVE) > 0)
+        k->mods |= WLTERM_MOD_ALT;
+    if (xkb_state_mod_name_is_active(state, XKB_MOD_NAME_CTRL, XKB_STATE_MODS_EFFECTIVE) > 0)
+        k->mods |= WLTERM_MOD_CTRL;
+    memset(k->text, 0, sizeof(k->text));
+    xkb_state_key_get_utf8(state, key + 8, k->text, sizeof(k->text));
+}
+
+static bool same_key(const struct wlterm_key *a, const struct wlterm_key *b) {
+    return a->sym == b->sym && a->mods == b->mods && strcmp(a->text, b->text) == 0;
+}
 
 static void keyboard_key(void *data, struct wl_keyboard *wl_keyboard, uint32_t serial,
                          uint32_t time, uint32_t key, uint32_t _key_state) {
     struct wlterm_application *app = data;
     enum wl_keyboard_key_state key_state = _key_state;
-    xkb_keysym_t sym = xkb_state_key_get_one_sym(app->xkb_state, key + 8);
 
-    if (key_state != WL_KEYBOARD_KEY_STATE_PRESSED)
+    if (key_state != WL_KEYBOARD_KEY_STATE_PRESSED) {
+        if (key == app->repeat_key)
+            repeat_stop(app);
+        return;
+    }
+
+    /* Key times are in ms, normally on CLOCK_MONOTONIC but with an unspecified
+       base. Use them when they look like it, the time of arrival otherwise. */
+    if (app->active_frame && !app->active_frame->input_time) {
+        uint64_t now = timestamp_us();
+        uint32_t age = (uint32_t)(now / 1000) - time;
+        app->active_frame->input_time = age < 10000 ? now - age * 1000ull : now;
+    }
+
+    queue_key(app, key);
+    repeat_start(app, key);
+}
+
+/* Keys that type no text, as xterm sends them: CSI <number> ~, or a final
+   byte after CSI, or after SS3 in application cursor mode (DECCKM) or
+   always for `ss3`. With modifiers, CSI 1 ; <1 + mods> <final>. */
+static const struct {
+    xkb_keysym_t sym;
+    char final;
+    int number;
+    bool ss3;
+} special_keys[] = {
+    {XKB_KEY_Up, 'A'}, {XKB_KEY_Down, 'B'}, {XKB_KEY_Right, 'C'}, {XKB_KEY_Left, 'D'},
+    {XKB_KEY_Home, 'H'}, {XKB_KEY_End, 'F'},
+    {XKB_KEY_F1, 'P', 0, true}, {XKB_KEY_F2, 'Q', 0, true},
+    {XKB_KEY_F3, 'R', 0, true}, {XKB_KEY_F4, 'S', 0, true},
+    {XKB_KEY_Insert, '~', 2}, {XKB_KEY_Delete, '~', 3},
+    {XKB_KEY_Prior, '~', 5}, {XKB_KEY_Next, '~', 6},
+    {XKB_KEY_F5, '~', 15}, {XKB_KEY_F6, '~', 17}, {XKB_KEY_F7, '~', 18},
+    {XKB_KEY_F8, '~', 19}, {XKB_KEY_F9, '~', 20}, {XKB_KEY_F10, '~', 21},
+    {XKB_KEY_F11, '~', 23}, {XKB_KEY_F12, '~', 24},
+};
+
+/* Type `count` presses of a key into the window's shell. */
+static void window_send_key(struct wlterm_window *w, const struct wlterm_key *k, int count) {
+    char buf[32];
+    int len = 0;
+
+    for (size_t i = 0; i < sizeof(special_keys) / sizeof(special_keys[0]); ++i) {
+        if (special_keys[i].sym != k->sym)
+            continue;
+        if (special_keys[i].number)
+            len = k->mods ? snprintf(buf, sizeof(buf), "\033[%d;%d~", special_keys[i].number,
+                                     1 + k->mods)
+                          : snprintf(buf, sizeof(buf), "\033[%d~", special_keys[i].number);
+        else if (k->mods)
+            len = snprintf(buf, sizeof(buf), "\033[1;%d%c", 1 + k->mods, special_keys[i].final);
+        else
+            len = snprintf(buf, sizeof(buf), "\033%c%c",
+                           special_keys[i].ss3 || w->vt->app_cursor_keys ? 'O' : '[',
+                           special_keys[i].final);
+        break;
+    }
+
+    if (!len) {
+        /* Alt sends ESC first, BackSpace DEL rather than ^H. */
+        if (k->mods & WLTERM_MOD_ALT)
+            buf[len++] = '\033';
+        if (k->sym == XKB_KEY_ISO_Left_Tab)
+            len += snprintf(buf + len, sizeof(buf) - len, "\033[Z");
+        else if (k->sym == XKB_KEY_BackSpace)
+            buf[len++] = k->mods & WLTERM_MOD_CTRL ? '\b' : '\177';
+        else if (k->text[0])
+            len += snprintf(buf + len, sizeof(buf) - len, "%s", k->text);
+        else
+            return;
+    }
+
+    if (!w->pty)
         return;
+    for (int i = 0; i < count; ++i)
+        wlterm_pty_write(w->pty, buf, len);
+}
+
+/* Act on `count` presses of `k` in a row. Scrolling and resizing add up
+   into one step. Commands take Ctrl+Shift, everything else goes to the
+   active window's shell. Returns whether the key was typed there. */
+static bool handle_key(struct wlterm_application *app, const struct wlterm_key *k, int count) {
+    bool command = (k->mods & (WLTERM_MOD_CTRL | WLTERM_MOD_SHIFT)) ==
+        (WLTERM_MOD_CTRL | WLTERM_MOD_SHIFT);
+    xkb_keysym_t sym = xkb_keysym_to_lower(k->sym);
+
+    if (command && sym == XKB_KEY_c) {
+        if (app->active_frame)
+            wlterm_frame_destroy(app->active_frame);
+        return false;
+    }
+    if (command && sym == XKB_KEY_n) {
+        for (int i = 0; i < count; ++i)
+            wlterm_frame_create(app);
+        return false;
+    }
+
+    struct wlterm_window *w = app->active_frame ? app->active_frame->active_window : NULL;
+    if (!w)
+        return false;
+
+    if (k->mods == WLTERM_MOD_SHIFT) {
+        switch (k->sym) {
+        case XKB_KEY_Prior:
+            wlterm_window_scroll(w, count * (w->grid->rows / 2));
+            return false;
+        case XKB_KEY_Next:
+            wlterm_window_scroll(w, -count * (w->grid->rows / 2));
+            return false;
+        case XKB_KEY_Insert:
+            paste_start(app, w);
+            return false;
+        }
+    }
+
+    if (!command) {
+        window_send_key(w, k, count);
+        return true;
+    }
 
     switch (sym) {
-    case XKB_KEY_c:
-        wlterm_frame_destroy(app->active_frame);
+    case XKB_KEY_v:
+    case XKB_KEY_s:
+        for (int i = 0; i < count; ++i)
+            w = w->frame->active_window = wlterm_window_split(
+                w, sym == XKB_KEY_v ? WLTERM_SPLIT_HORIZONTAL : WLTERM_SPLIT_VERTICAL);
+        break;
+    case XKB_KEY_x:
+        /* The last window goes with its frame. */
+        for (int i = 0; i < count && w->frame->root_window->next; ++i) {
+            struct wlterm_frame *f = w->frame;
+            wlterm_window_destroy(w);
+            w = f->active_window;
+        }
+        break;
+    case XKB_KEY_o:
+        for (int i = 0; i < count; ++i)
+            w = w->frame->active_window = w->next ? w->next : w->frame->root_window;
         break;
-    case XKB_KEY_n:
-        wlterm_frame_create(app);
+    case XKB_KEY_Up:
+    case XKB_KEY_Down:
+        wlterm_window_resize_split(w, WLTERM_SPLIT_VERTICAL, count *
+                                   (sym == XKB_KEY_Up ? w->cell_height : -w->cell_height));
         break;
+    case XKB_KEY_Right:
+    case XKB_KEY_Left:
+        wlterm_window_resize_split(w, WLTERM_SPLIT_HORIZONTAL, count *
+                                   (sym == XKB_KEY_Right ? w->cell_width : -w->cell_width));
+        break;
+    default:
+        window_send_key(w, k, count);
+        return true;
+    }
+    return false;
+}
+
+static struct wlterm_window *window_at(struct wlterm_frame *f, double x, double y) {
+    FOR_EACH_WINDOW (f, w)
+        if (x >= w->x && x < w->x + w->width && y >= w->y && y < w->y + w->height)
+            return w;
+    return NULL;
+}
+
+/* Everything that came in since the last time, at once: runs of the same
+   key, and all scrolling, are applied as a single step so the windows get
+   damaged once. */
+static void handle_input(struct wlterm_application *app) {
+    struct wlterm_frame *f = app->pointer_frame;
+    struct wlterm_window *w = f ? window_at(f, app->pointer_x, app->pointer_y) : NULL;
+
+    if (app->pointer_pressed && w) {
+        app->active_frame = f;
+        f->active_window = w;
+    }
+    app->pointer_pressed = false;
+
+    /* Wheels scroll three lines a notch, touchpads by the pixel. */
+    uint64_t now = timestamp_us();
+    if (w && app->scroll_discrete) {
+        wlterm_window_scroll_pixels(w, -3 * app->scroll_discrete * w->cell_height);
+    } else if (w && app->scroll) {
+        /* Touching again stops any scrolling still going on. */
+        double dt = (now - app->scroll_time) / 1e6;
+        double velocity = dt > 0.0 && dt < 0.1 ? -app->scroll / dt : 0.0;
+        app->scroll_velocity = (app->scroll_velocity + velocity) / 2;
+        app->scroll_time = now;
+        app->kinetic_window = NULL;
+        wlterm_window_scroll_pixels(w, -app->scroll);
+    }
+    if (w && app->scroll_stopped && fabs(app->scroll_velocity) > 50.0 &&
+        now - app->scroll_time < 100000)
+        app->kinetic_window = w;
+    app->scroll = 0.0;
+    app->scroll_discrete = 0;
+    app->scroll_stopped = false;
+
+    /* Slowing down exponentially, stopped by the end of the scrollback. Each
+       step damages the window, so the loop keeps waking up for frames until
+       the scrolling stops. */
+    if (app->kinetic_window) {
+        double dt = (now - app->scroll_time) / 1e6;
+        app->scroll_time = now;
+        if (!wlterm_window_scroll_pixels(app->kinetic_window, app->scroll_velocity * dt))
+            app->kinetic_window = NULL;
+        app->scroll_velocity *= exp(-dt / 0.325);
+        if (fabs(app->scroll_velocity) < 20.0)
+            app->kinetic_window = NULL;
+    }
+
+    bool typed = false;
+    for (int i = 0, count; i < app->n_keys; i += count) {
+        for (count = 1; i + count < app->n_keys; ++count)
+            if (!same_key(&app->keys[i + count], &app->keys[i]))
+                break;
+        typed |= handle_key(app, &app->keys[i], count);
     }
+    app->n_keys = 0;
+
+    /* Keys that left a frame as it was have no latency to measure: the next
+       frame drawn would be for something else. Unless they were typed into
+       its shell, which has yet to echo them. */
+    for (f = app->root_frame; f; f = f->next)
+        if (!f->dirty && !(typed && f == app->active_frame))
+            f->input_time = 0;
 }
 
 static const struct wl_keyboard_listener keyboard_listener = {
@@ -236,6 +778,91 @@ const struct wl_seat_listener seat_listener = {
 };
 
 
+static void presentation_clock_id(void *data, struct wp_presentation *presentation,
+                                  uint32_t clock) {
+    struct wlterm_application *app = data;
+    app->presentation_clock = clock;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+    .clock_id = presentation_clock_id,
+};
+
+static void output_handle_geometry(void *data, struct wl_output *output, int32_t x,
+                                   int32_t y, int32_t physical_width,
+                                   int32_t physical_height, int32_t subpixel,
+                                   const char *make, const char *model,
+                                   int32_t transform) {}
+
+static void output_handle_mode(void *data, struct wl_output *output, uint32_t flags,
+                               int32_t width, int32_t height, int32_t refresh) {}
+
+static void output_handle_done(void *data, struct wl_output *output) {}
+
+static void output_handle_scale(void *data, struct wl_output *output, int32_t scale) {
+    struct wlterm_output *o = data;
+    o->scale = scale;
+}
+
+static const struct wl_output_listener output_listener = {
+    .geometry = output_handle_geometry,
+    .mode = output_handle_mode,
+    .done = output_handle_done,
+    .scale = output_handle_scale,
+};
+
+/* Without fractional scaling, draw for the densest output the frame is
+   on. */
+static void frame_update_scale(struct wlterm_frame *f) {
+    if (f->fractional_scale)
+        return;
+
+    int32_t scale = 1;
+    for (int i = 0; i < f->n_outputs; ++i) {
+        struct wlterm_output *o = wl_output_get_user_data(f->outputs[i]);
+        if (o->scale > scale)
+            scale = o->scale;
+    }
+    wlterm_frame_set_scale(f, scale);
+}
+
+static void frame_handle_surface_enter(void *data, struct wl_surface *surface,
+                                       struct wl_output *output) {
+    struct wlterm_frame *f = data;
+    if (f->n_outputs == WLTERM_MAX_FRAME_OUTPUTS)
+        return;
+    f->outputs[f->n_outputs++] = output;
+    frame_update_scale(f);
+}
+
+static void frame_handle_surface_leave(void *data, struct wl_surface *surface,
+                                       struct wl_output *output) {
+    struct wlterm_frame *f = data;
+    for (int i = 0; i < f->n_outputs; ++i) {
+        if (f->outputs[i] != output)
+            continue;
+        f->outputs[i] = f->outputs[--f->n_outputs];
+        frame_update_scale(f);
+        return;
+    }
+}
+
+static const struct wl_surface_listener surface_listener = {
+    .enter = frame_handle_surface_enter,
+    .leave = frame_handle_surface_leave,
+};
+
+/* In 120ths. */
+static void frame_handle_preferred_scale(void *data,
+                                         struct wp_fractional_scale_v1 *fractional_scale,
+                                         uint32_t scale) {
+    wlterm_frame_set_scale(data, scale / 120.0);
+}
+
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener = {
+    .preferred_scale = frame_handle_preferred_scale,
+};
+
 static void handle_global(void *data, struct wl_registry *registry, uint32_t name,
                           const char *interface, uint32_t version) {
 
@@ -248,13 +875,48 @@ static void handle_global(void *data, struct wl_registry *registry, uint32_t nam
         wl_seat_add_listener(app->seat, &seat_listener, app);
     } else if (strcmp(interface, wl_shm_interface.name) == 0) {
         app->shm = wl_registry_bind(registry, name, &wl_shm_interface, version);
+    } else if (strcmp(interface, wl_data_device_manager_interface.name) == 0) {
+        app->data_device_manager =
+            wl_registry_bind(registry, name, &wl_data_device_manager_interface, 1);
     } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
         app->xdg_wm_base = wl_registry_bind(registry, name, &xdg_wm_base_interface, version);
+    } else if (strcmp(interface, wp_presentation_interface.name) == 0) {
+        app->presentation = wl_registry_bind(registry, name, &wp_presentation_interface, 1);
+        wp_presentation_add_listener(app->presentation, &presentation_listener, app);
+    } else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
+        app->viewporter = wl_registry_bind(registry, name, &wp_viewporter_interface, 1);
+    } else if (strcmp(interface, wp_fractional_scale_manager_v1_interface.name) == 0) {
+        app->fractional_scale_manager =
+            wl_registry_bind(registry, name, &wp_fractional_scale_manager_v1_interface, 1);
+    } else if (strcmp(interface, wl_output_interface.name) == 0 && version >= 2) {
+        struct wlterm_output *o = calloc(1, sizeof(struct wlterm_output));
+        o->output = wl_registry_bind(registry, name, &wl_output_interface, 2);
+        o->name = name;
+        o->scale = 1;
+        o->next = app->outputs;
+        app->outputs = o;
+        wl_output_add_listener(o->output, &output_listener, o);
     }
 }
 
 static void handle_global_remove(void *data, struct wl_registry *registry,
-                                 uint32_t name) {}
+                                 uint32_t name) {
+    struct wlterm_application *app = data;
+
+    for (struct wlterm_output **op = &app->outputs; *op; op = &(*op)->next) {
+        struct wlterm_output *o = *op;
+        if (o->name != name)
+            continue;
+
+        /* Frames on it go by the outputs they're still on. */
+        for (struct wlterm_frame *f = app->root_frame; f; f = f->next)
+            frame_handle_surface_leave(f, f->surface, o->output);
+        *op = o->next;
+        wl_output_destroy(o->output);
+        free(o);
+        return;
+    }
+}
 
 static const struct wl_registry_listener registry_listener = {
     .global = handle_global,
@@ -264,154 +926,1823 @@ static const struct wl_registry_listener registry_listener = {
 
 int missing_glyph(msdfgl_font_t font, int32_t glyph, void *data) {
     struct wlterm_application *app = data;
-    EGLContext c = eglGetCurrentContext();
-    EGLSurface drw = eglGetCurrentSurface(EGL_DRAW);
-    EGLSurface rd = eglGetCurrentSurface(EGL_READ);
-
-    // Switch to the root context, as our font textures are stored there
-    eglMakeCurrent(app->gl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
-                   app->gl_context);
-    int generated = msdfgl_generate_glyph(font, glyph);
-
-    // Restore context
-    eglMakeCurrent(app->gl_display, drw, rd, c);
 
-    return generated;
+    /* Only glyphs known to be ready are drawn, so this is rare. Never
+       generate here, in the middle of a frame. */
+    wlterm_glyph_request(app->glyph_worker, glyph);
+    return 0;
 }
 
 bool load_font(struct wlterm_application *app, const char *font_name) {
+    /* Everything that affects the generated glyphs. */
+    const float dpi = font_dpi;
+    const int atlas_size = 1024;
+    const double range = 4.0, scale = 1.0;
 
     eglMakeCurrent(app->gl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, app->gl_context);
     app->msdfgl_ctx = msdfgl_create_context("320 es");
-    msdfgl_set_dpi(app->msdfgl_ctx, 156.0, 156.0);
+    msdfgl_set_dpi(app->msdfgl_ctx, dpi, dpi);
 
-    /* Enable auto-generating glyphs as they are encountered for the first time. */
+    /* Glyphs are generated in the background as they are encountered for the
+       first time. */
     msdfgl_set_missing_glyph_callback(app->msdfgl_ctx, missing_glyph, app);
 
-    msdfgl_atlas_t atlas = msdfgl_create_atlas(app->msdfgl_ctx, 1024, 2);
-    active_font = msdfgl_load_font(app->msdfgl_ctx, font_name, 4.0, 1.0, atlas);
+    msdfgl_atlas_t atlas = msdfgl_create_atlas(app->msdfgl_ctx, atlas_size, 2);
+    active_font = msdfgl_load_font(app->msdfgl_ctx, font_name, range, scale, atlas);
     msdfgl_generate_ascii(active_font);
+    msdfgl_generate_glyph(active_font, WLTERM_PLACEHOLDER_GLYPH);
+
+    float _y = 0.0;
+    app->cell_width = 0.0;
+    msdfgl_geometry(&app->cell_width, &_y, active_font, font_size, 0, "M");
+    app->cell_height = msdfgl_vertical_advance(active_font, font_size);
+
+    /* From here on the root context belongs to the glyph worker. */
+    glFinish();
+    eglMakeCurrent(app->gl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    app->glyph_worker = wlterm_glyph_worker_create(app->gl_display, app->gl_context,
+                                                   app->msdfgl_ctx, active_font,
+                                                   font_name, range, scale, atlas_size);
+
+    for (int32_t c = ' '; c <= '~'; ++c)
+        wlterm_glyph_mark_ready(app->glyph_worker, c);
+    wlterm_glyph_mark_ready(app->glyph_worker, WLTERM_PLACEHOLDER_GLYPH);
 
     return true;
 }
 
-void wlterm_frame_resize(struct wlterm_frame *f, int width, int height) {
+int max(int a, int b) { return a > b ? a : b; }
+int min(int a, int b) { return a < b ? a : b; }
 
-    f->width = width;
-    f->height = height;
-    wl_egl_window_resize(f->gl_window, width * f->scale, height * f->scale, 0, 0);
-    glm_ortho(0.0, f->width, f->height, 0.0, -1.0, 1.0, f->projection);
+/* Fit the window's grid to its size in cells. */
+static void window_resize_grid(struct wlterm_window *w) {
+    w->cell_width = w->frame->application->cell_width;
+    w->cell_height = w->frame->application->cell_height;
 
-    f->root_window->width = width;
-    f->root_window->height = height;
-    /* f->root_window->height = height - f->minibuffer_height; */
+    wlterm_grid_resize(w->grid, w->height / w->cell_height, w->width / w->cell_width);
+    if (w->pty)
+        wlterm_pty_resize(w->pty, w->grid->rows, w->grid->cols);
+}
 
-    wl_surface_commit(f->surface);
+static void window_handle_pty_data(void *data, const char *buf, size_t len) {
+    struct wlterm_window *w = data;
+    wlterm_vt_feed(w->vt, buf, len);
 }
 
+static void window_handle_vt_reply(void *data, const char *buf, size_t len) {
+    struct wlterm_window *w = data;
+    if (w->pty)
+        wlterm_pty_write(w->pty, buf, len);
+}
 
-int max(int a, int b) { return a > b ? a : b; }
+/* Feed everything the reader thread has queued into the grid, and damage the
+   rows that changed. */
+void wlterm_window_read_pty(struct wlterm_window *w) {
+    struct wlterm_grid *g = w->grid;
 
-static inline void set_region(struct wlterm_frame *f, int x, int y, int w, int h) {
-    /* glScissor wants the botton-left corner of the area, the origin being in
-     the bottom-left corner of the frame. */
+    uint64_t now = timestamp_us() * 1000;
 
-    glScissor(max(0, x) * f->scale, max(0, f->height - y - h) * f->scale,
-              max(0, w) * f->scale, max(0, h) * f->scale);
+    /* A flood: the reader got half its ring ahead of parsing. */
+    if (wlterm_pty_queued(w->pty) >= WLTERM_PTY_CHUNKS / 2)
+        w->flood_seen = now;
+
+    size_t bytes = wlterm_pty_drain(w->pty, window_handle_pty_data, w);
+
+    if (!w->vt->synchronized_output)
+        w->sync_start = 0;
+    else if (!w->sync_start)
+        w->sync_start = now;
+
+    if (!bytes)
+        return;
+
+    /* New output jumps back to the bottom. */
+    if (w->scroll_offset || w->scroll_fraction) {
+        w->scroll_offset = 0;
+        w->scroll_fraction = 0.0;
+        wlterm_window_damage_all(w);
+        return;
+    }
+
+    int first = g->rows, last = -1;
+    for (int row = 0; row < g->rows; ++row) {
+        if (g->dirty[row]) {
+            if (row < first) first = row;
+            last = row;
+        }
+    }
+    if (last >= 0)
+        wlterm_window_damage(w, 0, first * w->cell_height, w->width,
+                             (last - first + 1) * w->cell_height);
 }
 
-void window_render(struct wlterm_window *w) {
+static void buffer_handle_release(void *data, struct wl_buffer *wl_buffer) {
+    struct wlterm_shm_buffer *b = data;
+    b->busy = false;
+}
 
-    /* if (w->position[1] > 0) w->position[1] = 0; */
-    /* if (w->position[0] > 0) w->position[0] = 0; */
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_handle_release,
+};
 
-    /* Prevent changing anything outside the window. */
+static void frame_release_buffers(struct wlterm_frame *f) {
+    for (int i = 0; i < 2; ++i)
+        if (f->buffers[i].buffer)
+            wl_buffer_destroy(f->buffers[i].buffer);
+    memset(f->buffers, 0, sizeof(f->buffers));
+    if (f->shm_data)
+        munmap(f->shm_data, f->shm_size);
+    f->shm_data = NULL;
+}
 
-    set_region(w->frame, w->x, w->y, w->width, w->height);
+/* Software frames: both buffers at the frame's buffer size, in one shared
+   memory file. Headless, they're only mapped. */
+static void frame_resize_buffers(struct wlterm_frame *f) {
+    frame_release_buffers(f);
+
+    int stride = f->buffer_width * 4;
+    size_t size = (size_t)stride * f->buffer_height;
+    f->shm_size = 2 * size;
+    int fd = wlterm_shm_file(f->shm_size);
+    if (fd >= 0)
+        f->shm_data = mmap(NULL, f->shm_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (fd < 0 || f->shm_data == MAP_FAILED) {
+        fprintf(stderr, "wlterm: can't allocate %zu bytes of buffers\n", f->shm_size);
+        exit(1);
+    }
 
-    /* Set projection to offset content to window location. */
-    glm_ortho(-w->x, w->width + (w->frame->width - w->width - w->x),
-              w->height + (w->frame->height - w->height - w->x), -w->y,
-              -1.0, 1.0, w->projection);
+    struct wl_shm_pool *pool = NULL;
+    if (f->surface)
+        pool = wl_shm_create_pool(f->application->shm, fd, f->shm_size);
+    for (int i = 0; i < 2; ++i) {
+        struct wlterm_shm_buffer *b = &f->buffers[i];
+        b->data = (uint32_t *)((char *)f->shm_data + i * size);
+        if (!pool)
+            continue;
+        b->buffer = wl_shm_pool_create_buffer(pool, i * size, f->buffer_width,
+                                              f->buffer_height, stride,
+                                              WL_SHM_FORMAT_XRGB8888);
+        wl_buffer_add_listener(b->buffer, &buffer_listener, b);
+    }
+    if (pool)
+        wl_shm_pool_destroy(pool);
+    close(fd);
+    f->back = 0;
+}
 
-    /* int modeline_h = msdfgl_vertical_advance(active_font, font_size); */
-    vec3 _color;
-    parse_color("0c1014", _color);
-    glClearColor(_color[0], _color[1], _color[2], 1.0);
-    glClear(GL_COLOR_BUFFER_BIT);
+void wlterm_frame_resize(struct wlterm_frame *f, int width, int height) {
 
-    /* Modeline */
-    /* draw_rect(0, w->height - modeline_h, w->width, modeline_h, "0a3749", w); */
-    float line_height = msdfgl_vertical_advance(active_font, font_size);
+    f->width = width;
+    f->height = height;
+    f->buffer_width = lround(width * f->scale);
+    f->buffer_height = lround(height * f->scale);
+    if (f->software) {
+        frame_resize_buffers(f);
+    } else if (f->gl_window) {
+        wl_egl_window_resize(f->gl_window, f->buffer_width, f->buffer_height, 0, 0);
+    } else {
+        eglMakeCurrent(f->application->gl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                       f->gl_context);
+        glBindRenderbuffer(GL_RENDERBUFFER, f->fbo_color);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, f->buffer_width, f->buffer_height);
+    }
+    if (f->viewport)
+        wp_viewport_set_destination(f->viewport, width, height);
+    glm_ortho(0.0, f->width, f->height, 0.0, -1.0, 1.0, f->projection);
 
+    /* New buffers, nothing in them yet. */
+    f->buffer_age = 0;
+    wlterm_frame_layout(f);
+    FOR_EACH_WINDOW (f, w)
+        wlterm_window_damage_all(w);
+}
 
+/* Draw at `scale` buffer pixels per surface coordinate from now on. Only the
+   buffers change: layout is in surface coordinates and glyphs are distance
+   fields, no glyph is generated again. */
+void wlterm_frame_set_scale(struct wlterm_frame *f, double scale) {
+    if (scale <= 0.0 || scale == f->scale)
+        return;
 
-    float x = 0.0;
-    float y = line_height  - 4.0;
-    x = msdfgl_printf(x, y, active_font, font_size, 0x98d1ceff,
-                      (GLfloat *)w->projection, MSDFGL_KERNING | MSDFGL_UTF8,
-                      "╭─");
+    uint64_t start = timestamp_us();
+    f->scale = scale;
 
-    x = msdfgl_printf(x, y, active_font, font_size, 0x26a98bff,
-                      (GLfloat *)w->projection, MSDFGL_KERNING | MSDFGL_UTF8,
-                      "hnyman@xps13");
+    /* With a viewport the buffer is mapped onto the surface size whatever its
+       scale, the buffer scale is for integer scales alone. */
+    if (f->surface && !f->viewport)
+        wl_surface_set_buffer_scale(f->surface, (int32_t)scale);
+    wlterm_frame_resize(f, f->width, f->height);
 
-    x = msdfgl_printf(x, y, active_font, font_size, 0x093748ff,
-                      (GLfloat *)w->projection, MSDFGL_KERNING | MSDFGL_UTF8,
-                      " ~/projects/github/wayland-terminal");
+    f->scale_changes++;
+    f->scale_change_time += timestamp_us() - start;
+}
 
-    x = msdfgl_printf(x, y, active_font, font_size, 0xedb54bff,
-                      (GLfloat *)w->projection, MSDFGL_KERNING | MSDFGL_UTF8,
-                      "  ‹opengl*›");
+static void window_place(struct wlterm_window *w, struct wlterm_rect rect) {
+    if (w->x == rect.x && w->y == rect.y && w->width == rect.width &&
+        w->height == rect.height)
+        return;
 
-    y += line_height;
+    w->x = rect.x;
+    w->y = rect.y;
+    w->width = rect.width;
+    w->height = rect.height;
+    window_resize_grid(w);
+    wlterm_window_damage_all(w);
+}
 
+/* Fit the windows to the frame's layout. Only windows that moved or changed
+   size get damaged. */
+void wlterm_frame_layout(struct wlterm_frame *f) {
+    if (f->layout)
+        wlterm_layout_apply(f->layout, (struct wlterm_rect){0, 0, f->width, f->height},
+                            window_place);
+}
 
-    msdfgl_printf(0.0, y, active_font, font_size, 0x98d1ceff,
-                  (GLfloat *)w->projection, MSDFGL_KERNING | MSDFGL_UTF8,
-                  "╰─$ ./build/wlterm");
+/* Create a window with a terminal of its own, at the end of the frame's
+   windows. It is up to the caller to give it a place in the layout. */
+struct wlterm_window *wlterm_window_create(struct wlterm_frame *f) {
+    struct wlterm_application *app = f->application;
+    struct wlterm_window *w = calloc(1, sizeof(struct wlterm_window));
+    if (!w) return NULL;
+
+    w->frame = f;
+    w->width = f->width;
+    w->height = f->height;
+    /* Without GL, FreeType draws any glyph right away. */
+    w->text.glyph_worker = f->software ? NULL : app->glyph_worker;
+    wlterm_run_cache_init(&w->runs, WLTERM_RUN_CACHE_SIZE);
+    w->grid = wlterm_grid_create(1, 1);
+    w->scrollback = wlterm_scrollback_create(WLTERM_SCROLLBACK_LINES);
+    w->grid->scrollback = w->scrollback;
+    window_resize_grid(w);
+    w->vt = wlterm_vt_create(w->grid);
+    w->vt->reply = window_handle_vt_reply;
+    w->vt->reply_data = w;
+
+    /* Headless windows have no shell, whatever drives them feeds the VT. */
+    if (app->backend == WLTERM_BACKEND_WAYLAND)
+        w->pty = wlterm_pty_create(NULL, w->grid->rows, w->grid->cols);
+
+    struct wlterm_window **wp = &f->root_window;
+    while (*wp)
+        wp = &(*wp)->next;
+    *wp = w;
+    return w;
+}
 
+void wlterm_window_destroy(struct wlterm_window *w) {
+    struct wlterm_frame *f = w->frame;
+
+    struct wlterm_window **wp = &f->root_window;
+    while (*wp != w)
+        wp = &(*wp)->next;
+    *wp = w->next;
+    if (f->active_window == w)
+        f->active_window = f->root_window;
+
+    if (w->layout)
+        wlterm_layout_remove(&f->layout, w->layout);
+
+    if (w->pty)
+        wlterm_pty_destroy(w->pty);
+    wlterm_vt_destroy(w->vt);
+    w->grid->scrollback = NULL;
+    wlterm_scrollback_destroy(w->scrollback);
+    wlterm_grid_destroy(w->grid);
+    wlterm_document_close(w->document);
+    wlterm_text_batch_release(&w->text);
+    wlterm_run_cache_release(&w->runs);
+    free(w->row_keys);
+    if (w->ring.fbo) {
+        eglMakeCurrent(f->application->gl_display, f->gl_surface, f->gl_surface,
+                       f->gl_context);
+        glDeleteFramebuffers(1, &w->ring.fbo);
+        glDeleteTextures(1, &w->ring.texture);
+    }
+    free(w->ring.lines);
+    free(w->ring.drawn);
+    if (w->cells.texture) {
+        eglMakeCurrent(f->application->gl_display, f->gl_surface, f->gl_surface,
+                       f->gl_context);
+        glDeleteTextures(1, &w->cells.texture);
+    }
+    free(w->cells.cells);
+    free(w->cells.changed);
+    free(w->cells.stale);
+    if (f->application->kinetic_window == w)
+        f->application->kinetic_window = NULL;
+    if (f->application->paste_window == w)
+        f->application->paste_window = NULL;
+    free(w->bg.vertices);
+    free(w->bg.colors);
+    free(w);
+
+    /* The neighbours take over the space. */
+    if (f->open)
+        wlterm_frame_layout(f);
 }
 
-void wlterm_frame_render(struct wlterm_frame *f) {
+/* Split the window in two, the new window going to the right of it or below
+   it. */
+struct wlterm_window *wlterm_window_split(struct wlterm_window *w, enum wlterm_split split) {
+    struct wlterm_frame *f = w->frame;
+    struct wlterm_window *added = wlterm_window_create(f);
+    if (!added)
+        return w;
+
+    added->layout = wlterm_layout_split(&f->layout, w->layout, split, added);
+    wlterm_frame_layout(f);
+    return added;
+}
 
-    eglMakeCurrent(f->application->gl_display, f->gl_surface, f->gl_surface, f->gl_context);
-    /* eglSwapInterval(app->gl_display, 0); */
+/* Grow the window by `delta` pixels, shrinking its neighbour across the
+   closest `split` edge. */
+void wlterm_window_resize_split(struct wlterm_window *w, enum wlterm_split split,
+                                int delta) {
+    if (wlterm_layout_resize(w->layout, split, delta))
+        wlterm_frame_layout(w->frame);
+}
 
-    glViewport(0, 0, f->width * f->scale, f->height * f->scale);
-    glEnable(GL_BLEND);
-    /* glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); */
-    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+void wlterm_window_damage(struct wlterm_window *w, int x, int y, int width, int height) {
 
-    /* set_region(f, 0, f->height - f->minibuffer_height, f->width, f->minibuffer_height); */
-    set_region(f, 0, f->height, f->width, 0);
-    vec3 _color;
-    parse_color("0c1014", _color);
-    glClearColor(_color[0], _color[1], _color[2], 1.0);
-    glClear(GL_COLOR_BUFFER_BIT);
+    if (width <= 0 || height <= 0)
+        return;
 
-    FOR_EACH_WINDOW (f, w) {
-        window_render(w);
+    if (w->dirty) {
+        /* Grow the existing damage to cover the new area. */
+        int x2 = max(w->damage.x + w->damage.width, x + width);
+        int y2 = max(w->damage.y + w->damage.height, y + height);
+        w->damage.x = min(w->damage.x, x);
+        w->damage.y = min(w->damage.y, y);
+        w->damage.width = x2 - w->damage.x;
+        w->damage.height = y2 - w->damage.y;
+    } else {
+        w->damage = (struct wlterm_rect){x, y, width, height};
+        w->dirty = true;
     }
 
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glDisableVertexAttribArray(0);
+    wlterm_frame_schedule(w->frame);
+}
 
-    eglSwapBuffers(f->application->gl_display, f->gl_surface);
+void wlterm_window_damage_all(struct wlterm_window *w) {
+    wlterm_window_damage(w, 0, 0, w->width, w->height);
 }
 
-struct wlterm_application *wlterm_application_create() {
-    struct wlterm_application *app = malloc(sizeof (struct wlterm_application));
-    if (!app) return NULL;
+/* Scroll the view `lines` into the scrollback, negative towards the bottom.
+   A viewed document scrolls towards its start instead. */
+void wlterm_window_scroll(struct wlterm_window *w, int lines) {
+    if (w->document) {
+        /* Only as far as the document has been indexed. */
+        long top = (long)w->document_top - lines;
+        long last = (long)wlterm_document_lines(w->document) - w->grid->rows;
+
+        top = top > last ? last : top;
+        top = top < 0 ? 0 : top;
+        if ((size_t)top == w->document_top)
+            return;
+        w->document_top = top;
+        wlterm_window_damage_all(w);
+        return;
+    }
 
-    app->display = wl_display_connect(NULL);
+    long offset = (long)w->scroll_offset + lines;
+    long max = w->scrollback ? w->scrollback->n_lines : 0;
 
-    app->registry = wl_display_get_registry(app->display);
-    wl_registry_add_listener(app->registry, &registry_listener, app);
+    offset = offset < 0 ? 0 : offset > max ? max : offset;
+    if (offset == w->scroll_offset && !w->scroll_fraction)
+        return;
+    w->scroll_offset = offset;
+    w->scroll_fraction = 0.0;
+    wlterm_window_damage_all(w);
+}
 
-    wl_display_roundtrip(app->display);
+/* Scroll back by `pixels`, forward if negative. Returns false if that went
+   nowhere. Documents scroll by whole lines, the rest is carried over in
+   `scroll_fraction`. */
+bool wlterm_window_scroll_pixels(struct wlterm_window *w, double pixels) {
+    double height = w->cell_height;
+
+    if (w->document) {
+        size_t top = w->document_top;
+        w->scroll_fraction += pixels;
+        int lines = w->scroll_fraction / height;
+        w->scroll_fraction -= lines * height;
+        wlterm_window_scroll(w, lines);
+        return w->document_top != top;
+    }
 
-    app->root_frame = NULL;
+    double max = (w->scrollback ? w->scrollback->n_lines : 0) * height;
+    double position = w->scroll_offset * height + w->scroll_fraction + pixels;
+    position = position < 0.0 ? 0.0 : position > max ? max : position;
+
+    int offset = position / height;
+    float fraction = position - offset * height;
+    if (fraction < 0.01)
+        fraction = 0.0;
+    if (offset == w->scroll_offset && fraction == w->scroll_fraction)
+        return false;
+
+    w->scroll_offset = offset;
+    w->scroll_fraction = fraction;
+    wlterm_window_damage_all(w);
+    return true;
+}
+
+/* Show `d` in the window in place of its terminal, which is closed. The
+   window takes ownership of the document. */
+void wlterm_window_view_document(struct wlterm_window *w, struct wlterm_document *d) {
+    if (w->pty)
+        wlterm_pty_destroy(w->pty);
+    w->pty = NULL;
+    wlterm_document_close(w->document);
+    w->document = d;
+    w->document_top = 0;
+    wlterm_window_damage_all(w);
+}
+
+void wlterm_frame_schedule(struct wlterm_frame *f) {
+    /* The actual rendering happens either in the pending frame callback, or
+       after the current batch of events has been dispatched. */
+    f->dirty = true;
+}
+
+
+
+void wlterm_text_batch_begin(struct wlterm_text_batch *b, msdfgl_font_t font, float size) {
+
+    if (b->font != font || b->size != size) {
+        /* The font is monospaced, so a single advance positions every glyph
+           and no per-run shaping is needed. */
+        float x = 0.0, y = 0.0;
+        msdfgl_geometry(&x, &y, font, size, 0, "M");
+        b->advance = x;
+        b->font = font;
+        b->size = size;
+    }
+    b->n_glyphs = 0;
+    b->missing = false;
+}
+
+static inline void text_batch_push(struct wlterm_text_batch *b, float x, float y,
+                                   uint32_t color, int32_t codepoint) {
+    if (b->n_glyphs == b->capacity) {
+        b->capacity = b->capacity ? b->capacity * 2 : 1024;
+        b->glyphs = realloc(b->glyphs, b->capacity * sizeof(msdfgl_glyph_t));
+    }
+
+    msdfgl_glyph_t *g = &b->glyphs[b->n_glyphs++];
+    g->x = x;
+    g->y = y;
+    g->color = color;
+    g->key = codepoint;
+    g->size = b->size;
+    g->offset = 0.0;
+    g->skew = 0.0;
+    g->strength = 0.5;
+}
+
+void wlterm_text_batch_add_glyph(struct wlterm_text_batch *b, float x, float y,
+                                 uint32_t color, int32_t codepoint) {
+
+    if (b->glyph_worker && !wlterm_glyph_ready(b->glyph_worker, codepoint)) {
+        if (b->n_requests == b->requests_capacity) {
+            b->requests_capacity = b->requests_capacity ? b->requests_capacity * 2 : 64;
+            b->requests = realloc(b->requests, b->requests_capacity * sizeof(int32_t));
+        }
+        b->requests[b->n_requests++] = codepoint;
+        codepoint = WLTERM_PLACEHOLDER_GLYPH;
+        b->missing = true;
+        b->misses++;
+    }
+
+    text_batch_push(b, x, y, color, codepoint);
+}
+
+float wlterm_text_batch_add_run(struct wlterm_text_batch *b, float x, float y,
+                                uint32_t color, const char *text) {
+
+    while (*text) {
+        int32_t codepoint;
+        text += utf8_decode(text, &codepoint);
+        wlterm_text_batch_add_glyph(b, x, y, color, codepoint);
+        x += b->advance;
+    }
+    return x;
+}
+
+/* One draw call per atlas page. Pages may have been evicted since the batch
+   was prepared, glyphs that went with them are drawn as placeholders. So
+   are those of the page a glyph is being generated into, rather than wait
+   for it; the window is drawn again once the glyph is in. Needs the glyph
+   worker's lock. */
+static void text_batch_render_pages(struct wlterm_text_batch *b, GLfloat *projection) {
+    struct wlterm_glyph_worker *gw = b->glyph_worker;
+    int start[WLTERM_ATLAS_MAX_PAGES + 1] = {0};
+    bool busy[WLTERM_ATLAS_MAX_PAGES] = {false};
+
+    for (int p = 1; p < gw->n_pages; ++p)
+        busy[p] = pthread_mutex_trylock(&gw->pages[p].lock) != 0;
+
+    for (int i = 0; i < b->n_glyphs; ++i) {
+        msdfgl_glyph_t *g = &b->glyphs[i];
+        if (!wlterm_glyph_ready(gw, g->key)) {
+            wlterm_glyph_request(gw, g->key);
+            g->key = WLTERM_PLACEHOLDER_GLYPH;
+            b->missing = true;
+            b->misses++;
+        } else if (busy[gw->page[g->key]]) {
+            g->key = WLTERM_PLACEHOLDER_GLYPH;
+            b->missing = true;
+        }
+        start[gw->page[g->key] + 1]++;
+    }
+    for (int p = 0; p < gw->n_pages; ++p)
+        start[p + 1] += start[p];
+
+    if (b->by_page_capacity < b->n_glyphs) {
+        b->by_page_capacity = b->capacity;
+        b->by_page = realloc(b->by_page, b->by_page_capacity * sizeof(msdfgl_glyph_t));
+    }
+    int next[WLTERM_ATLAS_MAX_PAGES];
+    memcpy(next, start, sizeof(next));
+    for (int i = 0; i < b->n_glyphs; ++i)
+        b->by_page[next[gw->page[b->glyphs[i].key]]++] = b->glyphs[i];
+
+    for (int p = 0; p < gw->n_pages; ++p) {
+        int n = start[p + 1] - start[p];
+        if (!n)
+            continue;
+        msdfgl_render(gw->pages[p].font, b->by_page + start[p], n, projection);
+        gw->pages[p].last_used = gw->frame;
+        b->draw_calls++;
+    }
+
+    for (int p = 1; p < gw->n_pages; ++p)
+        if (!busy[p])
+            pthread_mutex_unlock(&gw->pages[p].lock);
+}
+
+/* Draw the batch and request its missing glyphs. Main thread only. */
+void wlterm_text_batch_flush(struct wlterm_text_batch *b, GLfloat *projection) {
+
+    for (int i = 0; i < b->n_requests; ++i)
+        wlterm_glyph_request(b->glyph_worker, b->requests[i]);
+    b->n_requests = 0;
+
+    if (!b->n_glyphs)
+        return;
+
+    struct wlterm_glyph_worker *gw = b->glyph_worker;
+    if (!gw || gw->n_pages == 1) {
+        msdfgl_render(b->font, b->glyphs, b->n_glyphs, projection);
+        b->draw_calls++;
+    } else {
+        text_batch_render_pages(b, projection);
+    }
+
+    b->glyphs_drawn += b->n_glyphs;
+    b->n_glyphs = 0;
+}
+
+void wlterm_text_batch_release(struct wlterm_text_batch *b) {
+    free(b->glyphs);
+    free(b->by_page);
+    free(b->requests);
+    memset(b, 0, sizeof(struct wlterm_text_batch));
+}
+
+/* Rectangles are 2D positions at attribute 0 and colors at attribute 1, see
+   bg-vertex.glsl. The colors follow the positions in the same buffer, so their
+   offset is set at each flush. Needs the frame's context current. */
+static void frame_init_bg(struct wlterm_frame *f) {
+    glGenVertexArrays(1, &f->bg_vao);
+    glGenBuffers(1, &f->bg_vbo);
+    glBindVertexArray(f->bg_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, f->bg_vbo);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
+}
+
+/* Row quads are 2D positions and texture coordinates in one vec4 at
+   attribute 0, see rows-vertex.glsl. */
+static void frame_init_rows(struct wlterm_frame *f) {
+    glGenVertexArrays(1, &f->rows_vao);
+    glGenBuffers(1, &f->rows_vbo);
+    glBindVertexArray(f->rows_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, f->rows_vbo);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, 0);
+    glBindVertexArray(0);
+}
+
+static void bg_batch_add(struct wlterm_bg_batch *b, float x0, float y0, float x1, float y1,
+                         uint32_t color) {
+    if (b->n_runs == b->capacity) {
+        b->capacity = b->capacity ? b->capacity * 2 : 64;
+        b->vertices = realloc(b->vertices, b->capacity * 12 * sizeof(GLfloat));
+        b->colors = realloc(b->colors, b->capacity * 6 * sizeof(uint32_t));
+    }
+
+    GLfloat *v = &b->vertices[b->n_runs * 12];
+    GLfloat quad[12] = {x0, y0, x1, y0, x0, y1, x1, y0, x1, y1, x0, y1};
+    memcpy(v, quad, sizeof(quad));
+    uint32_t *c = &b->colors[b->n_runs++ * 6];
+    for (int i = 0; i < 6; ++i)
+        c[i] = color;
+}
+
+/* Add the runs of a row whose background isn't the default. */
+static void bg_batch_add_row(struct wlterm_bg_batch *b, const uint32_t *fg,
+                             const uint32_t *bg, const uint8_t *attrs, int cols,
+                             float advance, float y0, float y1) {
+    int start = 0;
+    uint32_t run = WLTERM_DEFAULT_BG;
+
+    for (int col = 0; col <= cols; ++col) {
+        uint32_t color = WLTERM_DEFAULT_BG;
+        if (col < cols)
+            color = attrs[col] & WLTERM_ATTR_REVERSE ? fg[col] : bg[col];
+        if (color == run)
+            continue;
+        if (run != WLTERM_DEFAULT_BG)
+            bg_batch_add(b, start * advance, y0, col * advance, y1, run);
+        start = col;
+        run = color;
+    }
+}
+
+/* One upload and one draw: the positions, then a color for every vertex. */
+static void bg_batch_flush(struct wlterm_bg_batch *b, struct wlterm_frame *f,
+                           GLfloat *projection) {
+    if (!b->n_runs)
+        return;
+
+    GLuint program = f->application->bg_program;
+    glUseProgram(program);
+    glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE,
+                       projection);
+
+    size_t positions = b->n_runs * 12 * sizeof(GLfloat);
+    size_t colors = b->n_runs * 6 * sizeof(uint32_t);
+    glBindVertexArray(f->bg_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, f->bg_vbo);
+    glBufferData(GL_ARRAY_BUFFER, positions + colors, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, positions, b->vertices);
+    glBufferSubData(GL_ARRAY_BUFFER, positions, colors, b->colors);
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, (void *)positions);
+
+    glDrawArrays(GL_TRIANGLES, 0, b->n_runs * 6);
+    glBindVertexArray(0);
+    b->n_runs = 0;
+}
+
+/* Add a line of a document, straight from the file's bytes. Tabs go to the
+   next multiple of 8 columns, other control characters are left blank. */
+static void text_batch_add_line(struct wlterm_text_batch *b, float y, const char *s,
+                                size_t len, int cols) {
+    size_t i = 0;
+
+    for (int col = 0; col < cols && i < len; ++col) {
+        int32_t codepoint;
+        const char *p = s + i;
+
+        /* utf8_decode may look up to 3 bytes ahead, which could be past the
+           end of the mapping. */
+        char tail[4] = {0};
+        if (len - i < 4) {
+            memcpy(tail, p, len - i);
+            p = tail;
+        }
+        i += utf8_decode(p, &codepoint);
+
+        if (codepoint == '\t')
+            col |= 7;
+        else if (codepoint > ' ' && codepoint != 0x7f)
+            wlterm_text_batch_add_glyph(b, col * b->advance, y, WLTERM_DEFAULT_FG,
+                                        codepoint);
+    }
+}
+
+static inline void set_region(struct wlterm_frame *f, int x, int y, int w, int h) {
+    /* glScissor wants the botton-left corner of the area, the origin being in
+     the bottom-left corner of the frame. */
+
+    glScissor(max(0, x) * f->scale, max(0, f->height - y - h) * f->scale,
+              max(0, w) * f->scale, max(0, h) * f->scale);
+}
+
+/* Collect the glyphs and backgrounds of a window, after
+   wlterm_text_batch_begin(). Touches nothing but the window, so windows are
+   prepared in parallel on the render pool. */
+/* Hash of everything a row's layout depends on, four lanes so the cells
+   don't make one long dependency chain. */
+static uint64_t row_key(const struct wlterm_text_batch *b, const uint32_t *codepoints,
+                        const uint32_t *fg, const uint32_t *bg, const uint8_t *attrs,
+                        int cols) {
+    const uint64_t prime = 0x100000001b3ull;
+    uint64_t h0 = 0xcbf29ce484222325ull, h1 = h0 ^ 1, h2 = h0 ^ 2, h3 = h0 ^ 3;
+    uint32_t size;
+
+    memcpy(&size, &b->size, sizeof(size));
+    for (int col = 0; col < cols; ++col) {
+        h0 = (h0 ^ codepoints[col]) * prime;
+        h1 = (h1 ^ fg[col]) * prime;
+        h2 = (h2 ^ bg[col]) * prime;
+        h3 = (h3 ^ attrs[col]) * prime;
+    }
+
+    uint64_t h = h0 ^ (h1 << 17 | h1 >> 47) ^ (h2 << 31 | h2 >> 33) ^ (h3 << 47 | h3 >> 17);
+    h ^= (uintptr_t)b->font ^ (uint64_t)size << 32 ^ (uint64_t)cols;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+/* Keep the row just laid out, starting at glyph `glyphs` and background run
+   `runs` of the batches. */
+static void window_cache_row(struct wlterm_window *w, uint64_t key, int glyphs, int runs) {
+    struct wlterm_text_batch *b = &w->text;
+    struct wlterm_run *r = wlterm_run_cache_put(&w->runs, key, b->n_glyphs - glyphs,
+                                                w->bg.n_runs - runs);
+    if (!r)
+        return;
+
+    for (int i = 0; i < r->n_glyphs; ++i) {
+        const msdfgl_glyph_t *g = &b->glyphs[glyphs + i];
+        r->glyphs[i] = (struct wlterm_shaped_glyph){g->x, g->color, g->key};
+    }
+
+    struct wlterm_shaped_bg *bg = wlterm_run_bg(r);
+    for (int i = 0; i < r->n_bg; ++i) {
+        const GLfloat *v = &w->bg.vertices[(runs + i) * 12];
+        bg[i] = (struct wlterm_shaped_bg){v[0], v[2], w->bg.colors[(runs + i) * 6]};
+    }
+}
+
+static void window_emit_row(struct wlterm_window *w, struct wlterm_run *r, float y,
+                            float y0, float y1) {
+    for (int i = 0; i < r->n_glyphs; ++i)
+        text_batch_push(&w->text, r->glyphs[i].x, y, r->glyphs[i].color,
+                        r->glyphs[i].codepoint);
+
+    struct wlterm_shaped_bg *bg = wlterm_run_bg(r);
+    for (int i = 0; i < r->n_bg; ++i)
+        bg_batch_add(&w->bg, bg[i].x0, y0, bg[i].x1, y1, bg[i].color);
+}
+
+/* The cells of row `row` scrolled back by `offset` lines, row -1 being the
+   line above the top. Returns the number of columns. */
+static int window_row_cells(struct wlterm_window *w, int row, int offset,
+                            const uint32_t **codepoints, const uint32_t **fg,
+                            const uint32_t **bg, const uint8_t **attrs) {
+    struct wlterm_grid *g = w->grid;
+
+    if (row < offset) {
+        struct wlterm_scrollback_line l;
+        if (!wlterm_scrollback_line(w->scrollback, offset - 1 - row, &l))
+            l.cols = 0;
+        *codepoints = l.codepoints;
+        *fg = l.fg;
+        *bg = l.bg;
+        *attrs = l.attrs;
+        return l.cols < g->cols ? l.cols : g->cols;
+    }
+
+    size_t o = wlterm_grid_row(g, row - offset);
+    *codepoints = &g->codepoints[o];
+    *fg = &g->fg[o];
+    *bg = &g->bg[o];
+    *attrs = &g->attrs[o];
+    return g->cols;
+}
+
+/* Add a row with its top at `top`, from the run cache if it has the row.
+   Returns false if it drew placeholders. */
+static bool window_add_row(struct wlterm_window *w, uint64_t key, float top,
+                           const uint32_t *codepoints, const uint32_t *fg,
+                           const uint32_t *bg, const uint8_t *attrs, int cols) {
+    struct wlterm_text_batch *b = &w->text;
+    float line_height = w->cell_height;
+    float y = top + line_height - 4.0;
+
+    struct wlterm_run *run = wlterm_run_cache_get(&w->runs, key);
+    if (run) {
+        window_emit_row(w, run, y, top, top + line_height);
+        return true;
+    }
+
+    int glyphs = b->n_glyphs, runs = w->bg.n_runs;
+    uint64_t misses = b->misses;
+
+    bg_batch_add_row(&w->bg, fg, bg, attrs, cols, b->advance, top, top + line_height);
+
+    for (int col = 0; col < cols; ++col) {
+        if (codepoints[col] == ' ')
+            continue;
+        uint32_t color = attrs[col] & WLTERM_ATTR_REVERSE ? bg[col] : fg[col];
+        wlterm_text_batch_add_glyph(b, col * b->advance, y, color, codepoints[col]);
+    }
+
+    /* Rows with placeholders are laid out again once their glyphs are
+       ready. */
+    if (b->misses != misses)
+        return false;
+    window_cache_row(w, key, glyphs, runs);
+    return true;
+}
+
+/* Scrolled back: only the rows the ring doesn't have yet, each into its
+   slot. */
+static void window_prepare_ring(struct wlterm_window *w) {
+    struct wlterm_row_ring *r = &w->ring;
+    struct wlterm_grid *g = w->grid;
+    int n_slots = g->rows + 2;
+    int slot_height = ceilf(w->cell_height);
+
+    if (!r->valid || r->n_slots != n_slots || r->slot_height != slot_height ||
+        r->width != w->width || r->scale != w->frame->scale || r->font != w->text.font) {
+        if (r->n_slots != n_slots) {
+            r->lines = realloc(r->lines, n_slots * sizeof(uint64_t));
+            r->drawn = realloc(r->drawn, n_slots * sizeof(int));
+        }
+        for (int i = 0; i < n_slots; ++i)
+            r->lines[i] = UINT64_MAX;
+        r->n_slots = n_slots;
+        r->slot_height = slot_height;
+        r->width = w->width;
+        r->scale = w->frame->scale;
+        r->font = w->text.font;
+        r->valid = true;
+    }
+    r->active = true;
+    r->n_drawn = 0;
+    w->row_keys_valid = false;
+
+    uint64_t first = (w->scrollback ? w->scrollback->n_lines : 0) - w->scroll_offset;
+    for (int row = w->scroll_fraction ? -1 : 0; row < g->rows; ++row) {
+        uint64_t line = first + row;
+        int slot = line % n_slots;
+        if (r->lines[slot] == line)
+            continue;
+
+        const uint32_t *codepoints, *fg, *bg;
+        const uint8_t *attrs;
+        int cols = window_row_cells(w, row, w->scroll_offset, &codepoints, &fg, &bg,
+                                    &attrs);
+        uint64_t key = row_key(&w->text, codepoints, fg, bg, attrs, cols);
+        bool complete = window_add_row(w, key, slot * slot_height, codepoints, fg, bg,
+                                       attrs, cols);
+        r->lines[slot] = complete ? line : UINT64_MAX;
+        r->drawn[r->n_drawn++] = slot;
+    }
+}
+
+/* Pack row `row` of the grid for the cell texture, reverse video already
+   applied. The codepoints become sprites when the row is uploaded. */
+static void cells_pack_row(struct wlterm_window *w, int row) {
+    struct wlterm_grid *g = w->grid;
+    uint32_t *cell = &w->cells.cells[(size_t)row * g->cols * 4];
+    size_t o = wlterm_grid_row(g, row);
+
+    for (int col = 0; col < g->cols; ++col, cell += 4) {
+        bool reverse = g->attrs[o + col] & WLTERM_ATTR_REVERSE;
+        cell[0] = g->codepoints[o + col];
+        cell[1] = reverse ? g->bg[o + col] : g->fg[o + col];
+        cell[2] = reverse ? g->fg[o + col] : g->bg[o + col];
+        cell[3] = g->attrs[o + col];
+    }
+}
+
+/* Cell render mode: only the rows that changed, or drew placeholders last
+   time, are packed for upload. */
+static void window_prepare_cells(struct wlterm_window *w) {
+    struct wlterm_cell_grid *c = &w->cells;
+    struct wlterm_grid *g = w->grid;
+    struct wlterm_sprites *s = w->frame->sprites;
+
+    if (c->rows != g->rows || c->cols != g->cols) {
+        c->cells = realloc(c->cells, (size_t)g->rows * g->cols * 4 * sizeof(uint32_t));
+        c->changed = realloc(c->changed, g->rows * sizeof(int));
+        c->stale = realloc(c->stale, g->rows);
+        c->rows = g->rows;
+        c->cols = g->cols;
+        c->valid = false;
+    }
+    bool all = !c->valid || !s || c->generation != s->generation;
+
+    c->n_changed = 0;
+    for (int row = 0; row < g->rows; ++row) {
+        if (all || g->dirty[row] || c->stale[row]) {
+            cells_pack_row(w, row);
+            c->changed[c->n_changed++] = row;
+        }
+        g->dirty[row] = 0;
+    }
+    w->row_keys_valid = false;
+}
+
+static void window_prepare(void *data) {
+    struct wlterm_window *w = data;
+    float line_height = w->cell_height;
+
+    struct wlterm_text_batch *b = &w->text;
+    struct wlterm_grid *g = w->grid;
+
+    /* Scrolled back, the top `scroll_offset` rows come from the scrollback
+       and the grid is pushed down. */
+    int offset = w->scroll_offset;
+
+    float y = line_height  - 4.0;
+
+    /* The cell texture only follows the live grid. */
+    w->cells.active = !w->document && !offset && !w->scroll_fraction &&
+        !w->frame->software &&
+        w->frame->application->render_mode == WLTERM_RENDER_CELLS;
+    if (!w->cells.active)
+        w->cells.valid = false;
+
+    if (w->document) {
+        for (int row = 0; row < g->rows; ++row, y += line_height) {
+            const char *line;
+            size_t len;
+            if (!wlterm_document_line(w->document, w->document_top + row, &line, &len))
+                break;
+            text_batch_add_line(b, y, line, len, g->cols);
+        }
+        return;
+    }
+
+    if ((offset || w->scroll_fraction) && !w->frame->software) {
+        window_prepare_ring(w);
+        return;
+    }
+    /* The grid may change at the bottom, start over when scrolling back. */
+    w->ring.active = false;
+    w->ring.valid = false;
+
+    if (w->cells.active) {
+        window_prepare_cells(w);
+        return;
+    }
+
+    /* Keys of rows that haven't changed since the last frame still hold.
+       Only software frames get here scrolled back, the grid pushed down like
+       this their keys don't. */
+    bool keys_valid = !offset && w->row_keys_valid && w->row_keys_rows == g->rows &&
+        w->row_keys_cols == g->cols && w->row_keys_font == b->font &&
+        w->row_keys_size == b->size;
+    if (w->row_keys_rows != g->rows) {
+        w->row_keys = realloc(w->row_keys, g->rows * sizeof(uint64_t));
+        w->row_keys_rows = g->rows;
+    }
+    w->row_keys_cols = g->cols;
+    w->row_keys_font = b->font;
+    w->row_keys_size = b->size;
+    w->row_keys_valid = !offset;
+
+    for (int row = w->scroll_fraction ? -1 : 0; row < g->rows; ++row) {
+        const uint32_t *codepoints, *fg, *bg;
+        const uint8_t *attrs;
+        int cols = window_row_cells(w, row, offset, &codepoints, &fg, &bg, &attrs);
+
+        uint64_t key = row >= 0 && keys_valid && !g->dirty[row] ? w->row_keys[row] :
+            row_key(b, codepoints, fg, bg, attrs, cols);
+        if (row >= 0) {
+            w->row_keys[row] = key;
+            g->dirty[row] = 0;
+        }
+
+        window_add_row(w, key, row * line_height + w->scroll_fraction, codepoints, fg,
+                       bg, attrs, cols);
+    }
+}
+
+/* Draw the rows window_prepare_ring() collected into their slots. */
+static void ring_draw_slots(struct wlterm_window *w) {
+    struct wlterm_row_ring *r = &w->ring;
+    float scale = w->frame->scale;
+    int width = lround(r->width * scale);
+    int slot_height = lround(r->slot_height * scale);
+    int height = r->n_slots * slot_height;
+
+    if (!r->fbo) {
+        glGenFramebuffers(1, &r->fbo);
+        glGenTextures(1, &r->texture);
+    }
+    if (r->texture_width != width || r->texture_height != height) {
+        glBindTexture(GL_TEXTURE_2D, r->texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindFramebuffer(GL_FRAMEBUFFER, r->fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                               r->texture, 0);
+        r->texture_width = width;
+        r->texture_height = height;
+    }
+    if (!r->n_drawn)
+        return;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, r->fbo);
+    glViewport(0, 0, width, height);
+
+    vec3 _color;
+    parse_color("0c1014", _color);
+    glClearColor(_color[0], _color[1], _color[2], 1.0);
+    for (int i = 0; i < r->n_drawn; ++i) {
+        glScissor(0, height - (r->drawn[i] + 1) * slot_height, width, slot_height);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+    glScissor(0, 0, width, height);
+
+    /* Slot 0 at the top, like rows in a window. */
+    mat4 projection;
+    glm_ortho(0.0, r->width, r->n_slots * r->slot_height, 0.0, -1.0, 1.0, projection);
+    bg_batch_flush(&w->bg, w->frame, (GLfloat *)projection);
+    wlterm_text_batch_flush(&w->text, (GLfloat *)projection);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, w->frame->fbo);
+    glViewport(0, 0, w->frame->buffer_width, w->frame->buffer_height);
+}
+
+/* Copy the visible rows from their slots, in one draw call. Row tops are
+   rounded to whole pixels to keep the glyphs sharp. */
+static void ring_draw_window(struct wlterm_window *w) {
+    struct wlterm_row_ring *r = &w->ring;
+    struct wlterm_frame *f = w->frame;
+    struct wlterm_grid *g = w->grid;
+    int first = w->scroll_fraction ? -1 : 0;
+    GLfloat vertices[(g->rows + 1) * 24];
+    int n = 0;
+
+    uint64_t line = (w->scrollback ? w->scrollback->n_lines : 0) - w->scroll_offset;
+    for (int row = first; row < g->rows; ++row) {
+        int slot = (line + row) % r->n_slots;
+        float y0 = roundf(row * w->cell_height + w->scroll_fraction);
+        float y1 = y0 + r->slot_height;
+        float t0 = 1.0 - (float)slot / r->n_slots;
+        float t1 = 1.0 - (float)(slot + 1) / r->n_slots;
+        GLfloat quad[24] = {
+            0.0, y0, 0.0, t0,  r->width, y0, 1.0, t0,  0.0, y1, 0.0, t1,
+            r->width, y0, 1.0, t0,  r->width, y1, 1.0, t1,  0.0, y1, 0.0, t1,
+        };
+        memcpy(&vertices[n * 24], quad, sizeof(quad));
+        n++;
+    }
+
+    GLuint program = f->application->rows_program;
+    glUseProgram(program);
+    glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE,
+                       (GLfloat *)w->projection);
+    glUniform1i(glGetUniformLocation(program, "rows"), 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, r->texture);
+
+    glBindVertexArray(f->rows_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, f->rows_vbo);
+    glBufferData(GL_ARRAY_BUFFER, n * 24 * sizeof(GLfloat), vertices, GL_STREAM_DRAW);
+    glDrawArrays(GL_TRIANGLES, 0, n * 6);
+    glBindVertexArray(0);
+}
+
+/* Start the sprites over. Cells referring to the old ones are uploaded
+   again. */
+static void sprites_reset(struct wlterm_sprites *s) {
+    for (int i = 0; i < s->table_size; ++i)
+        s->table[i].codepoint = -1;
+    s->n_sprites = 1;  /* Slot 0 stays blank. */
+    s->n_pending = 0;
+    s->generation++;
+    s->resets++;
+}
+
+/* The frame's sprites, for the window's font at the frame's scale. */
+static struct wlterm_sprites *frame_sprites(struct wlterm_frame *f,
+                                            struct wlterm_window *w) {
+    struct wlterm_sprites *s = f->sprites;
+
+    if (!s) {
+        s = f->sprites = calloc(1, sizeof(struct wlterm_sprites));
+        s->text.glyph_worker = f->application->glyph_worker;
+
+        glGenFramebuffers(1, &s->fbo);
+        glGenTextures(1, &s->texture);
+        glBindTexture(GL_TEXTURE_2D, s->texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, WLTERM_SPRITES_SIZE, WLTERM_SPRITES_SIZE,
+                     0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, s->fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                               s->texture, 0);
+        glScissor(0, 0, WLTERM_SPRITES_SIZE, WLTERM_SPRITES_SIZE);
+        glClearColor(0.0, 0.0, 0.0, 0.0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glBindFramebuffer(GL_FRAMEBUFFER, f->fbo);
+    }
+
+    int slot_width = ceilf(w->text.advance * f->scale);
+    int slot_height = ceilf(w->cell_height * f->scale);
+    if (s->font != w->text.font || s->size != w->text.size || s->scale != f->scale ||
+        s->slot_width != slot_width || s->slot_height != slot_height) {
+        s->font = w->text.font;
+        s->size = w->text.size;
+        s->scale = f->scale;
+        s->slot_width = slot_width;
+        s->slot_height = slot_height;
+        s->per_row = WLTERM_SPRITES_SIZE / slot_width;
+        s->capacity = s->per_row * (WLTERM_SPRITES_SIZE / slot_height);
+
+        int table_size = 64;
+        while (table_size < 2 * s->capacity)
+            table_size *= 2;
+        if (table_size != s->table_size) {
+            s->table = realloc(s->table, table_size * sizeof(struct wlterm_sprite));
+            s->table_size = table_size;
+        }
+        s->pending = realloc(s->pending, s->capacity * sizeof(struct wlterm_sprite));
+        sprites_reset(s);
+    }
+    return s;
+}
+
+/* The sprite of `codepoint`, added if it's new and its glyph is ready, the
+   placeholder's while it isn't. -1 when there's no room left. */
+static int sprites_get(struct wlterm_sprites *s, int32_t codepoint, bool *missing) {
+    if (codepoint <= ' ')
+        return 0;
+
+    uint32_t mask = s->table_size - 1;
+    uint32_t i = (uint32_t)codepoint * 0x9e3779b1u & mask;
+    for (; s->table[i].codepoint != -1; i = (i + 1) & mask)
+        if (s->table[i].codepoint == codepoint)
+            return s->table[i].index;
+
+    struct wlterm_glyph_worker *gw = s->text.glyph_worker;
+    if (!wlterm_glyph_ready(gw, codepoint)) {
+        wlterm_glyph_request(gw, codepoint);
+        *missing = true;
+        if (codepoint == WLTERM_PLACEHOLDER_GLYPH)
+            return 0;
+        return sprites_get(s, WLTERM_PLACEHOLDER_GLYPH, missing);
+    }
+    if (s->n_sprites == s->capacity)
+        return -1;
+
+    struct wlterm_sprite sprite = {codepoint, s->n_sprites++};
+    s->table[i] = sprite;
+    s->pending[s->n_pending++] = sprite;
+    return sprite.index;
+}
+
+/* Whether a glyph is being generated into the atlas page of `codepoint`
+   right now. Needs the glyph worker's lock. */
+static bool glyph_page_busy(struct wlterm_glyph_worker *gw, int32_t codepoint) {
+    struct wlterm_atlas_page *p = &gw->pages[gw->page[codepoint]];
+    if (p == gw->pages)
+        return false;
+    if (pthread_mutex_trylock(&p->lock) != 0)
+        return true;
+    pthread_mutex_unlock(&p->lock);
+    return false;
+}
+
+/* Draw the sprites added since the last frame into their slots. One draw
+   call each, clipped to the slot so wide glyphs don't spill into their
+   neighbours, but a glyph is only ever drawn once. Those in an atlas page
+   that is busy are left for later. Returns whether any were. */
+static bool sprites_draw(struct wlterm_sprites *s, struct wlterm_frame *f,
+                         float cell_height) {
+    if (!s->n_pending)
+        return false;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, s->fbo);
+    glViewport(0, 0, WLTERM_SPRITES_SIZE, WLTERM_SPRITES_SIZE);
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+
+    /* Slot 0 at the top left, in the frame's units. */
+    float size = WLTERM_SPRITES_SIZE / s->scale;
+    mat4 projection;
+    glm_ortho(0.0, size, size, 0.0, -1.0, 1.0, projection);
+
+    wlterm_text_batch_begin(&s->text, s->font, s->size);
+    int deferred = 0;
+    for (int i = 0; i < s->n_pending; ++i) {
+        int x = s->pending[i].index % s->per_row * s->slot_width;
+        int y = s->pending[i].index / s->per_row * s->slot_height;
+        glScissor(x, WLTERM_SPRITES_SIZE - y - s->slot_height, s->slot_width,
+                  s->slot_height);
+        glClear(GL_COLOR_BUFFER_BIT);
+        if (glyph_page_busy(s->text.glyph_worker, s->pending[i].codepoint)) {
+            s->pending[deferred++] = s->pending[i];
+            continue;
+        }
+        text_batch_push(&s->text, x / s->scale, y / s->scale + cell_height - 4.0,
+                        0xffffffff, s->pending[i].codepoint);
+        wlterm_text_batch_flush(&s->text, (GLfloat *)projection);
+    }
+    s->drawn += s->n_pending - deferred;
+    s->n_pending = deferred;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, f->fbo);
+    glViewport(0, 0, f->buffer_width, f->buffer_height);
+    return deferred > 0;
+}
+
+/* Turn the codepoints of the rows window_prepare_cells() packed into
+   sprites, and upload the rows. Needs the glyph worker's lock. */
+static void window_upload_cells(struct wlterm_window *w) {
+    struct wlterm_cell_grid *c = &w->cells;
+    struct wlterm_frame *f = w->frame;
+    struct wlterm_sprites *s = frame_sprites(f, w);
+
+    /* With sprites newer than the texture every row goes up, and once more
+       if the sprites fill up on the way. */
+    for (bool reset = false; ; reset = true) {
+        if (c->generation != s->generation)
+            c->valid = false;
+        if (!c->valid) {
+            c->n_changed = 0;
+            for (int row = 0; row < c->rows; ++row) {
+                cells_pack_row(w, row);
+                c->changed[c->n_changed++] = row;
+            }
+        }
+
+        bool full = false;
+        for (int i = 0; i < c->n_changed; ++i) {
+            int row = c->changed[i];
+            uint32_t *cell = &c->cells[(size_t)row * c->cols * 4];
+            bool missing = false;
+            for (int col = 0; col < c->cols; ++col, cell += 4) {
+                int sprite = sprites_get(s, cell[0], &missing);
+                if (sprite < 0) {
+                    full = missing = true;
+                    sprite = 0;
+                }
+                cell[0] = sprite;
+            }
+            c->stale[row] = missing;
+            w->text.missing |= missing;
+        }
+        if (!full || reset)
+            break;
+        sprites_reset(s);
+    }
+
+    if (!c->texture)
+        glGenTextures(1, &c->texture);
+    glBindTexture(GL_TEXTURE_2D, c->texture);
+    if (c->texture_rows != c->rows || c->texture_cols != c->cols) {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32UI, c->cols, c->rows, 0,
+                     GL_RGBA_INTEGER, GL_UNSIGNED_INT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        c->texture_rows = c->rows;
+        c->texture_cols = c->cols;
+    }
+
+    /* Consecutive rows go up together. */
+    for (int i = 0, n; i < c->n_changed; i += n) {
+        int first = c->changed[i];
+        for (n = 1; i + n < c->n_changed && c->changed[i + n] == first + n; ++n)
+            ;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, c->cols, n, GL_RGBA_INTEGER,
+                        GL_UNSIGNED_INT, &c->cells[(size_t)first * c->cols * 4]);
+    }
+    c->uploaded += (uint64_t)c->n_changed * c->cols;
+    c->n_changed = 0;
+    c->valid = true;
+    c->generation = s->generation;
+
+    w->text.missing |= sprites_draw(s, f, w->cell_height);
+}
+
+/* A single quad over the window, see cells-fragment.glsl. */
+static void window_draw_cells(struct wlterm_window *w) {
+    struct wlterm_frame *f = w->frame;
+    struct wlterm_sprites *s = f->sprites;
+    float width = w->width, height = w->height;
+    float cols = width / w->text.advance, rows = height / w->cell_height;
+    GLfloat quad[24] = {
+        0.0, 0.0, 0.0, 0.0,  width, 0.0, cols, 0.0,  0.0, height, 0.0, rows,
+        width, 0.0, cols, 0.0,  width, height, cols, rows,  0.0, height, 0.0, rows,
+    };
+
+    GLuint program = f->application->cells_program;
+    glUseProgram(program);
+    glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE,
+                       (GLfloat *)w->projection);
+    glUniform1i(glGetUniformLocation(program, "cells"), 0);
+    glUniform1i(glGetUniformLocation(program, "sprites"), 1);
+    glUniform2i(glGetUniformLocation(program, "slot"), s->slot_width, s->slot_height);
+    glUniform2f(glGetUniformLocation(program, "glyph"), w->text.advance * f->scale,
+                w->cell_height * f->scale);
+    glUniform1i(glGetUniformLocation(program, "per_row"), s->per_row);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, s->texture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, w->cells.texture);
+
+    glBindVertexArray(f->rows_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, f->rows_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STREAM_DRAW);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glBindVertexArray(0);
+}
+
+/* Draw what window_prepare() collected. */
+static void window_submit(struct wlterm_window *w) {
+
+    if (w->ring.active)
+        ring_draw_slots(w);
+    else if (w->cells.active)
+        window_upload_cells(w);
+
+    /* Prevent changing anything outside the window. */
+    set_region(w->frame, w->x, w->y, w->width, w->height);
+
+    /* Set projection to offset content to window location. */
+    glm_ortho(-w->x, w->width + (w->frame->width - w->width - w->x),
+              w->height + (w->frame->height - w->height - w->y), -w->y,
+              -1.0, 1.0, w->projection);
+
+    vec3 _color;
+    parse_color("0c1014", _color);
+    glClearColor(_color[0], _color[1], _color[2], 1.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    if (w->ring.active) {
+        ring_draw_window(w);
+        return;
+    }
+    if (w->cells.active) {
+        window_draw_cells(w);
+        return;
+    }
+
+    /* Everything in the window goes out in one draw call. */
+    bg_batch_flush(&w->bg, w->frame, (GLfloat *)w->projection);
+    wlterm_text_batch_flush(&w->text, (GLfloat *)w->projection);
+}
+
+/* Request the next callback, before the surface is committed. */
+static void frame_request_feedback(struct wlterm_frame *f) {
+    if (f->surface && !f->frame_callback) {
+        f->frame_callback = wl_surface_frame(f->surface);
+        wl_callback_add_listener(f->frame_callback, &frame_listener, f);
+    }
+
+    /* Follow the refresh cycle, and find out when the oldest unanswered key
+       press makes it to the screen. */
+    if (f->surface && !f->latency_feedback && f->application->presentation) {
+        f->latency_feedback = wp_presentation_feedback(f->application->presentation,
+                                                       f->surface);
+        wp_presentation_feedback_add_listener(f->latency_feedback, &feedback_listener, f);
+        f->latency_input_time = f->input_time;
+        f->input_time = 0;
+        f->feedback_target = f->target;
+    }
+    f->target = 0;
+}
+
+/* Account for a frame drawn from `start` and handed over from
+   `swap_start`. */
+static void frame_finish(struct wlterm_frame *f, uint64_t start, uint64_t swap_start) {
+    struct wlterm_profile *profile = &f->application->profile;
+    uint64_t end = timestamp_us();
+
+    /* The slowest recent frame, forgotten slowly. */
+    uint64_t took = (end - start) * 1000;
+    f->render_estimate -= f->render_estimate / 16;
+    if (took > f->render_estimate)
+        f->render_estimate = took;
+    f->drawn_at = end * 1000;
+
+    wlterm_histogram_add(&f->render_times, swap_start - start);
+    wlterm_histogram_add(&profile->metrics[WLTERM_PROFILE_CPU_RENDER], swap_start - start);
+    wlterm_histogram_add(&profile->metrics[WLTERM_PROFILE_SWAP], end - swap_start);
+    profile->frames++;
+
+    if (f->notify_fd >= 0) {
+        dprintf(f->notify_fd, "ok\n");
+        close(f->notify_fd);
+        f->notify_fd = -1;
+    }
+
+    if (!f->application->first_frame_time) {
+        struct wlterm_application *app = f->application;
+        app->first_frame_time = timestamp_us() - app->start_time;
+
+        if (getenv("WLTERM_STATS")) {
+            fprintf(stderr, "first frame %lu us after startup, programs built in %lu us "
+                    "(%s)\n", app->first_frame_time, app->program_time,
+                    app->programs_cached ? "cached" : "compiled");
+        }
+    }
+}
+
+/* Draw and swap a frame whose windows have been prepared. `prepare_time` is
+   what preparing them took, counted into the frame's CPU render time. */
+static void frame_submit(struct wlterm_frame *f, uint64_t prepare_time) {
+    struct wlterm_profile *profile = &f->application->profile;
+    uint64_t start = timestamp_us() - prepare_time;
+
+    /* With a single frame its context stays current between frames. */
+    if (eglGetCurrentContext() != f->gl_context ||
+        eglGetCurrentSurface(EGL_DRAW) != f->gl_surface)
+        eglMakeCurrent(f->application->gl_display, f->gl_surface, f->gl_surface,
+                       f->gl_context);
+
+    wlterm_gpu_timer_collect(&f->gpu_timer, &profile->metrics[WLTERM_PROFILE_GPU_RENDER]);
+    wlterm_gpu_timer_begin(&f->gpu_timer);
+    /* eglSwapInterval(app->gl_display, 0); */
+
+    glBindFramebuffer(GL_FRAMEBUFFER, f->fbo);
+    glViewport(0, 0, f->buffer_width, f->buffer_height);
+    glEnable(GL_BLEND);
+    /* glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); */
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    /* set_region(f, 0, f->height - f->minibuffer_height, f->width, f->minibuffer_height); */
+    set_region(f, 0, f->height, f->width, 0);
+    vec3 _color;
+    parse_color("0c1014", _color);
+    glClearColor(_color[0], _color[1], _color[2], 1.0);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    /* Windows are drawn where the back buffer is out of date, but only the
+       damaged areas are submitted to the compositor. */
+    EGLint rects[4 * 16];
+    EGLint n_rects = 0;
+    bool damage_all = false;
+
+    /* The atlas pages are shared with the glyph worker, which only holds
+       this lock briefly around generating a glyph. */
+    pthread_mutex_lock(&f->application->glyph_worker->lock);
+
+    FOR_EACH_WINDOW (f, w) {
+        if (!w->redraw)
+            continue;
+
+        /* Every placeholder drawn made a request. */
+        profile->glyph_misses += w->text.n_requests;
+        window_submit(w);
+        w->redraw = false;
+
+        if (!w->dirty)
+            continue;
+        w->drawn_frame = f->rendered_frames;
+
+        if (n_rects < 16) {
+            /* EGL damage rectangles are in buffer coordinates, with the origin
+               in the bottom-left corner. */
+            EGLint *r = &rects[4 * n_rects++];
+            r[0] = (w->x + w->damage.x) * f->scale;
+            r[1] = (f->height - w->y - w->damage.y - w->damage.height) * f->scale;
+            r[2] = w->damage.width * f->scale;
+            r[3] = w->damage.height * f->scale;
+        } else {
+            damage_all = true;  /* Too many to bother. */
+        }
+        w->dirty = false;
+    }
+    if (damage_all)
+        n_rects = 0;
+
+    pthread_mutex_unlock(&f->application->glyph_worker->lock);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDisableVertexAttribArray(0);
+
+    frame_request_feedback(f);
+    f->dirty = false;
+    f->rendered_frames++;
+
+    wlterm_gpu_timer_end(&f->gpu_timer);
+
+    /* Headless, "swapping" is waiting for the frame to be finished. */
+    uint64_t swap_start = timestamp_us();
+    if (f->gl_surface != EGL_NO_SURFACE) {
+        platform_swap_buffers_with_damage(f->application->gl_display, f->gl_surface,
+                                          rects, n_rects);
+
+        /* Asking now picks the next back buffer, it stays the same until the
+           next frame is drawn into it. */
+        EGLint age;
+        f->buffer_age = eglQuerySurface(f->application->gl_display, f->gl_surface,
+                                        EGL_BUFFER_AGE_EXT, &age) ? age : 0;
+    } else {
+        glFinish();
+        f->buffer_age = 1;  /* The framebuffer object keeps its contents. */
+    }
+    frame_finish(f, start, swap_start);
+}
+
+/* A window's area in buffer pixels, rounded outwards. */
+static struct wlterm_rect window_buffer_rect(struct wlterm_window *w, struct wlterm_rect r) {
+    double scale = w->frame->scale;
+    int x0 = floor((w->x + r.x) * scale), y0 = floor((w->y + r.y) * scale);
+    int x1 = ceil((w->x + r.x + r.width) * scale);
+    int y1 = ceil((w->y + r.y + r.height) * scale);
+    return (struct wlterm_rect){x0, y0, x1 - x0, y1 - y0};
+}
+
+/* Draw what window_prepare() collected without GL: the backgrounds, then
+   the glyphs from the frame's coverage cache. */
+static void window_draw_software(struct wlterm_window *w, struct wlterm_canvas *canvas) {
+    struct wlterm_frame *f = w->frame;
+    double scale = f->scale;
+    struct wlterm_rect r = window_buffer_rect(w, (struct wlterm_rect){0, 0, w->width,
+                                                                      w->height});
+
+    canvas->clip_x0 = max(0, r.x);
+    canvas->clip_y0 = max(0, r.y);
+    canvas->clip_x1 = min(canvas->width, r.x + r.width);
+    canvas->clip_y1 = min(canvas->height, r.y + r.height);
+    wlterm_canvas_fill(canvas, r.x, r.y, r.x + r.width, r.y + r.height,
+                       WLTERM_DEFAULT_BG);
+
+    struct wlterm_bg_batch *bg = &w->bg;
+    for (int i = 0; i < bg->n_runs; ++i) {
+        const GLfloat *v = &bg->vertices[i * 12];
+        wlterm_canvas_fill(canvas, lround((w->x + v[0]) * scale),
+                           lround((w->y + v[1]) * scale), lround((w->x + v[2]) * scale),
+                           lround((w->y + v[5]) * scale), bg->colors[i * 6]);
+    }
+    bg->n_runs = 0;
+
+    struct wlterm_text_batch *b = &w->text;
+    wlterm_coverage_cache_set_size(f->coverage, b->size, font_dpi * scale);
+    for (int i = 0; i < b->n_glyphs; ++i) {
+        const msdfgl_glyph_t *g = &b->glyphs[i];
+        wlterm_canvas_glyph(canvas, f->coverage, wlterm_coverage_get(f->coverage, g->key),
+                            lround((w->x + g->x) * scale), lround((w->y + g->y) * scale),
+                            g->color);
+    }
+    b->glyphs_drawn += b->n_glyphs;
+    b->n_glyphs = 0;
+}
+
+/* frame_submit() without GL. The back buffer first gets what it missed
+   from the other one copied over, then damaged windows are drawn into it
+   and it's attached to the surface. */
+static void frame_submit_software(struct wlterm_frame *f, uint64_t prepare_time) {
+    struct wlterm_shm_buffer *back = &f->buffers[f->back];
+    struct wlterm_shm_buffer *front = &f->buffers[!f->back];
+    uint64_t start = timestamp_us() - prepare_time;
+
+    /* Still on screen, the frame is drawn when it's released. */
+    if (back->busy) {
+        FOR_EACH_WINDOW (f, w) {
+            w->text.n_glyphs = 0;
+            w->bg.n_runs = 0;
+        }
+        return;
+    }
+
+    int width = f->buffer_width, height = f->buffer_height;
+    struct wlterm_canvas canvas = {back->data, width, height, 0, 0, width, height};
+    struct wlterm_canvas from = {front->data, width, height, 0, 0, width, height};
+
+    if (!f->buffer_age) {
+        wlterm_canvas_fill(&canvas, 0, 0, width, height, WLTERM_DEFAULT_BG);
+    } else if (back->n_missing < 0) {
+        wlterm_canvas_copy(&canvas, &from, 0, 0, width, height);
+    } else {
+        for (int i = 0; i < back->n_missing; ++i) {
+            struct wlterm_rect r = back->missing[i];
+            wlterm_canvas_copy(&canvas, &from, r.x, r.y, r.x + r.width, r.y + r.height);
+        }
+    }
+
+    struct wlterm_rect damage[WLTERM_SHM_DAMAGE_RECTS];
+    int n_damage = 0;
+    bool damage_all = !f->buffer_age;
+
+    FOR_EACH_WINDOW (f, w) {
+        if (!w->redraw)
+            continue;
+        window_draw_software(w, &canvas);
+        w->redraw = false;
+
+        if (!w->dirty)
+            continue;
+        w->drawn_frame = f->rendered_frames;
+        if (n_damage < WLTERM_SHM_DAMAGE_RECTS)
+            damage[n_damage++] = window_buffer_rect(w, w->damage);
+        else
+            damage_all = true;
+        w->dirty = false;
+    }
+
+    /* What was just drawn, the other buffer is now missing. */
+    if (damage_all || front->n_missing < 0 ||
+        front->n_missing + n_damage > WLTERM_SHM_DAMAGE_RECTS) {
+        front->n_missing = -1;
+    } else {
+        memcpy(&front->missing[front->n_missing], damage, n_damage * sizeof(*damage));
+        front->n_missing += n_damage;
+    }
+    back->n_missing = 0;
+
+    frame_request_feedback(f);
+    f->dirty = false;
+    f->rendered_frames++;
+
+    uint64_t swap_start = timestamp_us();
+    if (f->surface) {
+        wl_surface_attach(f->surface, back->buffer, 0, 0);
+        if (damage_all)
+            wl_surface_damage_buffer(f->surface, 0, 0, INT32_MAX, INT32_MAX);
+        for (int i = 0; i < n_damage && !damage_all; ++i)
+            wl_surface_damage_buffer(f->surface, damage[i].x, damage[i].y,
+                                     damage[i].width, damage[i].height);
+        wl_surface_commit(f->surface);
+        back->busy = true;
+    }
+    f->back = !f->back;
+    f->buffer_age = 1;  /* Brought up to date by copying, see above. */
+
+    frame_finish(f, start, swap_start);
+}
+
+/* Windows are prepared all at once on the render pool, then the frames are
+   drawn one after the other: GL submission and msdfgl stay on this
+   thread. */
+static void render_frames(struct wlterm_application *app, struct wlterm_frame **frames,
+                          int n_frames) {
+    int n_windows = 0;
+    for (int i = 0; i < n_frames; ++i)
+        FOR_EACH_WINDOW (frames[i], w)
+            n_windows++;
+    if (!n_windows)
+        return;
+
+    uint64_t start = timestamp_us();
+    void *windows[n_windows];
+    n_windows = 0;
+
+    /* Finds the font's advance through msdfgl, when it changes. */
+    pthread_mutex_lock(&app->glyph_worker->lock);
+    app->glyph_worker->frame++;
+    for (int i = 0; i < n_frames; ++i) {
+        struct wlterm_frame *f = frames[i];
+
+        /* Only damaged windows, and those the back buffer has an older
+           version of, are drawn. */
+        FOR_EACH_WINDOW (f, w) {
+            w->redraw = w->dirty || !f->buffer_age ||
+                f->rendered_frames - w->drawn_frame < (uint64_t)f->buffer_age;
+            if (!w->redraw)
+                continue;
+            wlterm_text_batch_begin(&w->text, active_font, font_size);
+            windows[n_windows++] = w;
+        }
+    }
+    pthread_mutex_unlock(&app->glyph_worker->lock);
+
+    wlterm_pool_run(app->render_pool, window_prepare, windows, n_windows);
+    uint64_t prepare_time = timestamp_us() - start;
+
+    for (int i = 0; i < n_frames; ++i) {
+        if (frames[i]->software)
+            frame_submit_software(frames[i], prepare_time);
+        else
+            frame_submit(frames[i], prepare_time);
+    }
+}
+
+void wlterm_frame_render(struct wlterm_frame *f) {
+    render_frames(f->application, &f, 1);
+}
+
+/* When to draw a damaged frame, in ns: as late as still makes the earliest
+   refresh it can, going by the last presentation and how long frames take
+   to draw, so that input up to then lands in that refresh. Right away while
+   the refresh rate is unknown.
+
+   Not before a window's synchronized update is done, or has timed out. And
+   under a flood of output, an occasional snapshot is enough: at most one
+   frame per refresh, and drawing takes no more than an eighth of the time,
+   the rest is left to parsing. */
+static uint64_t frame_render_time(struct wlterm_frame *f, uint64_t now) {
+    uint64_t earliest = now;
+    bool flooding = false;
+
+    FOR_EACH_WINDOW (f, w) {
+        if (w->sync_start && w->sync_start + SYNC_TIMEOUT > earliest)
+            earliest = w->sync_start + SYNC_TIMEOUT;
+        flooding |= w->flood_seen && w->flood_seen + FLOOD_HOLD > now;
+    }
+    if (flooding && f->drawn_at) {
+        uint64_t interval = 8 * f->render_estimate;
+        interval = interval > f->refresh ? interval : f->refresh;
+        if (f->drawn_at + interval > earliest)
+            earliest = f->drawn_at + interval;
+    }
+
+    uint64_t margin = f->render_estimate + f->slack;
+    if (!f->application->scheduler || !f->refresh || margin >= f->refresh ||
+        f->last_presented > earliest)
+        return earliest;
+
+    uint64_t refreshes = (earliest + margin - f->last_presented + f->refresh - 1) /
+        f->refresh;
+    f->target = f->last_presented + refreshes * f->refresh;
+    return f->target - margin;
+}
+
+/* Draw every frame that is damaged, not waiting for a frame callback, and
+   due. The schedule timer goes off when the next one is. */
+void wlterm_application_render(struct wlterm_application *app) {
+    uint64_t now = timestamp_us() * 1000, wake = UINT64_MAX;
+    int n = 0;
+    for (struct wlterm_frame *f = app->root_frame; f; f = f->next)
+        n++;
+
+    struct wlterm_frame *frames[n ? n : 1];
+    n = 0;
+    for (struct wlterm_frame *f = app->root_frame; f; f = f->next) {
+        if (!f->dirty || !f->configured || f->frame_callback ||
+            (f->software && f->buffers[f->back].busy))
+            continue;
+        uint64_t at = frame_render_time(f, now);
+        if (at > now) {
+            wake = at < wake ? at : wake;
+            continue;
+        }
+        frames[n++] = f;
+    }
+
+    if (app->schedule_fd >= 0) {
+        struct itimerspec its = {0};
+        if (wake != UINT64_MAX)
+            its.it_value = (struct timespec){wake / 1000000000, wake % 1000000000};
+        timerfd_settime(app->schedule_fd, TFD_TIMER_ABSTIME, &its, NULL);
+    }
+
+    render_frames(app, frames, n);
+}
+
+static int profile_signal_fd = -1;
+
+static void handle_profile_signal(int sig) {
+    uint64_t one = 1;
+    if (write(profile_signal_fd, &one, sizeof(one)) < 0) {}
+}
+
+static void dump_profile(struct wlterm_application *app) {
+    app->profile.glyphs_generated = app->glyph_worker->generated;
+    app->profile.atlas_pages = app->glyph_worker->n_pages;
+    app->profile.atlas_evictions = app->glyph_worker->evictions;
+    if (!wlterm_profile_dump(&app->profile, app->profile_path ? app->profile_path : "-"))
+        fprintf(stderr, "wlterm: can't write profile to %s\n", app->profile_path);
+}
+
+static struct wlterm_application *application_create(enum wlterm_backend backend) {
+    struct wlterm_application *app = calloc(1, sizeof (struct wlterm_application));
+    if (!app) return NULL;
+
+    app->backend = backend;
+    app->start_time = timestamp_us();
+    app->first_frame_time = 0;
+    app->server = NULL;
+    app->presentation = NULL;
+    app->presentation_clock = CLOCK_MONOTONIC;
+
+    /* Until the compositor says otherwise. */
+    app->repeat_rate = 25;
+    app->repeat_delay = 600;
+    app->repeat_fd = -1;
+    app->schedule_fd = -1;
+    app->paste_fd = -1;
+
+    const char *scheduler = getenv("WLTERM_SCHEDULER");
+    app->scheduler = !scheduler || strcmp(scheduler, "0") != 0;
+
+    const char *mode = getenv("WLTERM_RENDER_MODE");
+    app->render_mode = WLTERM_RENDER_BATCHES;
+    if (mode && strcmp(mode, "cells") == 0)
+        app->render_mode = WLTERM_RENDER_CELLS;
+    else if (mode && strcmp(mode, "software") == 0)
+        app->render_mode = WLTERM_RENDER_SOFTWARE;
+
+    memset(&app->profile, 0, sizeof(app->profile));
+    app->profile.scheduler = app->scheduler;
+    const char *profile_path = getenv("WLTERM_PROFILE");
+    app->profile_path = profile_path ? strdup(profile_path) : NULL;
+    app->profile_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    profile_signal_fd = app->profile_fd;
+    signal(SIGUSR1, handle_profile_signal);
+
+    app->root_frame = NULL;
 
     EGLint config_attribs[] = {
         EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
@@ -425,8 +2756,36 @@ struct wlterm_application *wlterm_application_create() {
         EGL_NONE
     };
 
-    app->gl_display = platform_get_egl_display(EGL_PLATFORM_WAYLAND_KHR,
-                                                     app->display, NULL);
+    if (backend == WLTERM_BACKEND_WAYLAND) {
+        app->display = wl_display_connect(NULL);
+        if (!app->display) {
+            fprintf(stderr, "wlterm: can't connect to a Wayland display\n");
+            exit(1);
+        }
+
+        app->repeat_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        app->schedule_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+
+        app->registry = wl_display_get_registry(app->display);
+        wl_registry_add_listener(app->registry, &registry_listener, app);
+
+        wl_display_roundtrip(app->display);
+
+        if (app->seat && app->data_device_manager) {
+            app->data_device = wl_data_device_manager_get_data_device(
+                app->data_device_manager, app->seat);
+            wl_data_device_add_listener(app->data_device, &data_device_listener, app);
+        }
+
+        app->gl_display = platform_get_egl_display(EGL_PLATFORM_WAYLAND_KHR,
+                                                   app->display, NULL);
+    } else {
+        /* Frames draw into FBOs, the config only needs to exist. */
+        config_attribs[1] = EGL_PBUFFER_BIT;
+        config_attribs[12] = EGL_NONE;
+        app->gl_display = platform_get_headless_egl_display();
+    }
+
     EGLint major, minor, count, n, size, i;
     EGLConfig *configs;
     eglInitialize(app->gl_display, &major, &minor);
@@ -452,26 +2811,231 @@ struct wlterm_application *wlterm_application_create() {
 
 
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    eglSwapInterval(app->gl_display, 0);
+    if (backend == WLTERM_BACKEND_WAYLAND)
+        eglSwapInterval(app->gl_display, 0);
+
+    /* Programs are shared with the frames' contexts. */
+    uint64_t programs_start = timestamp_us();
+    bool cached;
+    app->bg_program = create_program("bg-vertex.glsl", "bg-fragment.glsl", NULL,
+                                     &app->programs_cached);
+    app->rows_program = create_program("rows-vertex.glsl", "rows-fragment.glsl", NULL,
+                                       &cached);
+    app->programs_cached &= cached;
+    app->cells_program = create_program("rows-vertex.glsl", "cells-fragment.glsl", NULL,
+                                        &cached);
+    app->programs_cached &= cached;
+    app->program_time = timestamp_us() - programs_start;
 
     load_font(app, "/usr/share/fonts/truetype/dejavu/DejaVuSansMono.ttf");
 
+    const char *threads = getenv("WLTERM_RENDER_THREADS");
+    long n_threads = threads ? atoi(threads) : sysconf(_SC_NPROCESSORS_ONLN);
+    app->render_pool = wlterm_pool_create(n_threads < 1 ? 1 : n_threads > 16 ? 16 : n_threads);
+
     return app;
 }
 
+struct wlterm_application *wlterm_application_create() {
+    return application_create(WLTERM_BACKEND_WAYLAND);
+}
+
+struct wlterm_application *wlterm_application_create_headless() {
+    return application_create(WLTERM_BACKEND_HEADLESS);
+}
+
 void wlterm_application_destroy(struct wlterm_application *app) {
+    if (app->profile_path)
+        dump_profile(app);
+    free(app->profile_path);
+    signal(SIGUSR1, SIG_DFL);
+    close(app->profile_fd);
+
+    if (app->server)
+        wlterm_server_destroy(app->server);
+    wlterm_glyph_worker_destroy(app->glyph_worker);
+    wlterm_pool_destroy(app->render_pool);
+
+    while (app->n_spare_contexts)
+        eglDestroyContext(app->gl_display, app->spare_contexts[--app->n_spare_contexts]);
     eglTerminate(app->gl_display);
     eglReleaseThread();
 
-    wl_registry_destroy(app->registry);
-    wl_display_disconnect(app->display);
+    if (app->repeat_fd >= 0)
+        close(app->repeat_fd);
+    if (app->schedule_fd >= 0)
+        close(app->schedule_fd);
+    free(app->keys);
+    if (app->paste_fd >= 0)
+        close(app->paste_fd);
+    free(app->paste);
+    if (app->offer)
+        wl_data_offer_destroy(app->offer);
+    if (app->selection)
+        wl_data_offer_destroy(app->selection);
+    if (app->data_device)
+        wl_data_device_destroy(app->data_device);
+    if (app->data_device_manager)
+        wl_data_device_manager_destroy(app->data_device_manager);
+    if (app->xkb_state)
+        xkb_state_unref(app->xkb_state);
+    if (app->xkb_keymap)
+        xkb_keymap_unref(app->xkb_keymap);
+
+    while (app->outputs) {
+        struct wlterm_output *o = app->outputs;
+        app->outputs = o->next;
+        wl_output_destroy(o->output);
+        free(o);
+    }
+
+    if (app->display) {
+        wl_registry_destroy(app->registry);
+        wl_display_disconnect(app->display);
+    }
 }
 
 int wlterm_application_run(struct wlterm_application *app) {
-    while (wl_display_dispatch(app->display) != -1 && app->root_frame) {}
+
+    while (app->root_frame || app->server) {
+        if (app->display) {
+            while (wl_display_prepare_read(app->display) != 0)
+                wl_display_dispatch_pending(app->display);
+            wl_display_flush(app->display);
+        }
+
+        /* Wait for either the compositor, a paste, new server clients and
+           their requests or any of the PTY readers. */
+        int n_clients = app->server ? app->server->n_clients : 0;
+        int n_fds = 7 + n_clients;
+        for (struct wlterm_frame *f = app->root_frame; f; f = f->next)
+            FOR_EACH_WINDOW (f, w)
+                if (w->pty) n_fds++;
+
+        struct pollfd fds[n_fds];
+        fds[0] = (struct pollfd){.fd = app->display ? wl_display_get_fd(app->display) : -1,
+                                 .events = POLLIN};
+        fds[1] = (struct pollfd){.fd = app->glyph_worker->event_fd, .events = POLLIN};
+        fds[2] = (struct pollfd){.fd = app->server ? app->server->fd : -1, .events = POLLIN};
+        fds[3] = (struct pollfd){.fd = app->profile_fd, .events = POLLIN};
+        fds[4] = (struct pollfd){.fd = app->repeat_fd, .events = POLLIN};
+        fds[5] = (struct pollfd){.fd = app->schedule_fd, .events = POLLIN};
+        fds[6] = (struct pollfd){.fd = app->paste_fd, .events = POLLIN};
+        for (int i = 0; i < n_clients; ++i)
+            fds[7 + i] = (struct pollfd){.fd = app->server->clients[i].fd, .events = POLLIN};
+        n_fds = 7 + n_clients;
+        for (struct wlterm_frame *f = app->root_frame; f; f = f->next)
+            FOR_EACH_WINDOW (f, w)
+                if (w->pty)
+                    fds[n_fds++] = (struct pollfd){.fd = w->pty->event_fd, .events = POLLIN};
+
+        if (poll(fds, n_fds, -1) < 0 && errno != EINTR) {
+            if (app->display)
+                wl_display_cancel_read(app->display);
+            break;
+        }
+
+        if (app->display) {
+            if (fds[0].revents & POLLIN) {
+                if (wl_display_read_events(app->display) == -1)
+                    break;
+            } else {
+                wl_display_cancel_read(app->display);
+            }
+            if (wl_display_dispatch_pending(app->display) == -1)
+                break;
+        }
+
+        if (app->server) {
+            wlterm_server_dispatch(app->server, &fds[7]);
+            if (fds[2].revents & POLLIN)
+                wlterm_server_accept(app->server);
+        }
+
+        uint64_t signals;
+        if (read(app->profile_fd, &signals, sizeof(signals)) == sizeof(signals))
+            dump_profile(app);
+
+        /* Every repeat since the last look, no more than a second's worth
+           after a stall. */
+        uint64_t repeats;
+        if ((fds[4].revents & POLLIN) &&
+            read(app->repeat_fd, &repeats, sizeof(repeats)) == sizeof(repeats) &&
+            app->repeat_key) {
+            for (uint64_t i = 0; i < repeats && i < (uint64_t)app->repeat_rate; ++i)
+                queue_key(app, app->repeat_key);
+        }
+
+        if (fds[6].revents)
+            paste_read(app);
+
+        /* A frame is due, drawn below. */
+        uint64_t expirations;
+        if (fds[5].revents & POLLIN)
+            while (read(app->schedule_fd, &expirations, sizeof(expirations)) < 0 &&
+                   errno == EINTR) {}
+
+        handle_input(app);
+
+        /* PTY data is consumed as fast as it arrives, independent of how
+           often the frames get drawn. */
+        struct wlterm_frame *next;
+        for (struct wlterm_frame *f = app->root_frame; f; f = next) {
+            next = f->next;
+
+            /* A window goes when its shell exits, the frame with its last
+               window. */
+            struct wlterm_window *next_window;
+            for (struct wlterm_window *w = f->root_window; w; w = next_window) {
+                next_window = w->next;
+                if (!w->pty)
+                    continue;
+                wlterm_window_read_pty(w);
+                if (wlterm_pty_done(w->pty))
+                    wlterm_window_destroy(w);
+            }
+            if (!f->root_window)
+                wlterm_frame_destroy(f);
+        }
+
+        /* Redraw windows that drew placeholders once their glyphs land. */
+        if (wlterm_glyph_worker_drain(app->glyph_worker)) {
+            for (struct wlterm_frame *f = app->root_frame; f; f = f->next)
+                FOR_EACH_WINDOW (f, w)
+                    if (w->text.missing)
+                        wlterm_window_damage_all(w);
+        }
+
+        /* Frames damaged while no frame callback was pending are drawn when
+           due, the rest wait for their callback. */
+        wlterm_application_render(app);
+
+        for (struct wlterm_frame *f = app->root_frame; f; f = next) {
+            next = f->next;
+            if (f->close_after_first_frame && f->rendered_frames)
+                wlterm_frame_destroy(f);
+        }
+    }
     return 0;
 }
 
+/* A context sharing the application's, a closed frame's if there is one. */
+static EGLContext frame_get_context(struct wlterm_application *app) {
+    if (app->n_spare_contexts)
+        return app->spare_contexts[--app->n_spare_contexts];
+    return eglCreateContext(app->gl_display, app->gl_conf, app->gl_context,
+                            context_attribs);
+}
+
+/* Keep a closed frame's context for the next frame, or destroy it if enough
+   are kept. It must not be current. */
+static void frame_put_context(struct wlterm_application *app, EGLContext context) {
+    if (app->n_spare_contexts < WLTERM_SPARE_CONTEXTS)
+        app->spare_contexts[app->n_spare_contexts++] = context;
+    else
+        eglDestroyContext(app->gl_display, context);
+}
+
 struct wlterm_frame *wlterm_frame_create(struct wlterm_application *app) {
 
     struct wlterm_frame **fp = &app->root_frame;
@@ -485,31 +3049,115 @@ struct wlterm_frame *wlterm_frame_create(struct wlterm_application *app) {
     f->width = 200;
     f->height = 200;
     f->open = true;
+    f->configured = app->backend == WLTERM_BACKEND_HEADLESS;
     f->scale = 1.0;
+    f->buffer_width = f->width;
+    f->buffer_height = f->height;
+    f->viewport = NULL;
+    f->fractional_scale = NULL;
+    f->n_outputs = 0;
+    f->scale_changes = 0;
+    f->scale_change_time = 0;
     f->next = NULL;
     f->prev = prev;
+    f->dirty = false;
+    f->frame_callback = NULL;
+    f->rendered_frames = 0;
+    f->skipped_frames = 0;
+    f->notify_fd = -1;
+    f->close_after_first_frame = false;
+    memset(&f->render_times, 0, sizeof(f->render_times));
+    f->sprites = NULL;
+    f->software = app->render_mode == WLTERM_RENDER_SOFTWARE;
+    memset(f->buffers, 0, sizeof(f->buffers));
+    f->back = 0;
+    f->shm_data = NULL;
+    f->shm_size = 0;
+    f->coverage = NULL;
+    f->input_time = 0;
+    f->latency_input_time = 0;
+    f->latency_feedback = NULL;
+    f->last_presented = 0;
+    f->refresh = 0;
+    f->render_estimate = 0;
+    f->slack = SCHEDULE_SLACK;
+    f->target = 0;
+    f->feedback_target = 0;
+    f->drawn_at = 0;
+
+    f->root_window = NULL;
+    f->buffer_age = 0;
+    f->active_window = wlterm_window_create(f);
+    f->layout = f->active_window->layout = wlterm_layout_create(f->active_window);
+    wlterm_frame_layout(f);
+
+    f->surface = NULL;
+    f->gl_context = EGL_NO_CONTEXT;
+    f->gl_window = NULL;
+    f->gl_surface = EGL_NO_SURFACE;
+    f->fbo = 0;
+    f->fbo_color = 0;
+
+    if (f->software) {
+        f->coverage = calloc(1, sizeof(struct wlterm_coverage_cache));
+        if (!wlterm_coverage_cache_init(f->coverage, app->glyph_worker->font_name)) {
+            fprintf(stderr, "wlterm: can't load %s\n", app->glyph_worker->font_name);
+            exit(1);
+        }
+        memset(&f->gpu_timer, 0, sizeof(f->gpu_timer));
+        if (app->backend == WLTERM_BACKEND_HEADLESS) {
+            frame_resize_buffers(f);
+            wlterm_window_damage_all(f->root_window);
+            wlterm_frame_render(f);
+            return f;
+        }
+    } else {
+        f->gl_context = frame_get_context(app);
+    }
 
-    f->root_window = malloc(sizeof(struct wlterm_window));
-    f->root_window->width = f->width;
-    f->root_window->height = f->height;
-    f->root_window->frame = f;
-    f->root_window->x = 0;
-    f->root_window->y = 0;
-    /* f->root_window->contents = NULL; */
-    f->root_window->next = NULL;
-
-    /* Share the context between frames */
-    f->gl_context = eglCreateContext(app->gl_display, app->gl_conf,
-                                     app->gl_context, context_attribs);
+    if (app->backend == WLTERM_BACKEND_HEADLESS) {
+        eglMakeCurrent(app->gl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, f->gl_context);
+
+        glGenFramebuffers(1, &f->fbo);
+        glGenRenderbuffers(1, &f->fbo_color);
+        glBindRenderbuffer(GL_RENDERBUFFER, f->fbo_color);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, f->buffer_width,
+                              f->buffer_height);
+        glBindFramebuffer(GL_FRAMEBUFFER, f->fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER,
+                                  f->fbo_color);
+
+        glEnable(GL_SCISSOR_TEST);
+        frame_init_bg(f);
+        frame_init_rows(f);
+        wlterm_gpu_timer_init(&f->gpu_timer);
+        app->profile.gpu_timer |= f->gpu_timer.supported;
+
+        wlterm_window_damage_all(f->root_window);
+        wlterm_frame_render(f);
+        return f;
+    }
 
     f->surface = wl_compositor_create_surface(app->compositor);
     wl_surface_set_user_data(f->surface, f);
+    wl_surface_add_listener(f->surface, &surface_listener, f);
     wl_surface_set_buffer_scale(f->surface, f->scale);
 
-    f->gl_window = wl_egl_window_create(f->surface, 200, 200);
-    f->gl_surface = platform_create_egl_surface(app->gl_display,
-                                                app->gl_conf,
-                                                f->gl_window, NULL);
+    if (app->viewporter && app->fractional_scale_manager) {
+        f->viewport = wp_viewporter_get_viewport(app->viewporter, f->surface);
+        wp_viewport_set_destination(f->viewport, f->width, f->height);
+        f->fractional_scale = wp_fractional_scale_manager_v1_get_fractional_scale(
+            app->fractional_scale_manager, f->surface);
+        wp_fractional_scale_v1_add_listener(f->fractional_scale,
+                                            &fractional_scale_listener, f);
+    }
+
+    if (!f->software) {
+        f->gl_window = wl_egl_window_create(f->surface, 200, 200);
+        f->gl_surface = platform_create_egl_surface(app->gl_display,
+                                                    app->gl_conf,
+                                                    f->gl_window, NULL);
+    }
 
     f->xdg_surface = xdg_wm_base_get_xdg_surface(app->xdg_wm_base, f->surface);
     f->xdg_toplevel = xdg_surface_get_toplevel(f->xdg_surface);
@@ -520,28 +3168,171 @@ struct wlterm_frame *wlterm_frame_create(struct wlterm_application *app) {
     xdg_toplevel_set_title(f->xdg_toplevel, "wlterm");
     wl_surface_commit(f->surface);
 
-    eglMakeCurrent(app->gl_display, f->gl_surface, f->gl_surface, f->gl_context);
+    if (f->software) {
+        frame_resize_buffers(f);
+    } else {
+        eglMakeCurrent(app->gl_display, f->gl_surface, f->gl_surface, f->gl_context);
 
-    glEnable(GL_SCISSOR_TEST);
+        glEnable(GL_SCISSOR_TEST);
+        frame_init_bg(f);
+        frame_init_rows(f);
+        wlterm_gpu_timer_init(&f->gpu_timer);
+        app->profile.gpu_timer |= f->gpu_timer.supported;
+    }
 
-    wl_display_roundtrip(app->display);
+    /* Drawn once configured, without waiting for it here. */
+    wlterm_window_damage_all(f->root_window);
+    return f;
+}
 
-    eglSwapBuffers(app->gl_display, f->gl_surface);
-    struct wl_callback *callback = wl_surface_frame(f->surface);
-    wl_callback_add_listener(callback, &frame_listener, f);
+/* Read back what was last rendered into a headless frame, as top-down RGBA.
+   `rgba` holds buffer_width by buffer_height pixels. */
+void wlterm_frame_read_pixels(struct wlterm_frame *f, uint8_t *rgba) {
+    int width = f->buffer_width;
+    int height = f->buffer_height;
+
+    /* Software frames last drew into the buffer before the back one. */
+    if (f->software) {
+        const uint32_t *pixels = f->buffers[!f->back].data;
+        for (size_t i = 0; i < (size_t)width * height; ++i) {
+            rgba[i * 4] = pixels[i] >> 16;
+            rgba[i * 4 + 1] = pixels[i] >> 8;
+            rgba[i * 4 + 2] = pixels[i];
+            rgba[i * 4 + 3] = 0xff;
+        }
+        return;
+    }
 
-    wlterm_frame_render(f);
-    return f;
+    eglMakeCurrent(f->application->gl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                   f->gl_context);
+    glBindFramebuffer(GL_FRAMEBUFFER, f->fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+
+    /* GL rows go bottom-up. */
+    size_t stride = (size_t)width * 4;
+    uint8_t *row = malloc(stride);
+    for (int y = 0; y < height / 2; ++y) {
+        uint8_t *a = rgba + y * stride, *b = rgba + (height - 1 - y) * stride;
+        memcpy(row, a, stride);
+        memcpy(a, b, stride);
+        memcpy(b, row, stride);
+    }
+    free(row);
 }
 
 void wlterm_frame_destroy(struct wlterm_frame *f) {
     f->open = false;
 
-    platform_destroy_egl_surface(f->application->gl_display, f->gl_surface);
+    if (getenv("WLTERM_STATS")) {
+        uint64_t draw_calls = 0, glyphs_drawn = 0;
+        FOR_EACH_WINDOW (f, w) {
+            draw_calls += w->text.draw_calls;
+            glyphs_drawn += w->text.glyphs_drawn;
+        }
+        fprintf(stderr, "frame %p: %lu frames rendered, %lu frame callbacks skipped, "
+                "%lu glyph draw calls for %lu glyphs\n",
+                (void *)f, f->rendered_frames, f->skipped_frames, draw_calls, glyphs_drawn);
+        fprintf(stderr, "frame %p: scale %g, changed %lu times in %lu us\n", (void *)f,
+                f->scale, f->scale_changes, f->scale_change_time);
+        if (f->application->scheduler)
+            fprintf(stderr, "frame %p: refresh %lu us, drawing takes up to %lu us, "
+                    "%lu us of slack\n", (void *)f, f->refresh / 1000,
+                    f->render_estimate / 1000, f->slack / 1000);
+        struct wlterm_glyph_worker *gw = f->application->glyph_worker;
+        int resident = wlterm_glyph_worker_resident(gw);
+        fprintf(stderr, "atlas: %d of %d pages, %d glyphs (%d%% full), %lu generated, "
+                "%lu pages evicted\n", gw->n_pages, gw->max_pages, resident,
+                resident * 100 / (gw->n_pages * WLTERM_ATLAS_PAGE_GLYPHS), gw->generated,
+                gw->evictions);
+        FOR_EACH_WINDOW (f, w) {
+            struct wlterm_scrollback_stats sb;
+            wlterm_scrollback_stats(w->scrollback, &sb);
+            fprintf(stderr, "window %p: %lu lines of scrollback in %lu KiB (%lu KiB "
+                    "compressed, %lu pages), %lu pages decompressed\n", (void *)w,
+                    sb.lines, (sb.hot_bytes + sb.cold_bytes) >> 10, sb.cold_bytes >> 10,
+                    sb.pages, sb.decompressed);
+            fprintf(stderr, "window %p: rows laid out %lu times, reused %lu times, %zu "
+                    "cached in %zu KiB, %lu evicted\n", (void *)w, w->runs.misses,
+                    w->runs.hits, w->runs.n_runs, w->runs.bytes >> 10,
+                    w->runs.evictions);
+            if (w->cells.uploaded)
+                fprintf(stderr, "window %p: %lu cells uploaded\n", (void *)w,
+                        w->cells.uploaded);
+        }
+        if (f->sprites)
+            fprintf(stderr, "frame %p: %d of %d sprites, %lu drawn, started over %lu "
+                    "times\n", (void *)f, f->sprites->n_sprites, f->sprites->capacity,
+                    f->sprites->drawn, f->sprites->resets);
+        fprintf(stderr, "frame %p: render time histogram:\n", (void *)f);
+        for (int i = 0; i < WLTERM_HISTOGRAM_BUCKETS; ++i)
+            if (f->render_times.buckets[i])
+                fprintf(stderr, "  %7u-%7u us: %u\n", 1u << i, (2u << i) - 1,
+                        f->render_times.buckets[i]);
+    }
 
-    xdg_toplevel_destroy(f->xdg_toplevel);
-    xdg_surface_destroy(f->xdg_surface);
-    wl_surface_destroy(f->surface);
+    if (f->frame_callback)
+        wl_callback_destroy(f->frame_callback);
+    if (f->latency_feedback)
+        wp_presentation_feedback_destroy(f->latency_feedback);
+    if (f->notify_fd >= 0)
+        close(f->notify_fd);
+
+    if (f->software) {
+        frame_release_buffers(f);
+        wlterm_coverage_cache_release(f->coverage);
+        free(f->coverage);
+    } else {
+        eglMakeCurrent(f->application->gl_display, f->gl_surface, f->gl_surface,
+                       f->gl_context);
+        wlterm_gpu_timer_finish(&f->gpu_timer);
+        glDeleteVertexArrays(1, &f->bg_vao);
+        glDeleteBuffers(1, &f->bg_vbo);
+        glDeleteVertexArrays(1, &f->rows_vao);
+        glDeleteBuffers(1, &f->rows_vbo);
+    }
+    if (f->fbo) {
+        glDeleteFramebuffers(1, &f->fbo);
+        glDeleteRenderbuffers(1, &f->fbo_color);
+    }
+    if (f->sprites) {
+        glDeleteFramebuffers(1, &f->sprites->fbo);
+        glDeleteTextures(1, &f->sprites->texture);
+        free(f->sprites->table);
+        free(f->sprites->pending);
+        wlterm_text_batch_release(&f->sprites->text);
+        free(f->sprites);
+    }
+    if (f->application->active_frame == f)
+        f->application->active_frame = NULL;
+    if (f->application->pointer_frame == f)
+        f->application->pointer_frame = NULL;
+
+    while (f->root_window)
+        wlterm_window_destroy(f->root_window);
+
+    /* Everything in the context is gone, it goes on to the next frame. */
+    if (f->gl_context != EGL_NO_CONTEXT) {
+        eglMakeCurrent(f->application->gl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                       EGL_NO_CONTEXT);
+        frame_put_context(f->application, f->gl_context);
+    }
+
+    if (f->surface) {
+        if (f->gl_surface != EGL_NO_SURFACE)
+            platform_destroy_egl_surface(f->application->gl_display, f->gl_surface);
+        if (f->gl_window)
+            wl_egl_window_destroy(f->gl_window);
+
+        if (f->fractional_scale)
+            wp_fractional_scale_v1_destroy(f->fractional_scale);
+        if (f->viewport)
+            wp_viewport_destroy(f->viewport);
+
+        xdg_toplevel_destroy(f->xdg_toplevel);
+        xdg_surface_destroy(f->xdg_surface);
+        wl_surface_destroy(f->surface);
+    }
 
     if (!f->prev)  /* root frame */
         f->application->root_frame = f->next;
@@ -4,19 +4,77 @@
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <GLES2/gl2.h>
 #include <EGL/egl.h>
 #include <msdfgl.h>
 
 #include <cglm/mat4.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "document.h"
+#include "glyphs.h"
+#include "grid.h"
+#include "layout.h"
+#include "pool.h"
+#include "profile.h"
+#include "pty.h"
+#include "runs.h"
+#include "scrollback.h"
+#include "server.h"
+#include "software.h"
+#include "vt.h"
 
 
 struct wlterm_window;
 struct wlterm_frame;
 
+/* Lines of scrollback kept per window. */
+#define WLTERM_SCROLLBACK_LINES 1000000
+
+/* GL contexts of closed frames kept for new ones. */
+#define WLTERM_SPARE_CONTEXTS 4
+
+enum wlterm_backend {
+    WLTERM_BACKEND_WAYLAND,
+    /* No compositor: frames render into framebuffer objects that can be read
+       back, for benchmarks and tests. */
+    WLTERM_BACKEND_HEADLESS,
+};
+
+enum wlterm_render_mode {
+    /* Glyphs and backgrounds collected on the CPU every frame, from rows
+       laid out before when they haven't changed. */
+    WLTERM_RENDER_BATCHES,
+    /* The cells are kept in a texture, only changed rows are uploaded, and
+       a single quad draws the window: each pixel looks up its cell and the
+       glyph drawn for it. $WLTERM_RENDER_MODE=cells. */
+    WLTERM_RENDER_CELLS,
+    /* No GL in frames: the batches are drawn on the CPU with glyphs
+       rasterized by FreeType, into shared memory buffers. EGL is still used
+       for font metrics. $WLTERM_RENDER_MODE=software. */
+    WLTERM_RENDER_SOFTWARE,
+};
+
+/* Modifiers held with a key, as xterm numbers them in key sequences
+   (CSI 1 ; 1 + mods A). */
+enum wlterm_mod {
+    WLTERM_MOD_SHIFT = 1,
+    WLTERM_MOD_ALT = 2,
+    WLTERM_MOD_CTRL = 4,
+};
+
+/* A key press as it came in: what it does depends on the modifiers held at
+   the time, not when it is handled. */
+struct wlterm_key {
+    xkb_keysym_t sym;
+    uint8_t mods;
+    char text[7];  /* The UTF-8 it types, NUL terminated. */
+};
 
 struct wlterm_application {
+    enum wlterm_backend backend;
 
     struct wl_display *display;
     struct wl_registry *registry;
@@ -31,15 +89,132 @@ struct wlterm_application {
     struct wl_keyboard *kbd;
     struct wl_pointer *pointer;
 
+    /* Input is queued as it arrives and handled once per main loop
+       iteration, before anything is drawn, so a burst of events costs a
+       single redraw. */
+    struct wlterm_key *keys;
+    int n_keys;
+    int keys_capacity;
+
+    /* Key repeat is up to clients, at the rate (per second) and delay (ms)
+       from wl_keyboard.repeat_info. */
+    int32_t repeat_rate;
+    int32_t repeat_delay;
+    uint32_t repeat_key;  /* Evdev code of the key repeating, 0 for none. */
+    int repeat_fd;        /* timerfd, fires at every repeat. */
+
+    /* Damaged frames are drawn when due, see frame_render_time. Off with
+       WLTERM_SCHEDULER=0, drawing right away. */
+    bool scheduler;
+    int schedule_fd;  /* timerfd, fires when the next frame is due. */
+
+    /* The pointer in surface coordinates, and scrolling summed up until the
+       input is handled. */
+    struct wlterm_frame *pointer_frame;
+    double pointer_x;
+    double pointer_y;
+    bool pointer_pressed;
+    double scroll;            /* Surface pixels, positive down. */
+    int32_t scroll_discrete;  /* Wheel notches. */
+    bool scroll_stopped;      /* Fingers lifted off the touchpad. */
+
+    /* Touchpad scrolling goes on for a while after the fingers are lifted,
+       slowing down. Velocity in pixels per second, back into the
+       scrollback. */
+    double scroll_velocity;
+    uint64_t scroll_time;
+    struct wlterm_window *kinetic_window;
+
+    /* The clipboard, when it holds text. A paste is read from `paste_fd`
+       by the main loop, then sent to the window it was made in. */
+    struct wl_data_device_manager *data_device_manager;
+    struct wl_data_device *data_device;
+    struct wl_data_offer *offer;  /* The latest, until it is the selection. */
+    const char *offer_type;
+    struct wl_data_offer *selection;
+    const char *selection_type;
+    int paste_fd;
+    char *paste;
+    size_t paste_len;
+    struct wlterm_window *paste_window;
+
+    struct wp_presentation *presentation;
+    uint32_t presentation_clock;
+
+    /* Fractional scales need both, integer output scales are used
+       otherwise. */
+    struct wp_viewporter *viewporter;
+    struct wp_fractional_scale_manager_v1 *fractional_scale_manager;
+    struct wlterm_output *outputs;
+
     EGLDisplay gl_display;
     EGLConfig gl_conf;
     EGLContext gl_context;
 
+    /* Creating a context takes longer than everything else a frame needs:
+       closed frames leave theirs here for the next ones. */
+    EGLContext spare_contexts[WLTERM_SPARE_CONTEXTS];
+    int n_spare_contexts;
+
     msdfgl_context_t msdfgl_ctx;
+    struct wlterm_glyph_worker *glyph_worker;
+
+    enum wlterm_render_mode render_mode;
+
+    /* Shared by every frame's context. */
+    GLuint bg_program;
+    GLuint rows_program;
+    GLuint cells_program;
+    uint64_t program_time;  /* Building the programs at startup, in us. */
+    bool programs_cached;   /* All of them came from the program cache. */
+
+    /* Size of a character cell in pixels, the font is monospaced. */
+    float cell_width;
+    float cell_height;
+
+    /* Builds the glyphs and backgrounds of all windows due for a redraw in
+       parallel, $WLTERM_RENDER_THREADS threads. */
+    struct wlterm_pool *render_pool;
+
     struct wlterm_frame *root_frame;
     struct wlterm_frame *active_frame;
+
+    /* Set in server mode, the application then keeps running without
+       frames. */
+    struct wlterm_server *server;
+
+    uint64_t start_time;
+    uint64_t first_frame_time;
+
+    struct wlterm_profile profile;
+    char *profile_path;  /* $WLTERM_PROFILE */
+    int profile_fd;      /* Signalled on SIGUSR1. */
+};
+
+
+struct wlterm_output {
+    struct wl_output *output;
+    uint32_t name;
+    int32_t scale;
+    struct wlterm_output *next;
 };
 
+#define WLTERM_MAX_FRAME_OUTPUTS 8
+
+/* Rectangles drawn into one buffer and not the other, beyond these the
+   whole buffer is copied. */
+#define WLTERM_SHM_DAMAGE_RECTS 16
+
+struct wlterm_shm_buffer {
+    struct wl_buffer *buffer;  /* NULL when headless. */
+    uint32_t *data;
+    bool busy;  /* Until the compositor releases it. */
+
+    /* Areas, in buffer pixels, drawn into the other buffer since this one
+       was last drawn. -1 for all of it. */
+    struct wlterm_rect missing[WLTERM_SHM_DAMAGE_RECTS];
+    int n_missing;
+};
 
 struct wlterm_frame {
     struct wlterm_application *application;
@@ -50,27 +225,232 @@ struct wlterm_frame {
     struct xdg_surface *xdg_surface;
     struct xdg_toplevel *xdg_toplevel;
 
-    struct wl_buffer *buffer;
+    /* Software rendering: two buffers in one shared memory file, drawn in
+       turn. A buffer is brought up to date by copying what it missed from
+       the other, so only damaged windows are drawn. */
+    bool software;
+    struct wlterm_shm_buffer buffers[2];
+    int back;  /* The buffer drawn next. */
     void *shm_data;
+    size_t shm_size;
+    struct wlterm_coverage_cache *coverage;
 
     bool open;
+    bool configured;  /* Nothing is drawn before the first configure event. */
     int width;
     int height;
 
+    /* Windows are laid out in surface coordinates, and drawn at `scale`
+       times that: buffer_width by buffer_height pixels. Glyphs are distance
+       fields, they are drawn at any scale from the same atlas. */
     double scale;
+    int buffer_width;
+    int buffer_height;
+    struct wp_viewport *viewport;
+    struct wp_fractional_scale_v1 *fractional_scale;
+    struct wl_output *outputs[WLTERM_MAX_FRAME_OUTPUTS];  /* The surface is on. */
+    int n_outputs;
+    uint64_t scale_changes;
+    uint64_t scale_change_time;  /* Spent switching, in us. */
 
     /* OpenGL */
     struct wl_egl_window *gl_window;
 
+    /* Headless only, drawn into instead of a window surface. */
+    GLuint fbo;
+    GLuint fbo_color;
+
     EGLContext gl_context;
     EGLConfig gl_conf;
     EGLDisplay gl_display;
     EGLSurface gl_surface;
 
+    /* Vertex arrays are per context. */
+    GLuint bg_vao;
+    GLuint bg_vbo;
+    GLuint rows_vao;
+    GLuint rows_vbo;
+
+    /* Glyphs drawn for the cell render mode, created on first use. */
+    struct wlterm_sprites *sprites;
+
     mat4 projection;
 
+    /* All windows of the frame, in the order they were created, and how
+       they tile it. */
     struct wlterm_window *root_window;
+    struct wlterm_layout *layout;
+    struct wlterm_window *active_window;
+
+    /* Frames since the back buffer about to be drawn into was last drawn,
+       0 if its contents are undefined. Windows it already shows up to date
+       aren't drawn again. */
+    int buffer_age;
+
+    /* Damage tracking. A frame callback is only requested when something was
+       drawn, so an idle frame gets no wakeups at all. */
+    bool dirty;
+    struct wl_callback *frame_callback;
+
+    uint64_t rendered_frames;
+    uint64_t skipped_frames;
+
+    /* Server clients waiting for the first frame to be drawn, -1 if none. */
+    int notify_fd;
+    bool close_after_first_frame;
+
+    struct wlterm_histogram render_times;
+    struct wlterm_gpu_timer gpu_timer;
+
+    /* Oldest key press not on screen yet, and the one whose presentation
+       is being waited for, in CLOCK_MONOTONIC us. */
+    uint64_t input_time;
+    uint64_t latency_input_time;
+    struct wp_presentation_feedback *latency_feedback;
+
+    /* Drawing is put off until just in time for the next refresh, so input
+       arriving meanwhile still makes it (see frame_render_time). From
+       presentation feedback: the last presentation and the refresh period,
+       0 while unknown. The slowest recent frame and the slack left for the
+       compositor, grown when a frame misses its refresh. The refresh the
+       frame being drawn, and the one waited for, were meant for. When the
+       last frame was drawn. All in CLOCK_MONOTONIC ns. */
+    uint64_t last_presented;
+    uint64_t refresh;
+    uint64_t render_estimate;
+    uint64_t slack;
+    uint64_t target;
+    uint64_t feedback_target;
+    uint64_t drawn_at;
+};
 
+/* Glyphs of a window collected during rendering, drawn with a single
+   msdfgl_render call. The buffer is kept around between frames. Batches are
+   filled on the render pool, so adding glyphs touches nothing shared. */
+struct wlterm_text_batch {
+    msdfgl_font_t font;
+    float size;
+    float advance;
+
+    /* Glyphs not generated yet are drawn as a placeholder in the meantime,
+       and requested from here when the batch is flushed. */
+    struct wlterm_glyph_worker *glyph_worker;
+    bool missing;
+    int32_t *requests;
+    int n_requests;
+    int requests_capacity;
+
+    msdfgl_glyph_t *glyphs;
+    int n_glyphs;
+    int capacity;
+
+    /* The glyphs again, grouped by atlas page. */
+    msdfgl_glyph_t *by_page;
+    int by_page_capacity;
+
+    uint64_t draw_calls;
+    uint64_t glyphs_drawn;
+    uint64_t misses;
+};
+
+/* Cell backgrounds other than the default, one rectangle per run of cells of
+   the same color, drawn under the text. */
+struct wlterm_bg_batch {
+    GLfloat *vertices;  /* Two triangles per run. */
+    uint32_t *colors;   /* The run's color for each of its 6 vertices. */
+    int n_runs;
+    int capacity;
+};
+
+/* Width and height of the sprite texture. */
+#define WLTERM_SPRITES_SIZE 2048
+
+struct wlterm_sprite {
+    int32_t codepoint;  /* -1 for an empty table entry. */
+    int32_t index;
+};
+
+/* Glyphs drawn once each, white on transparent, into a slot the size of a
+ * cell at the frame's scale: what the cell render mode samples. Slot 0 is
+ * left empty for blank cells.
+ *
+ * When the scale, the font or its size change, or the texture is full, the
+ * sprites start over and `generation` goes up: cells referring to the old
+ * ones are uploaded again. */
+struct wlterm_sprites {
+    GLuint fbo;
+    GLuint texture;
+
+    msdfgl_font_t font;
+    float size;
+    float scale;
+    int slot_width;  /* In pixels, a cell rounded up. */
+    int slot_height;
+    int per_row;
+    int capacity;
+    int n_sprites;
+    uint64_t generation;
+
+    /* Codepoint to sprite, open addressing. */
+    struct wlterm_sprite *table;
+    int table_size;
+
+    /* Added, to be drawn before the cells using them. */
+    struct wlterm_sprite *pending;
+    int n_pending;
+
+    struct wlterm_text_batch text;
+
+    uint64_t drawn;
+    uint64_t resets;
+};
+
+/* The window's cells in the cell render mode, a RGBA32UI texel each: the
+ * sprite, foreground, background and attributes. Rows are packed on the
+ * render pool when they changed, and uploaded when the window is drawn. */
+struct wlterm_cell_grid {
+    GLuint texture;
+    int texture_rows;
+    int texture_cols;
+
+    bool active;  /* Used for the window's current contents. */
+    bool valid;   /* The texture holds every row. */
+    uint64_t generation;  /* Of the sprites it refers to. */
+
+    int rows;
+    int cols;
+    uint32_t *cells;  /* Four words per cell, the codepoint until uploaded. */
+    int *changed;     /* Rows packed for the next upload. */
+    int n_changed;
+    uint8_t *stale;   /* Rows that drew placeholders, packed again. */
+
+    uint64_t uploaded;  /* Cells. */
+};
+
+/* Rows drawn while scrolled back, kept in a texture so that scrolling only
+ * draws the rows it brings into view and moves the rest on the GPU.
+ *
+ * Lines are numbered from the oldest in the scrollback through the grid,
+ * line l is kept in slot l % n_slots. Scrolled back the rows don't change:
+ * new output jumps back to the bottom, which doesn't use the ring. */
+struct wlterm_row_ring {
+    GLuint fbo;
+    GLuint texture;
+    int texture_width;
+    int texture_height;
+
+    bool active;  /* Used for the window's current contents. */
+    bool valid;
+    int width;
+    int slot_height;  /* The cell height, rounded up. */
+    int n_slots;
+    float scale;
+    msdfgl_font_t font;
+    uint64_t *lines;  /* Line in each slot, UINT64_MAX for none. */
+
+    /* Slots to draw into in the next frame. */
+    int *drawn;
+    int n_drawn;
 };
 
 struct wlterm_window {
@@ -85,24 +465,95 @@ struct wlterm_window {
     int height;
 
     mat4 projection;
+
+    struct wlterm_layout *layout;
+
+    /* Area needing a redraw, in window coordinates. */
+    bool dirty;
+    struct wlterm_rect damage;
+
+    /* Drawn into the next frame: damaged, or out of date in its buffer. */
+    bool redraw;
+    uint64_t drawn_frame;  /* Frame the current contents were first drawn in. */
+
+    struct wlterm_text_batch text;
+    struct wlterm_bg_batch bg;
+
+    /* Rows laid out in earlier frames. The key of every visible row is kept
+       too, so rows that haven't changed aren't even hashed again. */
+    struct wlterm_run_cache runs;
+    uint64_t *row_keys;
+    int row_keys_rows;
+    int row_keys_cols;
+    msdfgl_font_t row_keys_font;
+    float row_keys_size;
+    bool row_keys_valid;
+
+    struct wlterm_grid *grid;
+    struct wlterm_vt *vt;
+    struct wlterm_pty *pty;
+
+    /* When the application began the synchronized update it is in the
+       middle of (DECSET 2026), in CLOCK_MONOTONIC ns, 0 for none. And
+       when its output last got half the PTY ring ahead of parsing, 0 for
+       never. Either puts drawing the frame off, see frame_render_time. */
+    uint64_t sync_start;
+    uint64_t flood_seen;
+
+    struct wlterm_scrollback *scrollback;
+    int scroll_offset;      /* Lines scrolled back from the bottom. */
+    float scroll_fraction;  /* And pixels, less than a line. */
+    struct wlterm_row_ring ring;
+    struct wlterm_cell_grid cells;
+
+    /* A file being viewed, shown instead of the grid. */
+    struct wlterm_document *document;
+    size_t document_top;  /* Line at the top of the window. */
+
+    /* Size of a grid cell in pixels. */
+    float cell_width;
+    float cell_height;
 };
 
 
 
 struct wlterm_application *wlterm_application_create();
+struct wlterm_application *wlterm_application_create_headless();
 void wlterm_application_destroy(struct wlterm_application *);
 int wlterm_application_run(struct wlterm_application *);
 struct wlterm_frame *wlterm_frame_create(struct wlterm_application *);
 void wlterm_frame_destroy(struct wlterm_frame *);
+void wlterm_frame_read_pixels(struct wlterm_frame *, uint8_t *rgba);
 struct wlterm_window *wlterm_window_create(struct wlterm_frame *);
 void wlterm_window_destroy(struct wlterm_window *);
+struct wlterm_window *wlterm_window_split(struct wlterm_window *, enum wlterm_split);
+void wlterm_window_resize_split(struct wlterm_window *, enum wlterm_split, int delta);
 
 
 #define FOR_EACH_WINDOW(frame, w) \
     for (struct wlterm_window *w = frame->root_window; w; w = w->next)
 
 void wlterm_frame_resize(struct wlterm_frame *, int, int);
+void wlterm_frame_set_scale(struct wlterm_frame *, double);
+void wlterm_frame_layout(struct wlterm_frame *);
 void wlterm_frame_render(struct wlterm_frame *);
+void wlterm_application_render(struct wlterm_application *);
+void wlterm_frame_schedule(struct wlterm_frame *);
+
+void wlterm_text_batch_begin(struct wlterm_text_batch *, msdfgl_font_t, float);
+float wlterm_text_batch_add_run(struct wlterm_text_batch *, float, float, uint32_t,
+                                const char *);
+void wlterm_text_batch_add_glyph(struct wlterm_text_batch *, float, float, uint32_t,
+                                 int32_t);
+void wlterm_text_batch_flush(struct wlterm_text_batch *, GLfloat *);
+void wlterm_text_batch_release(struct wlterm_text_batch *);
+
+void wlterm_window_damage(struct wlterm_window *, int, int, int, int);
+void wlterm_window_damage_all(struct wlterm_window *);
+void wlterm_window_scroll(struct wlterm_window *, int lines);
+bool wlterm_window_scroll_pixels(struct wlterm_window *, double pixels);
+void wlterm_window_view_document(struct wlterm_window *, struct wlterm_document *);
+void wlterm_window_read_pty(struct wlterm_window *);
 
 #define WLTERM_CHECK_GLERROR \
     do {                                                             \